@@ -0,0 +1,586 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Class benchmark: samples/s and trigger to pad update latency
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// The benchmark loads a class shared object and runs it in a minimal
+// host runtime providing the HAKit object, pad, property and main loop
+// primitives the classes use. It drives the 'trig' input pad at
+// increasing rates, and measures the time between each trigger and the
+// next output pad update. Run it with the device simulator preloaded
+// to benchmark classes without any hardware.
+//
+// Results are printed as one JSON object per line and rate.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "log.h"
+#include "mod.h"
+#include "prop.h"
+#include "sys.h"
+
+#define DEFAULT_RATES "10,20,50,100,200,500,1000,2000,5000"
+#define DEFAULT_DURATION 2.0
+#define DRAIN_US 2000000
+#define MAX_PROPS 32
+#define MAX_PADS 64
+#define MAX_TAGS 256
+
+int opt_debug = 0;
+static int opt_verbose = 0;
+
+
+/*
+ * Host runtime: objects and properties
+ */
+
+typedef struct {
+	hk_obj_t obj;
+	int nprops;
+	char *names[MAX_PROPS];
+	char *values[MAX_PROPS];
+	int npads;
+	hk_pad_t *pads[MAX_PADS];
+} bench_obj_t;
+
+static bench_obj_t bench_obj;
+
+
+void log_str(char *fmt, ...)
+{
+	va_list ap;
+
+	if (!opt_verbose && (strstr(fmt, "ERROR") == NULL) && (strstr(fmt, "PANIC") == NULL)) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+
+char *hk_prop_get(hk_prop_t *props, char *name)
+{
+	int i;
+
+	if (props != &bench_obj.obj.props) {
+		return NULL;
+	}
+
+	for (i = 0; i < bench_obj.nprops; i++) {
+		if (strcmp(bench_obj.names[i], name) == 0) {
+			return bench_obj.values[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+int hk_prop_get_int(hk_prop_t *props, char *name)
+{
+	char *value = hk_prop_get(props, name);
+
+	if (value == NULL) {
+		return 0;
+	}
+
+	return strtol(value, NULL, 0);
+}
+
+
+static void bench_prop_set(char *name, char *value)
+{
+	int i;
+
+	for (i = 0; i < bench_obj.nprops; i++) {
+		if (strcmp(bench_obj.names[i], name) == 0) {
+			bench_obj.values[i] = value;
+			return;
+		}
+	}
+
+	if (bench_obj.nprops < MAX_PROPS) {
+		bench_obj.names[bench_obj.nprops] = name;
+		bench_obj.values[bench_obj.nprops] = value;
+		bench_obj.nprops++;
+	}
+}
+
+
+/*
+ * Host runtime: pads
+ */
+
+static hk_pad_t *bench_trig = NULL;
+static uint64_t bench_outstanding = 0;   // Time of oldest unanswered trigger, 0 if none
+static uint32_t *bench_lat = NULL;
+static int bench_lat_size = 0;
+static int bench_nsamples = 0;
+static int bench_nupdates = 0;
+
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+hk_pad_t *hk_pad_create(hk_obj_t *obj, hk_pad_dir_t dir, char *name)
+{
+	hk_pad_t *pad = calloc(1, sizeof(hk_pad_t));
+
+	(void) dir;
+
+	pad->obj = obj;
+	pad->name = strdup(name);
+
+	if (bench_obj.npads < MAX_PADS) {
+		bench_obj.pads[bench_obj.npads++] = pad;
+	}
+
+	return pad;
+}
+
+
+int hk_pad_is_connected(hk_pad_t *pad)
+{
+	(void) pad;
+	return 1;
+}
+
+
+/* Tell sensor data pads from the ones added by the common publishing
+   code: statistics, acquisition timestamps and rollup windows */
+static int bench_pad_is_data(hk_pad_t *pad)
+{
+	char *name = pad->name;
+	int len = strlen(name);
+	char *s;
+
+	if (strcmp(name, "stats") == 0) {
+		return 0;
+	}
+
+	if ((len > 3) && (strcmp(name + len - 3, "_ts") == 0)) {
+		return 0;
+	}
+
+	s = strrchr(name, '_');
+	if ((s != NULL) &&
+	    ((strncmp(s, "_min", 4) == 0) || (strncmp(s, "_max", 4) == 0) || (strncmp(s, "_avg", 4) == 0)) &&
+	    isdigit(s[4])) {
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static void bench_pad_updated(hk_pad_t *pad)
+{
+	uint64_t t = now_us();
+
+	bench_nupdates++;
+
+	if (!bench_pad_is_data(pad)) {
+		return;
+	}
+
+	/* First data update after a trigger completes all pending triggers */
+	if (bench_outstanding != 0) {
+		if (bench_nsamples < bench_lat_size) {
+			bench_lat[bench_nsamples] = t - bench_outstanding;
+		}
+		bench_nsamples++;
+		bench_outstanding = 0;
+	}
+}
+
+
+void hk_pad_update_int(hk_pad_t *pad, int value)
+{
+	if (opt_verbose > 1) {
+		fprintf(stderr, "%s.%s = %d\n", pad->obj->name, pad->name, value);
+	}
+	bench_pad_updated(pad);
+}
+
+
+void hk_pad_update_str(hk_pad_t *pad, char *value)
+{
+	if (opt_verbose > 1) {
+		fprintf(stderr, "%s.%s = '%s'\n", pad->obj->name, pad->name, value);
+	}
+	bench_pad_updated(pad);
+}
+
+
+/*
+ * Host runtime: main loop
+ */
+
+typedef struct {
+	sys_tag_t tag;
+	int fd;                // -1 for timeouts
+	uint64_t deadline;
+	unsigned long delay;
+	sys_func_t func;
+	sys_io_func_t io_func;
+	void *arg;
+} bench_src_t;
+
+static bench_src_t bench_srcs[MAX_TAGS];
+static sys_tag_t bench_next_tag = 1;
+
+
+static bench_src_t *bench_src_new(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_TAGS; i++) {
+		bench_src_t *src = &bench_srcs[i];
+		if (src->tag == 0) {
+			memset(src, 0, sizeof(*src));
+			src->tag = bench_next_tag++;
+			src->fd = -1;
+			return src;
+		}
+	}
+
+	fprintf(stderr, "PANIC: Too many event sources\n");
+	exit(1);
+}
+
+
+sys_tag_t sys_timeout(unsigned long delay, sys_func_t func, void *arg)
+{
+	bench_src_t *src = bench_src_new();
+
+	src->delay = delay;
+	src->deadline = now_us() + (delay * 1000);
+	src->func = func;
+	src->arg = arg;
+
+	return src->tag;
+}
+
+
+sys_tag_t sys_io_watch(int fd, sys_io_func_t func, void *arg)
+{
+	bench_src_t *src = bench_src_new();
+
+	src->fd = fd;
+	src->io_func = func;
+	src->arg = arg;
+
+	return src->tag;
+}
+
+
+void sys_remove(sys_tag_t tag)
+{
+	int i;
+
+	if (tag == 0) {
+		return;
+	}
+
+	for (i = 0; i < MAX_TAGS; i++) {
+		if (bench_srcs[i].tag == tag) {
+			bench_srcs[i].tag = 0;
+			return;
+		}
+	}
+}
+
+
+static void bench_iterate(uint64_t until)
+{
+	struct pollfd fds[MAX_TAGS];
+	sys_tag_t tags[MAX_TAGS];
+	struct timespec ts;
+	uint64_t t = now_us();
+	uint64_t deadline = until;
+	int nfds = 0;
+	int i;
+
+	for (i = 0; i < MAX_TAGS; i++) {
+		bench_src_t *src = &bench_srcs[i];
+
+		if (src->tag == 0) {
+			continue;
+		}
+
+		if (src->fd >= 0) {
+			fds[nfds].fd = src->fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			tags[nfds] = src->tag;
+			nfds++;
+		}
+		else if (src->deadline < deadline) {
+			deadline = src->deadline;
+		}
+	}
+
+	if (deadline < t) {
+		deadline = t;
+	}
+
+	ts.tv_sec = (deadline - t) / 1000000;
+	ts.tv_nsec = ((deadline - t) % 1000000) * 1000;
+
+	if (ppoll(fds, nfds, &ts, NULL) > 0) {
+		for (i = 0; i < nfds; i++) {
+			if (fds[i].revents) {
+				int k;
+				for (k = 0; k < MAX_TAGS; k++) {
+					bench_src_t *src = &bench_srcs[k];
+					if ((src->tag == tags[i]) && (src->fd >= 0)) {
+						if (src->io_func(src->arg, src->fd) == 0) {
+							src->tag = 0;
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	t = now_us();
+
+	for (i = 0; i < MAX_TAGS; i++) {
+		bench_src_t *src = &bench_srcs[i];
+
+		if ((src->tag != 0) && (src->fd < 0) && (src->deadline <= t)) {
+			sys_tag_t tag = src->tag;
+
+			if (src->func(src->arg)) {
+				if (src->tag == tag) {
+					src->deadline += src->delay * 1000;
+				}
+			}
+			else if (src->tag == tag) {
+				src->tag = 0;
+			}
+		}
+	}
+}
+
+
+/*
+ * Benchmark
+ */
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t va = *((uint32_t *) a);
+	uint32_t vb = *((uint32_t *) b);
+	return (va > vb) - (va < vb);
+}
+
+
+static uint64_t cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ((uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000) +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+static void bench_run(hk_class_t *class, double rate, double duration)
+{
+	uint64_t period = (uint64_t) (1e6 / rate);
+	uint64_t t0, t_end, t_next, t_last;
+	uint64_t cpu0, cpu;
+	int ntrigs = 0;
+	double elapsed;
+	uint32_t p50 = 0, p99 = 0;
+
+	bench_lat_size = (int) (rate * duration) + 1;
+	bench_lat = realloc(bench_lat, bench_lat_size * sizeof(uint32_t));
+	bench_nsamples = 0;
+	bench_nupdates = 0;
+	bench_outstanding = 0;
+
+	cpu0 = cpu_us();
+	t0 = now_us();
+	t_end = t0 + (uint64_t) (duration * 1e6);
+	t_next = t0;
+
+	while (now_us() < t_end) {
+		uint64_t t = now_us();
+
+		if (t >= t_next) {
+			if (bench_outstanding == 0) {
+				bench_outstanding = t;
+			}
+			class->input(bench_trig, "1");
+			ntrigs++;
+
+			/* Do not try to catch up when the loop falls behind */
+			t_next += period;
+			if (t_next < t) {
+				t_next = t + period;
+			}
+		}
+
+		bench_iterate((t_next < t_end) ? t_next : t_end);
+	}
+
+	/* Wait for the last trigger to complete */
+	t_last = now_us();
+	while ((bench_outstanding != 0) && (now_us() < t_last + DRAIN_US)) {
+		bench_iterate(now_us() + 10000);
+	}
+
+	cpu = cpu_us() - cpu0;
+	elapsed = ((double) (now_us() - t0)) / 1e6;
+
+	if (bench_nsamples > 0) {
+		int n = (bench_nsamples < bench_lat_size) ? bench_nsamples : bench_lat_size;
+		qsort(bench_lat, n, sizeof(uint32_t), cmp_u32);
+		p50 = bench_lat[(n * 50) / 100];
+		p99 = bench_lat[((n * 99) / 100 < n) ? (n * 99) / 100 : n-1];
+	}
+
+	printf("{\"class\":\"%s\",\"version\":\"%s\",\"rate\":%g,\"duration\":%.3f,"
+	       "\"triggers\":%d,\"samples\":%d,\"updates\":%d,\"samples_per_sec\":%.1f,"
+	       "\"p50_us\":%u,\"p99_us\":%u,\"cpu_us_per_sample\":%.1f}\n",
+	       class->name, class->version, rate, elapsed,
+	       ntrigs, bench_nsamples, bench_nupdates, bench_nsamples / elapsed,
+	       p50, p99, bench_nsamples ? ((double) cpu) / bench_nsamples : 0.0);
+	fflush(stdout);
+}
+
+
+static void usage(char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-v] [-r rate,...] [-t seconds] <class.so> [name=value ...]\n", argv0);
+	fprintf(stderr, "  -v           Increase verbosity\n");
+	fprintf(stderr, "  -r rates     Trigger rates in Hz (default: " DEFAULT_RATES ")\n");
+	fprintf(stderr, "  -t seconds   Duration of each rate step (default: %g)\n", DEFAULT_DURATION);
+	fprintf(stderr, "Object properties are given as name=value arguments.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	char *rates = DEFAULT_RATES;
+	double duration = DEFAULT_DURATION;
+	hk_class_t *class;
+	void *dl;
+	char *s, *s1;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "vr:t:")) != -1) {
+		switch (opt) {
+		case 'v':
+			opt_verbose++;
+			opt_debug++;
+			break;
+		case 'r':
+			rates = optarg;
+			break;
+		case 't':
+			duration = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dl = dlopen(argv[optind], RTLD_NOW | RTLD_GLOBAL);
+	if (dl == NULL) {
+		fprintf(stderr, "ERROR: %s\n", dlerror());
+		return 2;
+	}
+
+	class = dlsym(dl, "_class");
+	if (class == NULL) {
+		fprintf(stderr, "ERROR: %s: No class definition found\n", argv[optind]);
+		return 2;
+	}
+
+	/* Publish every sample by default, so that each one can be timed */
+	bench_prop_set("max_interval", "1");
+
+	for (i = optind+1; i < argc; i++) {
+		char *value = strchr(argv[i], '=');
+		if (value == NULL) {
+			usage(argv[0]);
+			return 1;
+		}
+		*(value++) = '\0';
+		bench_prop_set(argv[i], value);
+	}
+
+	bench_obj.obj.name = "bench";
+
+	if (class->new(&bench_obj.obj) != 0) {
+		fprintf(stderr, "ERROR: Failed to create %s object\n", class->name);
+		return 3;
+	}
+
+	for (i = 0; i < bench_obj.npads; i++) {
+		if (strcmp(bench_obj.pads[i]->name, "trig") == 0) {
+			bench_trig = bench_obj.pads[i];
+		}
+	}
+
+	if (bench_trig == NULL) {
+		fprintf(stderr, "ERROR: Class %s has no trig pad\n", class->name);
+		return 3;
+	}
+
+	if (class->start != NULL) {
+		class->start(&bench_obj.obj);
+	}
+
+	/* Let the object settle */
+	bench_iterate(now_us() + 100000);
+
+	for (s = strtok_r(rates, ",", &s1); s != NULL; s = strtok_r(NULL, ",", &s1)) {
+		double rate = strtod(s, NULL);
+		if (rate > 0) {
+			bench_run(class, rate, duration);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Bus transaction recorder
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Recording is enabled by setting HAKIT_BUSLOG to a file path before
+// starting the engine. Each transaction attempt is appended with a single
+// write() on a file opened with O_APPEND, so that several objects and
+// class libraries of the same process can share the same log.
+// The log can be replayed with the device simulator (see classes/sim).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "buslog.h"
+
+#define BUSLOG_BUFSIZE 512
+
+static pthread_once_t buslog_once = PTHREAD_ONCE_INIT;
+static int buslog_fd = -1;
+
+
+static void buslog_open(void)
+{
+        char *path = getenv(BUSLOG_ENV);
+        struct stat st;
+
+        if ((path == NULL) || (*path == '\0')) {
+                return;
+        }
+
+        buslog_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (buslog_fd < 0) {
+                log_str("ERROR: Cannot open bus log %s: %s", path, strerror(errno));
+                return;
+        }
+
+        /* Write file header if we are the first writer */
+        if ((fstat(buslog_fd, &st) == 0) && (st.st_size == 0)) {
+                buslog_hdr_t hdr = {
+                        .magic = BUSLOG_MAGIC,
+                        .version = BUSLOG_VERSION,
+                        .rec_size = sizeof(buslog_rec_t),
+                };
+
+                if (write(buslog_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+                        log_str("ERROR: Cannot write bus log %s: %s", path, strerror(errno));
+                        close(buslog_fd);
+                        buslog_fd = -1;
+                        return;
+                }
+        }
+
+        log_str("Recording bus transactions to %s", path);
+}
+
+
+int buslog_enabled(void)
+{
+        pthread_once(&buslog_once, buslog_open);
+        return (buslog_fd >= 0);
+}
+
+
+void buslog_start(struct timespec *t0)
+{
+        if (buslog_enabled()) {
+                clock_gettime(CLOCK_MONOTONIC, t0);
+        }
+}
+
+
+static void buslog_write(buslog_bus_t type, int bus, int addr, struct timespec *t0, int error,
+                         uint8_t *prefix, int prefix_len, uint8_t *tx, int tx_len, uint8_t *rx, int rx_len)
+{
+        int saved_errno = errno;
+        int size = sizeof(buslog_rec_t) + prefix_len + tx_len + rx_len;
+        uint8_t sbuf[BUSLOG_BUFSIZE];
+        uint8_t *buf = (size <= (int) sizeof(sbuf)) ? sbuf : malloc(size);
+        buslog_rec_t *rec = (buslog_rec_t *) buf;
+        uint8_t *data = buf + sizeof(buslog_rec_t);
+        struct timespec t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        rec->t = ((uint64_t) t0->tv_sec * 1000000000) + t0->tv_nsec;
+        rec->duration = ((t1.tv_sec - t0->tv_sec) * 1000000000L) + (t1.tv_nsec - t0->tv_nsec);
+        rec->type = type;
+        rec->bus = bus;
+        rec->addr = addr;
+        rec->status = error ? saved_errno : 0;
+        rec->tx_len = prefix_len + tx_len;
+        rec->rx_len = rx_len;
+
+        if (prefix_len > 0) {
+                memcpy(data, prefix, prefix_len);
+        }
+        if (tx_len > 0) {
+                memcpy(data + prefix_len, tx, tx_len);
+        }
+        if (rx_len > 0) {
+                memcpy(data + prefix_len + tx_len, rx, rx_len);
+        }
+
+        if (write(buslog_fd, buf, size) != size) {
+                log_str("ERROR: Cannot write bus log: %s", strerror(errno));
+        }
+
+        if (buf != sbuf) {
+                free(buf);
+        }
+
+        errno = saved_errno;
+}
+
+
+void buslog_i2c(int bus, int addr, struct timespec *t0, uint8_t command,
+                uint8_t *tx, int tx_len, uint8_t *rx, int rx_len, int error)
+{
+        if (buslog_fd < 0) {
+                return;
+        }
+
+        buslog_write(BUSLOG_I2C, bus, addr, t0, error, &command, 1, tx, tx_len, rx, error ? 0 : rx_len);
+}
+
+
+void buslog_spi(int bus, int cs, struct timespec *t0, uint8_t *tx, uint8_t *rx, int len, int error)
+{
+        if (buslog_fd < 0) {
+                return;
+        }
+
+        buslog_write(BUSLOG_SPI, bus, cs, t0, error, NULL, 0, tx, len, rx, error ? 0 : len);
+}
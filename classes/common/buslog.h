@@ -0,0 +1,58 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Bus transaction recorder
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_BUSLOG_H__
+#define __HAKIT_BUSLOG_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define BUSLOG_ENV "HAKIT_BUSLOG"   // Environment variable giving the log file path
+
+/*
+ * Log file format (little-endian):
+ *   buslog_hdr_t, then a sequence of records made of
+ *   buslog_rec_t, tx_len request bytes, rx_len response bytes.
+ */
+
+#define BUSLOG_MAGIC   "HKBL"
+#define BUSLOG_VERSION 1
+
+typedef enum {
+        BUSLOG_I2C=1,
+        BUSLOG_SPI=2,
+} buslog_bus_t;
+
+typedef struct __attribute__((packed)) {
+        char magic[4];
+        uint16_t version;
+        uint16_t rec_size;     // sizeof(buslog_rec_t), for forward compatibility
+} buslog_hdr_t;
+
+typedef struct __attribute__((packed)) {
+        uint64_t t;            // Transaction start time (ns, CLOCK_MONOTONIC)
+        uint32_t duration;     // Transaction duration (ns)
+        uint8_t type;          // buslog_bus_t
+        uint8_t bus;           // Bus number
+        uint8_t addr;          // I2C slave address or SPI chip select
+        uint8_t status;        // errno value, 0 if successful
+        uint16_t tx_len;       // Bytes written
+        uint16_t rx_len;       // Bytes read
+} buslog_rec_t;
+
+extern int buslog_enabled(void);
+extern void buslog_start(struct timespec *t0);
+extern void buslog_i2c(int bus, int addr, struct timespec *t0, uint8_t command,
+                       uint8_t *tx, int tx_len, uint8_t *rx, int rx_len, int error);
+extern void buslog_spi(int bus, int cs, struct timespec *t0,
+                       uint8_t *tx, uint8_t *rx, int len, int error);
+
+#endif /* __HAKIT_BUSLOG_H__ */
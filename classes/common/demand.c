@@ -0,0 +1,111 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Demand-driven sampling
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Sampling an output nobody consumes wastes CPU, bus bandwidth and sensor
+// power. The published outputs of an object, along with their timestamp
+// and rollup companion pads, are checked for consumers at a slow pace on
+// the main loop: when none is connected any more, the class is asked to
+// suspend sampling, i.e. stop its periodic timer and put the chip in
+// power-down mode; it is asked to resume as soon as a consumer shows up
+// again. Outputs exported to shared memory or history are always wanted.
+//
+// The check is enabled by default, and disabled by setting the 'demand'
+// property to 0. The active state is read without locking by ticker
+// threads, to skip samples while suspended.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "prop.h"
+#include "demand.h"
+
+
+static int demand_connected(demand_t *demand)
+{
+        int i;
+
+        for (i = 0; i < demand->npubs; i++) {
+                if (pub_is_connected(demand->pubs[i])) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+
+static int demand_check(demand_t *demand)
+{
+        int active = demand_connected(demand);
+
+        if (active != demand->active) {
+                log_str("%s%s sampling: %s", demand->hdr, active ? "Resuming":"Suspending",
+                        active ? "output connected":"no output connected");
+                __atomic_store_n(&demand->active, active, __ATOMIC_RELAXED);
+                demand->func(demand->arg, active);
+        }
+
+        return 1;
+}
+
+
+void demand_init(demand_t *demand, hk_obj_t *obj, char *hdr, demand_func_t func, void *arg)
+{
+        char *str = hk_prop_get(&obj->props, "demand");
+
+        memset(demand, 0, sizeof(demand_t));
+        demand->hdr = strdup(hdr);
+        demand->enabled = (str == NULL) || (atoi(str) != 0);
+        demand->active = 1;
+        demand->func = func;
+        demand->arg = arg;
+}
+
+
+void demand_add_pub(demand_t *demand, pub_t *pub)
+{
+        if (demand->npubs < DEMAND_MAX_PUBS) {
+                demand->pubs[demand->npubs++] = pub;
+        }
+}
+
+
+void demand_start(demand_t *demand)
+{
+        if (!demand->enabled || (demand->npubs == 0) || (demand->tag != 0)) {
+                return;
+        }
+
+        demand_check(demand);
+        demand->tag = sys_timeout(DEMAND_CHECK_INTERVAL, (sys_func_t) demand_check, demand);
+}
+
+
+void demand_cleanup(demand_t *demand)
+{
+        if (demand->tag != 0) {
+                sys_remove(demand->tag);
+                demand->tag = 0;
+        }
+
+        if (demand->hdr != NULL) {
+                free(demand->hdr);
+                demand->hdr = NULL;
+        }
+}
+
+
+int demand_active(demand_t *demand)
+{
+        return __atomic_load_n(&demand->active, __ATOMIC_RELAXED);
+}
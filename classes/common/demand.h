@@ -0,0 +1,43 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Demand-driven sampling
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_DEMAND_H__
+#define __HAKIT_DEMAND_H__
+
+#include "mod.h"
+#include "sys.h"
+#include "pub.h"
+
+#define DEMAND_MAX_PUBS 32
+#define DEMAND_CHECK_INTERVAL 1000  // Consumer check period (ms)
+
+/* Called on the main loop when sampling must be suspended (active=0) or resumed (active=1) */
+typedef void (*demand_func_t)(void *arg, int active);
+
+typedef struct {
+        char *hdr;
+        int enabled;           // Demand tracking enabled ('demand' property)
+        int active;            // At least one output has a consumer
+        pub_t *pubs[DEMAND_MAX_PUBS];
+        int npubs;
+        demand_func_t func;
+        void *arg;
+        sys_tag_t tag;
+} demand_t;
+
+extern void demand_init(demand_t *demand, hk_obj_t *obj, char *hdr, demand_func_t func, void *arg);
+extern void demand_add_pub(demand_t *demand, pub_t *pub);
+extern void demand_start(demand_t *demand);
+extern void demand_cleanup(demand_t *demand);
+
+extern int demand_active(demand_t *demand);
+
+#endif /* __HAKIT_DEMAND_H__ */
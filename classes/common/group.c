@@ -0,0 +1,211 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Phase-aligned sampling groups
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Objects given the same 'group' property name are sampled by a single
+// aligned ticker thread: at each tick, members are run back to back,
+// sorted by bus so that transactions on a bus are not interleaved with
+// other work, and their samples get the tick deadline as common
+// acquisition time.
+//
+// All members of a group must share the same period. The group registry
+// is process-wide, as the common code is one library shared by all
+// classes: objects of different classes join the same group, and run
+// from the same ticker thread.
+//
+// Different groups run from different threads, and aligned tickers fire
+// together when their periods have common multiples. Each bus has a
+// process-wide lock, held by a group while its members on that bus run,
+// so that groups take turns on a bus instead of interleaving their
+// transactions. A group holds one bus lock at a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "pub.h"
+#include "group.h"
+
+typedef struct group_s {
+        char *name;
+        int period;
+        ticker_t ticker;
+        pthread_mutex_t mutex;
+        group_member_t *members;
+        struct group_s *next;
+} group_t;
+
+typedef struct group_bus_s {
+        char *name;
+        pthread_mutex_t mutex;
+        struct group_bus_s *next;
+} group_bus_t;
+
+static group_t *group_list = NULL;
+static group_bus_t *group_buses = NULL;
+
+
+static int group_tick(group_t *group)
+{
+        group_member_t *member;
+        pthread_mutex_t *bus_lock = NULL;
+        struct timespec mono, real;
+        pub_ts_t ts;
+        long ofs_ns;
+
+        /* Sample time is the tick deadline, in both clocks */
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_REALTIME, &real);
+        ofs_ns = (mono.tv_sec - group->ticker.deadline.tv_sec) * 1000000000L + (mono.tv_nsec - group->ticker.deadline.tv_nsec);
+
+        ts.mono = group->ticker.deadline;
+        ts.real.tv_sec = real.tv_sec - (ofs_ns / 1000000000L);
+        ts.real.tv_nsec = real.tv_nsec - (ofs_ns % 1000000000L);
+        if (ts.real.tv_nsec < 0) {
+                ts.real.tv_nsec += 1000000000L;
+                ts.real.tv_sec--;
+        }
+        else if (ts.real.tv_nsec >= 1000000000L) {
+                ts.real.tv_nsec -= 1000000000L;
+                ts.real.tv_sec++;
+        }
+
+        pub_ts_hold(&ts);
+
+        pthread_mutex_lock(&group->mutex);
+
+        for (member = group->members; member != NULL; member = member->next) {
+                /* Members are sorted by bus: switch bus locks between runs */
+                if (member->bus_lock != bus_lock) {
+                        if (bus_lock != NULL) {
+                                pthread_mutex_unlock(bus_lock);
+                        }
+                        bus_lock = member->bus_lock;
+                        pthread_mutex_lock(bus_lock);
+                }
+
+                iostats_jitter(member->stats, group->ticker.late_us);
+                iostats_missed(member->stats, group->ticker.overruns);
+
+                if (member->func(member->arg) != 0) {
+                        iostats_missed(member->stats, 1);
+                }
+        }
+
+        if (bus_lock != NULL) {
+                pthread_mutex_unlock(bus_lock);
+        }
+
+        pthread_mutex_unlock(&group->mutex);
+
+        pub_ts_hold(NULL);
+
+        return 0;
+}
+
+
+static group_t *group_find(char *name)
+{
+        group_t *group;
+
+        for (group = group_list; group != NULL; group = group->next) {
+                if (strcmp(group->name, name) == 0) {
+                        return group;
+                }
+        }
+
+        return NULL;
+}
+
+
+static pthread_mutex_t *group_bus_lock(char *name)
+{
+        group_bus_t *bus;
+
+        for (bus = group_buses; bus != NULL; bus = bus->next) {
+                if (strcmp(bus->name, name) == 0) {
+                        return &bus->mutex;
+                }
+        }
+
+        bus = malloc(sizeof(group_bus_t));
+        bus->name = strdup(name);
+        pthread_mutex_init(&bus->mutex, NULL);
+        bus->next = group_buses;
+        group_buses = bus;
+
+        return &bus->mutex;
+}
+
+
+int group_join(char *name, char *bus, int period, ticker_func_t func, void *arg, iostats_t *stats, char *hdr)
+{
+        group_t *group = group_find(name);
+        group_member_t *member;
+        group_member_t **pmember;
+
+        if (group == NULL) {
+                group = malloc(sizeof(group_t));
+                memset(group, 0, sizeof(group_t));
+                group->name = strdup(name);
+                group->period = period;
+                pthread_mutex_init(&group->mutex, NULL);
+                ticker_init(&group->ticker);
+                group->ticker.align = 1;
+
+                /* Jitter is accounted in the member statistics */
+                if (ticker_start(&group->ticker, hdr, period, (ticker_func_t) group_tick, group, NULL) < 0) {
+                        pthread_mutex_destroy(&group->mutex);
+                        free(group->name);
+                        free(group);
+                        return -1;
+                }
+
+                group->next = group_list;
+                group_list = group;
+        }
+        else if (group->period != period) {
+                log_str("ERROR: %sPeriod %d ms does not match sampling group '%s' (%d ms)", hdr, period, name, group->period);
+                return -1;
+        }
+
+        /* Already a member */
+        for (member = group->members; member != NULL; member = member->next) {
+                if ((member->func == func) && (member->arg == arg)) {
+                        return 0;
+                }
+        }
+
+        member = malloc(sizeof(group_member_t));
+        member->bus = strdup(bus);
+        member->bus_lock = group_bus_lock(bus);
+        member->func = func;
+        member->arg = arg;
+        member->stats = stats;
+
+        /* Keep members sorted by bus, in joining order */
+        pthread_mutex_lock(&group->mutex);
+
+        pmember = &group->members;
+        while ((*pmember != NULL) && (strcmp((*pmember)->bus, bus) <= 0)) {
+                pmember = &((*pmember)->next);
+        }
+        member->next = *pmember;
+        *pmember = member;
+
+        pthread_mutex_unlock(&group->mutex);
+
+        log_str("%sJoined sampling group '%s' on %s", hdr, name, bus);
+
+        return 0;
+}
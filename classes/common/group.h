@@ -0,0 +1,31 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Phase-aligned sampling groups
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_GROUP_H__
+#define __HAKIT_GROUP_H__
+
+#include <pthread.h>
+
+#include "iostats.h"
+#include "ticker.h"
+
+typedef struct group_member_s {
+        char *bus;             // Bus identifier, members on the same bus run back to back
+        pthread_mutex_t *bus_lock; // Process-wide bus lock, held while members of the bus run
+        ticker_func_t func;    // Sampling function, run by the group thread
+        void *arg;
+        iostats_t *stats;
+        struct group_member_s *next;
+} group_member_t;
+
+extern int group_join(char *name, char *bus, int period, ticker_func_t func, void *arg, iostats_t *stats, char *hdr);
+
+#endif /* __HAKIT_GROUP_H__ */
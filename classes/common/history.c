@@ -0,0 +1,506 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Compressed on-device sample history
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// When the 'history' property gives a size in KB, published pad values
+// are also appended to a ring file <history_dir>/<object>.hist, mapped in
+// memory, so that samples survive an uplink outage or a restart and can
+// be fetched later by time range.
+//
+// The ring is made of fixed-size blocks, each holding samples of a single
+// pad. The first sample of a block is stored as is in the block header;
+// the following ones are bit-packed, most significant bit first:
+//
+//   time delta-of-delta (ms)          value delta (zigzag)
+//   '0'                 0             '0'               0
+//   '10'   + 7 bits     [-64,63]      '10'  + 6 bits    < 2^6
+//   '110'  + 9 bits     [-256,255]    '110' + 13 bits   < 2^13
+//   '1110' + 12 bits    [-2048,2047]  '111' + 32 bits
+//   '1111' + 32 bits
+//
+// Periodic samples of a slowly changing value thus take 2 bits. Pad
+// values are integers, so plain deltas are used rather than the XOR of
+// floating point representations.
+//
+// Block counters are updated after the encoded bits, so that a block is
+// consistent whenever the process stops. When the ring is full, the
+// oldest block is reused. Blocks older than the 'retention' property
+// (in seconds) are released when a new block is allocated, and ignored
+// by queries.
+//
+// Queries decode the blocks of a series overlapping a time range, oldest
+// first. The ring file can be read while the object is running, e.g. by
+// the hkhist reader tool, which also has a codec round-trip check.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "history.h"
+
+_Static_assert(sizeof(history_header_t) <= HISTORY_HEADER_SIZE, "history_header_t too large");
+_Static_assert(sizeof(history_block_t) == HISTORY_BLOCK_SIZE, "history_block_t layout changed");
+
+#define HISTORY_DATA_BITS ((int) (sizeof(((history_block_t *) 0)->data) * 8))
+#define HISTORY_MAX_SAMPLE_BITS (4 + 32 + 3 + 32)
+
+
+static void history_put(history_block_t *block, unsigned int *pos, uint32_t bits, int n)
+{
+        while (n > 0) {
+                n--;
+                if ((bits >> n) & 1) {
+                        block->data[*pos / 8] |= 0x80 >> (*pos % 8);
+                }
+                (*pos)++;
+        }
+}
+
+
+static uint32_t history_get(history_block_t *block, unsigned int *pos, int n)
+{
+        uint32_t bits = 0;
+
+        while (n > 0) {
+                n--;
+                bits = (bits << 1) | ((block->data[*pos / 8] >> (7 - (*pos % 8))) & 1);
+                (*pos)++;
+        }
+
+        return bits;
+}
+
+
+static int64_t history_now(void)
+{
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        return ((int64_t) t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+
+static int history_expired(history_t *hist, history_block_t *block, int64_t now)
+{
+        return (hist->retention > 0) && (block->t_last < now - ((int64_t) hist->retention * 1000));
+}
+
+
+static int history_in_use(history_t *hist, history_block_t *block)
+{
+        int i;
+
+        for (i = 0; i < HISTORY_MAX_SERIES; i++) {
+                if (hist->series[i].block == block) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+
+static history_block_t *history_alloc(history_t *hist, int series)
+{
+        uint32_t nblocks = hist->header->nblocks;
+        history_block_t *block;
+        int64_t now = history_now();
+        unsigned int i;
+
+        /* Release expired blocks */
+        if (hist->retention > 0) {
+                for (i = 0; i < nblocks; i++) {
+                        block = &hist->blocks[i];
+                        if ((block->seq != 0) && history_expired(hist, block, now) && !history_in_use(hist, block)) {
+                                block->seq = 0;
+                        }
+                }
+        }
+
+        /* Reuse the oldest block, skipping blocks being filled */
+        do {
+                hist->head = (hist->head + 1) % nblocks;
+                block = &hist->blocks[hist->head];
+        } while (history_in_use(hist, block));
+
+        /* Let the previous blocks reach the file */
+        msync(hist->header, HISTORY_HEADER_SIZE + nblocks * HISTORY_BLOCK_SIZE, MS_ASYNC);
+
+        memset(block, 0, sizeof(history_block_t));
+        block->series = series;
+        block->seq = ++hist->seq;
+
+        return block;
+}
+
+
+static void history_reset(history_t *hist, uint32_t nblocks)
+{
+        memset(hist->header, 0, HISTORY_HEADER_SIZE);
+        memset(hist->blocks, 0, nblocks * HISTORY_BLOCK_SIZE);
+
+        hist->header->version = HISTORY_VERSION;
+        hist->header->block_size = HISTORY_BLOCK_SIZE;
+        hist->header->nblocks = nblocks;
+        hist->header->magic = HISTORY_MAGIC;
+}
+
+
+static history_t *history_map(char *path, int flags, uint32_t nblocks, char *hdr)
+{
+        history_t *hist = malloc(sizeof(history_t));
+        size_t size = HISTORY_HEADER_SIZE + (size_t) nblocks * HISTORY_BLOCK_SIZE;
+        int prot = ((flags & O_ACCMODE) == O_RDONLY) ? PROT_READ : (PROT_READ | PROT_WRITE);
+        void *map;
+
+        memset(hist, 0, sizeof(history_t));
+        hist->hdr = strdup(hdr);
+
+        hist->fd = open(path, flags | O_CLOEXEC, 0644);
+        if (hist->fd < 0) {
+                log_str("ERROR: %sCannot open history file %s: %s", hdr, path, strerror(errno));
+                goto failed;
+        }
+
+        /* Read-only: take the ring size from the file header */
+        if (nblocks == 0) {
+                history_header_t header;
+                struct stat st;
+
+                if (read(hist->fd, &header, sizeof(header)) != sizeof(header)) {
+                        log_str("ERROR: %sCannot read history file %s", hdr, path);
+                        goto failed;
+                }
+
+                if ((header.magic != HISTORY_MAGIC) || (header.version != HISTORY_VERSION) ||
+                    (header.block_size != HISTORY_BLOCK_SIZE) || (header.nseries > HISTORY_MAX_SERIES)) {
+                        log_str("ERROR: %sUnsupported history file %s", hdr, path);
+                        goto failed;
+                }
+
+                size = HISTORY_HEADER_SIZE + (size_t) header.nblocks * HISTORY_BLOCK_SIZE;
+
+                /* Mapping past the end of a truncated file would fault on access */
+                if ((fstat(hist->fd, &st) < 0) || ((size_t) st.st_size < size)) {
+                        log_str("ERROR: %sTruncated history file %s", hdr, path);
+                        goto failed;
+                }
+        }
+        else if (ftruncate(hist->fd, size) < 0) {
+                log_str("ERROR: %sCannot size history file %s: %s", hdr, path, strerror(errno));
+                goto failed;
+        }
+
+        map = mmap(NULL, size, prot, MAP_SHARED, hist->fd, 0);
+        if (map == MAP_FAILED) {
+                log_str("ERROR: %sCannot map history file %s: %s", hdr, path, strerror(errno));
+                goto failed;
+        }
+        hist->size = size;
+        hist->header = map;
+        hist->blocks = map + HISTORY_HEADER_SIZE;
+
+        return hist;
+
+failed:
+        if (hist->fd >= 0) {
+                close(hist->fd);
+        }
+        free(hist->hdr);
+        free(hist);
+        return NULL;
+}
+
+
+history_t *history_open(char *path, int size_kb, int retention, char *hdr)
+{
+        history_t *hist;
+        uint32_t nblocks;
+        unsigned int i;
+
+        nblocks = ((size_t) size_kb * 1024 - HISTORY_HEADER_SIZE) / HISTORY_BLOCK_SIZE;
+        if (((size_t) size_kb * 1024 <= HISTORY_HEADER_SIZE) || (nblocks < 2 * HISTORY_MAX_SERIES)) {
+                log_str("ERROR: %sHistory size %d KB is too small", hdr, size_kb);
+                return NULL;
+        }
+
+        hist = history_map(path, O_RDWR | O_CREAT, nblocks, hdr);
+        if (hist == NULL) {
+                return NULL;
+        }
+
+        /* Start over if the layout does not match */
+        if ((hist->header->magic != HISTORY_MAGIC) || (hist->header->version != HISTORY_VERSION) ||
+            (hist->header->block_size != HISTORY_BLOCK_SIZE) || (hist->header->nblocks != nblocks) ||
+            (hist->header->nseries > HISTORY_MAX_SERIES)) {
+                log_str("%sCreating history file %s (%u blocks)", hdr, path, nblocks);
+                history_reset(hist, nblocks);
+        }
+        else {
+                /* Resume after the most recent block */
+                for (i = 0; i < nblocks; i++) {
+                        if (hist->blocks[i].seq > hist->seq) {
+                                hist->seq = hist->blocks[i].seq;
+                                hist->head = i;
+                        }
+                }
+                log_str("%sResuming history file %s (%u blocks)", hdr, path, nblocks);
+        }
+
+        hist->retention = (retention > 0) ? retention : 0;
+
+        return hist;
+}
+
+
+history_t *history_load(char *path, char *hdr)
+{
+        /* Read-only access, e.g. from a reader tool while the object is running */
+        return history_map(path, O_RDONLY, 0, hdr);
+}
+
+
+void history_close(history_t *hist)
+{
+        munmap(hist->header, hist->size);
+        close(hist->fd);
+        free(hist->hdr);
+        free(hist);
+}
+
+
+int history_series(history_t *hist, char *name)
+{
+        history_header_t *header = hist->header;
+        int i;
+
+        for (i = 0; i < (int) header->nseries; i++) {
+                if (strncmp(header->series[i], name, HISTORY_NAME_SIZE - 1) == 0) {
+                        return i;
+                }
+        }
+
+        if (header->nseries >= HISTORY_MAX_SERIES) {
+                log_str("ERROR: %sNo history series left for %s", hist->hdr, name);
+                return -1;
+        }
+
+        strncpy(header->series[i], name, HISTORY_NAME_SIZE - 1);
+        header->nseries = i + 1;
+
+        return i;
+}
+
+
+void history_append(history_t *hist, int series, int64_t t, int value)
+{
+        history_series_t *s = &hist->series[series];
+        history_block_t *block = s->block;
+        int64_t dt = t - s->t;
+        int64_t dod = dt - s->dt;
+        int64_t delta = (int64_t) value - s->value;
+        uint64_t zz = ((uint64_t) delta << 1) ^ (delta >> 63);
+        unsigned int pos;
+
+        /* Start a new block when full, or when deltas do not fit */
+        if ((block == NULL) || (block->nbits + HISTORY_MAX_SAMPLE_BITS > HISTORY_DATA_BITS) ||
+            (dod < INT32_MIN) || (dod > INT32_MAX) || (zz > UINT32_MAX)) {
+                block = history_alloc(hist, series);
+                block->value0 = value;
+                block->t_first = t;
+                block->t_last = t;
+                block->count = 1;
+
+                s->block = block;
+                s->t = t;
+                s->dt = 0;
+                s->value = value;
+                return;
+        }
+
+        pos = block->nbits;
+
+        if (dod == 0) {
+                history_put(block, &pos, 0x0, 1);
+        }
+        else if ((dod >= -64) && (dod <= 63)) {
+                history_put(block, &pos, 0x2, 2);
+                history_put(block, &pos, dod, 7);
+        }
+        else if ((dod >= -256) && (dod <= 255)) {
+                history_put(block, &pos, 0x6, 3);
+                history_put(block, &pos, dod, 9);
+        }
+        else if ((dod >= -2048) && (dod <= 2047)) {
+                history_put(block, &pos, 0xE, 4);
+                history_put(block, &pos, dod, 12);
+        }
+        else {
+                history_put(block, &pos, 0xF, 4);
+                history_put(block, &pos, dod, 32);
+        }
+
+        if (zz == 0) {
+                history_put(block, &pos, 0x0, 1);
+        }
+        else if (zz < (1 << 6)) {
+                history_put(block, &pos, 0x2, 2);
+                history_put(block, &pos, zz, 6);
+        }
+        else if (zz < (1 << 13)) {
+                history_put(block, &pos, 0x6, 3);
+                history_put(block, &pos, zz, 13);
+        }
+        else {
+                history_put(block, &pos, 0x7, 3);
+                history_put(block, &pos, zz, 32);
+        }
+
+        /* Counters last, once the sample is encoded */
+        block->t_last = t;
+        block->nbits = pos;
+        block->count++;
+
+        s->t = t;
+        s->dt = dt;
+        s->value = value;
+}
+
+
+static int64_t history_sign(uint32_t bits, int n)
+{
+        /* Sign-extend an n-bit two's complement field */
+        return (int64_t) ((int32_t) (bits << (32 - n)) >> (32 - n));
+}
+
+
+static int history_decode(history_block_t *block, int64_t from, int64_t to, history_sample_t *buf, int max)
+{
+        unsigned int pos = 0;
+        int64_t t = block->t_first;
+        int64_t dt = 0;
+        int64_t value = block->value0;
+        unsigned int nbits = (block->nbits < HISTORY_DATA_BITS) ? block->nbits : HISTORY_DATA_BITS;
+        int count = 0;
+        uint32_t i;
+
+        for (i = 0; (i < block->count) && (count < max); i++) {
+                if (i > 0) {
+                        int64_t dod;
+                        uint32_t zz;
+
+                        /* Do not trust the block header of a file written by someone else:
+                           stop at the end of encoded data, and never read past the block */
+                        if ((pos >= nbits) || (pos + HISTORY_MAX_SAMPLE_BITS > HISTORY_DATA_BITS)) {
+                                break;
+                        }
+
+                        if (history_get(block, &pos, 1) == 0) {
+                                dod = 0;
+                        }
+                        else if (history_get(block, &pos, 1) == 0) {
+                                dod = history_sign(history_get(block, &pos, 7), 7);
+                        }
+                        else if (history_get(block, &pos, 1) == 0) {
+                                dod = history_sign(history_get(block, &pos, 9), 9);
+                        }
+                        else if (history_get(block, &pos, 1) == 0) {
+                                dod = history_sign(history_get(block, &pos, 12), 12);
+                        }
+                        else {
+                                dod = history_sign(history_get(block, &pos, 32), 32);
+                        }
+
+                        if (history_get(block, &pos, 1) == 0) {
+                                zz = 0;
+                        }
+                        else if (history_get(block, &pos, 1) == 0) {
+                                zz = history_get(block, &pos, 6);
+                        }
+                        else if (history_get(block, &pos, 1) == 0) {
+                                zz = history_get(block, &pos, 13);
+                        }
+                        else {
+                                zz = history_get(block, &pos, 32);
+                        }
+
+                        dt += dod;
+                        t += dt;
+                        value += (int64_t) (zz >> 1) ^ -(int64_t) (zz & 1);
+                }
+
+                if ((t >= from) && (t <= to)) {
+                        buf[count].t = t;
+                        buf[count].value = value;
+                        count++;
+                }
+        }
+
+        return count;
+}
+
+
+static int history_cmp(const void *p1, const void *p2)
+{
+        history_block_t *b1 = *((history_block_t **) p1);
+        history_block_t *b2 = *((history_block_t **) p2);
+
+        return (b1->seq > b2->seq) - (b1->seq < b2->seq);
+}
+
+
+int history_query(history_t *hist, char *name, int64_t from, int64_t to, history_sample_t *buf, int max)
+{
+        uint32_t nblocks = hist->header->nblocks;
+        history_block_t **list;
+        int64_t now = history_now();
+        int series = -1;
+        int nlist = 0;
+        int count = 0;
+        unsigned int i;
+
+        for (i = 0; i < hist->header->nseries; i++) {
+                if (strncmp(hist->header->series[i], name, HISTORY_NAME_SIZE - 1) == 0) {
+                        series = i;
+                }
+        }
+
+        if (series < 0) {
+                return 0;
+        }
+
+        /* Blocks of the series overlapping the time range, oldest first */
+        list = malloc(nblocks * sizeof(history_block_t *));
+        for (i = 0; i < nblocks; i++) {
+                history_block_t *block = &hist->blocks[i];
+                if ((block->seq != 0) && (block->series == series) &&
+                    (block->t_last >= from) && (block->t_first <= to) &&
+                    !history_expired(hist, block, now)) {
+                        list[nlist++] = block;
+                }
+        }
+
+        qsort(list, nlist, sizeof(history_block_t *), history_cmp);
+
+        for (i = 0; (i < (unsigned int) nlist) && (count < max); i++) {
+                count += history_decode(list[i], from, to, buf + count, max - count);
+        }
+
+        free(list);
+
+        return count;
+}
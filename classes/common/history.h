@@ -0,0 +1,81 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Compressed on-device sample history
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_HISTORY_H__
+#define __HAKIT_HISTORY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HISTORY_DEFAULT_DIR "/var/lib/hakit"
+#define HISTORY_SUFFIX ".hist"
+
+#define HISTORY_MAGIC 0x54534B48   // "HKST"
+#define HISTORY_VERSION 1
+#define HISTORY_HEADER_SIZE 4096   // File header, padded to a page
+#define HISTORY_BLOCK_SIZE 256
+#define HISTORY_MAX_SERIES 32
+#define HISTORY_NAME_SIZE 32
+
+/* File header, at offset 0 */
+typedef struct {
+        uint32_t magic;        // HISTORY_MAGIC
+        uint16_t version;      // HISTORY_VERSION, bumped on any layout or encoding change
+        uint16_t block_size;   // HISTORY_BLOCK_SIZE
+        uint32_t nblocks;      // Number of blocks in the ring
+        uint32_t nseries;      // Number of series names in use
+        char series[HISTORY_MAX_SERIES][HISTORY_NAME_SIZE];
+} history_header_t;
+
+/* Ring block: samples of one series, decodable on its own */
+typedef struct {
+        uint32_t seq;          // Allocation sequence number, 0 if free
+        uint16_t series;       // Index of the series name in the file header
+        uint16_t nbits;        // Encoded data length
+        uint32_t count;        // Number of samples, including the first one
+        int32_t value0;        // First sample value
+        int64_t t_first;       // First sample time (ms since Epoch)
+        int64_t t_last;        // Last sample time (ms since Epoch)
+        uint8_t data[HISTORY_BLOCK_SIZE - 32];
+} history_block_t;
+
+typedef struct {
+        int64_t t;             // Sample time (ms since Epoch)
+        int value;
+} history_sample_t;
+
+typedef struct {
+        history_block_t *block; // Block being filled, NULL if none
+        int64_t t;             // Last sample time
+        int64_t dt;            // Last time delta
+        int value;             // Last sample value
+} history_series_t;
+
+typedef struct {
+        char *hdr;
+        int fd;
+        size_t size;           // Mapped file size
+        history_header_t *header;
+        history_block_t *blocks;
+        unsigned int head;     // Last allocated block
+        uint32_t seq;          // Last allocation sequence number
+        int retention;         // Maximum sample age (s), 0 if limited by size only
+        history_series_t series[HISTORY_MAX_SERIES];
+} history_t;
+
+extern history_t *history_open(char *path, int size_kb, int retention, char *hdr);
+extern history_t *history_load(char *path, char *hdr);
+extern void history_close(history_t *hist);
+extern int history_series(history_t *hist, char *name);
+extern void history_append(history_t *hist, int series, int64_t t, int value);
+extern int history_query(history_t *hist, char *name, int64_t from, int64_t to, history_sample_t *buf, int max);
+
+#endif /* __HAKIT_HISTORY_H__ */
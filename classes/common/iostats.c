@@ -0,0 +1,356 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Per-object bus i/o statistics
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Counters are updated from the acquisition threads with relaxed atomic
+// increments, and read from the main loop without locking: a dump may
+// be off by a transaction in progress, which is fine for monitoring.
+//
+// Sending SIGUSR1 to the process dumps the statistics of all objects
+// to the log. The list of objects and the signal handler are shared by
+// all classes, as the common code is one library: the handler is
+// installed once, with the first object, and the previous one is put
+// back when the last object goes away. The handler only writes to a pipe
+// watched by the main loop, and chains to the previously installed one.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "iostats.h"
+
+#define IOSTATS_INC(_var_, _n_) __atomic_fetch_add(&(_var_), (_n_), __ATOMIC_RELAXED)
+#define IOSTATS_GET(_var_) __atomic_load_n(&(_var_), __ATOMIC_RELAXED)
+
+static const char *op_names[IOSTATS_NOPS] = { "read", "write", "xfer" };
+
+static iostats_t *iostats_list = NULL;
+static int iostats_pipe[2] = { -1, -1 };
+static sys_tag_t iostats_pipe_tag = 0;
+static struct sigaction iostats_sigaction_prev;
+
+
+static void iostats_sighandler(int sig, siginfo_t *info, void *ucontext)
+{
+        int saved_errno = errno;
+        char c = 0;
+
+        if (write(iostats_pipe[1], &c, 1) < 0) {
+                /* Nothing we can do from a signal handler */
+        }
+
+        errno = saved_errno;
+
+        if (iostats_sigaction_prev.sa_flags & SA_SIGINFO) {
+                if (iostats_sigaction_prev.sa_sigaction != NULL) {
+                        iostats_sigaction_prev.sa_sigaction(sig, info, ucontext);
+                }
+        }
+        else if ((iostats_sigaction_prev.sa_handler != SIG_DFL) && (iostats_sigaction_prev.sa_handler != SIG_IGN)) {
+                iostats_sigaction_prev.sa_handler(sig);
+        }
+}
+
+
+static int iostats_sigusr1(void *user_data, int fd)
+{
+        char buf[16];
+        iostats_t *stats;
+
+        (void) user_data;
+
+        while (read(fd, buf, sizeof(buf)) > 0);
+
+        for (stats = iostats_list; stats != NULL; stats = stats->next) {
+                iostats_dump(stats);
+        }
+
+        return 1;
+}
+
+
+static void iostats_setup_signal(void)
+{
+        struct sigaction sa;
+
+        if (iostats_pipe[0] >= 0) {
+                return;
+        }
+
+        if (pipe2(iostats_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+                log_str("ERROR: Cannot create i/o statistics pipe: %s", strerror(errno));
+                return;
+        }
+
+        iostats_pipe_tag = sys_io_watch(iostats_pipe[0], (sys_io_func_t) iostats_sigusr1, NULL);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = iostats_sighandler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+
+        if (sigaction(SIGUSR1, &sa, &iostats_sigaction_prev) < 0) {
+                log_str("ERROR: Cannot install SIGUSR1 handler: %s", strerror(errno));
+        }
+}
+
+
+static void iostats_cleanup_signal(void)
+{
+        if (iostats_pipe[0] < 0) {
+                return;
+        }
+
+        sigaction(SIGUSR1, &iostats_sigaction_prev, NULL);
+
+        if (iostats_pipe_tag != 0) {
+                sys_remove(iostats_pipe_tag);
+                iostats_pipe_tag = 0;
+        }
+
+        close(iostats_pipe[0]);
+        close(iostats_pipe[1]);
+        iostats_pipe[0] = iostats_pipe[1] = -1;
+}
+
+
+static int iostats_pad_update(iostats_t *stats)
+{
+        char buf[384];
+
+        iostats_format(stats, buf, sizeof(buf));
+        hk_pad_update_str(stats->pad, buf);
+
+        return 1;
+}
+
+
+void iostats_init(iostats_t *stats, hk_obj_t *obj, char *hdr)
+{
+        memset(stats, 0, sizeof(iostats_t));
+        stats->hdr = strdup(hdr);
+
+        stats->next = iostats_list;
+        iostats_list = stats;
+
+        iostats_setup_signal();
+
+        /* Get statistics pad update period property */
+        int period = hk_prop_get_int(&obj->props, "stats");
+        if (period > 0) {
+                stats->pad = hk_pad_create(obj, HK_PAD_OUT, "stats");
+                stats->pad_tag = sys_timeout(period, (sys_func_t) iostats_pad_update, stats);
+        }
+}
+
+
+void iostats_cleanup(iostats_t *stats)
+{
+        iostats_t **pstats = &iostats_list;
+
+        while (*pstats != NULL) {
+                if (*pstats == stats) {
+                        *pstats = stats->next;
+                        break;
+                }
+                pstats = &((*pstats)->next);
+        }
+
+        if (iostats_list == NULL) {
+                iostats_cleanup_signal();
+        }
+
+        if (stats->pad_tag != 0) {
+                sys_remove(stats->pad_tag);
+                stats->pad_tag = 0;
+        }
+
+        if (stats->hdr != NULL) {
+                free(stats->hdr);
+                stats->hdr = NULL;
+        }
+}
+
+
+void iostats_start(struct timespec *t0)
+{
+        clock_gettime(CLOCK_MONOTONIC, t0);
+}
+
+
+static void iostats_hist_add(iostats_counters_t *c, unsigned long us)
+{
+        int bucket = 0;
+
+        while ((us > 0) && (bucket < (IOSTATS_HIST_SIZE-1))) {
+                us >>= 1;
+                bucket++;
+        }
+
+        IOSTATS_INC(c->count, 1);
+        IOSTATS_INC(c->hist[bucket], 1);
+}
+
+
+void iostats_record(iostats_t *stats, iostats_op_t op, struct timespec *t0, int bytes, int error)
+{
+        struct timespec t1;
+
+        if (stats == NULL) {
+                return;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        unsigned long us = ((t1.tv_sec - t0->tv_sec) * 1000000L) + ((t1.tv_nsec - t0->tv_nsec) / 1000);
+
+        iostats_counters_t *c = &stats->ops[op];
+        iostats_hist_add(c, us);
+        if (error) {
+                IOSTATS_INC(c->errors, 1);
+        }
+        else if (bytes > 0) {
+                IOSTATS_INC(c->bytes, bytes);
+        }
+}
+
+
+void iostats_retry(iostats_t *stats)
+{
+        if (stats != NULL) {
+                IOSTATS_INC(stats->retries, 1);
+        }
+}
+
+
+void iostats_jitter(iostats_t *stats, unsigned long us)
+{
+        if (stats == NULL) {
+                return;
+        }
+
+        iostats_hist_add(&stats->jitter, us);
+
+        /* Only the ticker thread of the object updates the maximum */
+        if (us > IOSTATS_GET(stats->jitter_max)) {
+                __atomic_store_n(&stats->jitter_max, us, __ATOMIC_RELAXED);
+        }
+}
+
+
+void iostats_missed(iostats_t *stats, unsigned long count)
+{
+        if (stats != NULL) {
+                IOSTATS_INC(stats->missed, count);
+        }
+}
+
+
+static uint64_t iostats_percentile(iostats_counters_t *c, uint64_t count, int pct)
+{
+        uint64_t target = (count * pct + 99) / 100;
+        uint64_t acc = 0;
+        int i;
+
+        for (i = 0; i < IOSTATS_HIST_SIZE; i++) {
+                acc += IOSTATS_GET(c->hist[i]);
+                if (acc >= target) {
+                        break;
+                }
+        }
+
+        /* Bucket upper bound, in us */
+        return UINT64_C(1) << i;
+}
+
+
+int iostats_format(iostats_t *stats, char *buf, int size)
+{
+        int len = 0;
+        int op;
+
+        buf[0] = '\0';
+
+        for (op = 0; op < IOSTATS_NOPS; op++) {
+                iostats_counters_t *c = &stats->ops[op];
+                uint64_t count = IOSTATS_GET(c->count);
+
+                if ((count > 0) && (len < size)) {
+                        len += snprintf(buf+len, size-len, "%s=%" PRIu64 " err=%" PRIu64 " bytes=%" PRIu64 " p50<%" PRIu64 "us p99<%" PRIu64 "us ",
+                                        op_names[op], count, IOSTATS_GET(c->errors), IOSTATS_GET(c->bytes),
+                                        iostats_percentile(c, count, 50), iostats_percentile(c, count, 99));
+                }
+        }
+
+        if (len < size) {
+                len += snprintf(buf+len, size-len, "retries=%" PRIu64, IOSTATS_GET(stats->retries));
+        }
+
+        uint64_t count = IOSTATS_GET(stats->jitter.count);
+        if ((count > 0) && (len < size)) {
+                len += snprintf(buf+len, size-len, " jitter p50<%" PRIu64 "us p99<%" PRIu64 "us max=%" PRIu64 "us missed=%" PRIu64,
+                                iostats_percentile(&stats->jitter, count, 50),
+                                iostats_percentile(&stats->jitter, count, 99),
+                                IOSTATS_GET(stats->jitter_max), IOSTATS_GET(stats->missed));
+        }
+
+        return len;
+}
+
+
+void iostats_dump(iostats_t *stats)
+{
+        char buf[384];
+        int op, i;
+
+        iostats_format(stats, buf, sizeof(buf));
+        log_str("%sI/O stats: %s", stats->hdr, buf);
+
+        for (op = 0; op < IOSTATS_NOPS; op++) {
+                iostats_counters_t *c = &stats->ops[op];
+                int len = 0;
+
+                if (IOSTATS_GET(c->count) == 0) {
+                        continue;
+                }
+
+                for (i = 0; i < IOSTATS_HIST_SIZE; i++) {
+                        uint64_t n = IOSTATS_GET(c->hist[i]);
+                        if ((n > 0) && (len < (int) sizeof(buf))) {
+                                len += snprintf(buf+len, sizeof(buf)-len, " <%" PRIu64 "us:%" PRIu64, UINT64_C(1) << i, n);
+                        }
+                }
+
+                log_str("%s  %s latency:%s", stats->hdr, op_names[op], buf);
+        }
+
+        if (IOSTATS_GET(stats->jitter.count) > 0) {
+                int len = 0;
+
+                for (i = 0; i < IOSTATS_HIST_SIZE; i++) {
+                        uint64_t n = IOSTATS_GET(stats->jitter.hist[i]);
+                        if ((n > 0) && (len < (int) sizeof(buf))) {
+                                len += snprintf(buf+len, sizeof(buf)-len, " <%" PRIu64 "us:%" PRIu64, UINT64_C(1) << i, n);
+                        }
+                }
+
+                log_str("%s  jitter:%s", stats->hdr, buf);
+        }
+}
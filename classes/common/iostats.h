@@ -0,0 +1,61 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Per-object bus i/o statistics
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_IOSTATS_H__
+#define __HAKIT_IOSTATS_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mod.h"
+#include "sys.h"
+
+#define IOSTATS_HIST_SIZE 24  // Latency buckets: [0] < 1us, [k] = [2^(k-1), 2^k) us
+
+typedef enum {
+        IOSTATS_READ=0,
+        IOSTATS_WRITE,
+        IOSTATS_XFER,
+        IOSTATS_NOPS
+} iostats_op_t;
+
+typedef struct {
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t errors;
+        uint64_t hist[IOSTATS_HIST_SIZE];
+} iostats_counters_t;
+
+typedef struct iostats_s {
+        char *hdr;
+        iostats_counters_t ops[IOSTATS_NOPS];
+        uint64_t retries;
+        iostats_counters_t jitter; // Periodic sample lateness vs deadline
+        uint64_t jitter_max;   // Worst lateness (us)
+        uint64_t missed;       // Periodic samples skipped
+        hk_pad_t *pad;         // Optional 'stats' output pad
+        sys_tag_t pad_tag;
+        struct iostats_s *next;
+} iostats_t;
+
+extern void iostats_init(iostats_t *stats, hk_obj_t *obj, char *hdr);
+extern void iostats_cleanup(iostats_t *stats);
+
+extern void iostats_start(struct timespec *t0);
+extern void iostats_record(iostats_t *stats, iostats_op_t op, struct timespec *t0, int bytes, int error);
+extern void iostats_retry(iostats_t *stats);
+extern void iostats_jitter(iostats_t *stats, unsigned long us);
+extern void iostats_missed(iostats_t *stats, unsigned long count);
+
+extern int iostats_format(iostats_t *stats, char *buf, int size);
+extern void iostats_dump(iostats_t *stats);
+
+#endif /* __HAKIT_IOSTATS_H__ */
@@ -0,0 +1,324 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Sensor pad publishing with deadband and rate limiting
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "pub.h"
+
+/* Sample time imposed on the calling thread, e.g. by a sampling group tick */
+static __thread pub_ts_t *pub_ts_held = NULL;
+
+
+static uint64_t pub_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t) ts.tv_sec) * 1000 + (ts.tv_nsec / 1000000);
+}
+
+
+void pub_ts_hold(pub_ts_t *ts)
+{
+        pub_ts_held = ts;
+}
+
+
+void pub_ts_get(pub_ts_t *ts)
+{
+        if (pub_ts_held != NULL) {
+                *ts = *pub_ts_held;
+                return;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts->mono);
+        clock_gettime(CLOCK_REALTIME, &ts->real);
+}
+
+
+void pub_cfg_init(pub_cfg_t *cfg, hk_prop_t *props)
+{
+        cfg->timestamp = hk_prop_get_int(props, "timestamp");
+
+        cfg->deadband = hk_prop_get(props, "deadband");
+
+        cfg->min_interval = hk_prop_get_int(props, "min_interval");
+        if (cfg->min_interval < 0) {
+                cfg->min_interval = 0;
+        }
+
+        cfg->max_interval = hk_prop_get_int(props, "max_interval");
+        if (cfg->max_interval < 0) {
+                cfg->max_interval = 0;
+        }
+
+        cfg->shm = hk_prop_get_int(props, "shm");
+        cfg->shm_region = NULL;
+
+        cfg->history = hk_prop_get_int(props, "history");
+        cfg->history_ring = NULL;
+
+        cfg->nrollups = rollup_parse(hk_prop_get(props, "rollup"), cfg->rollups, ROLLUP_MAX_WINDOWS);
+}
+
+
+/* Find the deadband of a pad in a list of "<value>" or "<pad>:<value>" entries.
+   A per-pad entry takes precedence over the default value. */
+static int pub_deadband(char *str, char *name)
+{
+        int len = strlen(name);
+        int deadband = 0;
+
+        while ((str != NULL) && (*str != '\0')) {
+                char *end = strchr(str, ',');
+                char *colon = strchr(str, ':');
+
+                if (end == NULL) {
+                        end = str + strlen(str);
+                }
+
+                if ((colon != NULL) && (colon < end)) {
+                        if (((colon - str) == len) && (strncmp(str, name, len) == 0)) {
+                                deadband = atoi(colon + 1);
+                                break;
+                        }
+                }
+                else {
+                        deadband = atoi(str);
+                }
+
+                str = end;
+                while ((*str == ',') || ((*str != '\0') && (*str <= ' '))) {
+                        str++;
+                }
+        }
+
+        return (deadband > 0) ? deadband : 0;
+}
+
+
+void pub_init(pub_t *pub, hk_pad_t *pad, pub_cfg_t *cfg)
+{
+        int i;
+
+        pub->pad = pad;
+        pub->ts_pad = NULL;
+        pub->cfg = cfg;
+        pub->format = NULL;
+        pub->deadband = pub_deadband(cfg->deadband, pad->name);
+        pub->valid = 0;
+        pub->pending = 0;
+        pub->value = 0;
+        pub->t_last = 0;
+        pub->tag = 0;
+        pub->shm_slot = NULL;
+        pub->history_series = -1;
+        memset(&pub->ts, 0, sizeof(pub->ts));
+
+        if (cfg->timestamp) {
+                char name[strlen(pad->name) + 4];
+                snprintf(name, sizeof(name), "%s_ts", pad->name);
+                pub->ts_pad = hk_pad_create(pad->obj, HK_PAD_OUT, name);
+        }
+
+        if (cfg->shm) {
+                if (cfg->shm_region == NULL) {
+                        char hdr[strlen(pad->obj->name) + 4];
+                        snprintf(hdr, sizeof(hdr), "%s: ", pad->obj->name);
+                        cfg->shm_region = shm_open_object(pad->obj, hdr);
+
+                        /* Do not retry for the other pads */
+                        if (cfg->shm_region == NULL) {
+                                cfg->shm = 0;
+                        }
+                }
+
+                if (cfg->shm_region != NULL) {
+                        pub->shm_slot = shm_slot_alloc(cfg->shm_region, pad->name);
+                }
+        }
+
+        if (cfg->history > 0) {
+                if (cfg->history_ring == NULL) {
+                        char *dir = hk_prop_get(&pad->obj->props, "history_dir");
+                        if (dir == NULL) {
+                                dir = HISTORY_DEFAULT_DIR;
+                        }
+
+                        char path[strlen(dir) + strlen(pad->obj->name) + 16];
+                        snprintf(path, sizeof(path), "%s/%s" HISTORY_SUFFIX, dir, pad->obj->name);
+
+                        char hdr[strlen(pad->obj->name) + 4];
+                        snprintf(hdr, sizeof(hdr), "%s: ", pad->obj->name);
+                        cfg->history_ring = history_open(path, cfg->history, hk_prop_get_int(&pad->obj->props, "retention"), hdr);
+
+                        /* Do not retry for the other pads */
+                        if (cfg->history_ring == NULL) {
+                                cfg->history = 0;
+                        }
+                }
+
+                if (cfg->history_ring != NULL) {
+                        pub->history_series = history_series(cfg->history_ring, pad->name);
+                }
+        }
+
+        for (i = 0; i < cfg->nrollups; i++) {
+                rollup_init(&pub->rollups[i], pad, cfg->rollups[i]);
+        }
+}
+
+
+void pub_set_format(pub_t *pub, pub_format_t format)
+{
+        pub->format = format;
+}
+
+
+static void pub_emit(pub_t *pub, int value, pub_ts_t *ts, uint64_t now)
+{
+        if (pub->tag != 0) {
+                sys_remove(pub->tag);
+                pub->tag = 0;
+        }
+
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        log_debug(3, "%s: acquisition to update latency = %ld us", pub->pad->name,
+                  ((t.tv_sec - ts->mono.tv_sec) * 1000000L) + ((t.tv_nsec - ts->mono.tv_nsec) / 1000));
+
+        /* Timestamp goes first so that consumers can match it with the value */
+        if (pub->ts_pad != NULL) {
+                char str[32];
+                snprintf(str, sizeof(str), "%ld.%03ld", (long) ts->real.tv_sec, ts->real.tv_nsec / 1000000);
+                hk_pad_update_str(pub->ts_pad, str);
+        }
+
+        /* Keep published values for later retrieval */
+        if (pub->history_series >= 0) {
+                history_append(pub->cfg->history_ring, pub->history_series,
+                               ((int64_t) ts->real.tv_sec * 1000) + (ts->real.tv_nsec / 1000000), value);
+        }
+
+        pub->pad->state = value;
+        pub->valid = 1;
+        pub->pending = 0;
+        pub->t_last = now;
+
+        if (pub->format != NULL) {
+                char str[32];
+                pub->format(str, sizeof(str), value);
+                hk_pad_update_str(pub->pad, str);
+        }
+        else {
+                hk_pad_update_int(pub->pad, value);
+        }
+}
+
+
+static int pub_flush(pub_t *pub)
+{
+        pub->tag = 0;
+
+        if (pub->pending) {
+                pub_emit(pub, pub->value, &pub->ts, pub_now());
+        }
+
+        return 0;
+}
+
+
+void pub_update(pub_t *pub, int value, pub_ts_t *ts, int force)
+{
+        pub_cfg_t *cfg = pub->cfg;
+        uint64_t now = pub_now();
+        pub_ts_t ts_now;
+
+        if (ts == NULL) {
+                pub_ts_get(&ts_now);
+                ts = &ts_now;
+        }
+
+        /* Shared memory gets every sample */
+        if (pub->shm_slot != NULL) {
+                shm_slot_write(pub->shm_slot, value, &ts->mono, &ts->real);
+        }
+
+        /* So do rollup windows */
+        if (cfg->nrollups > 0) {
+                int64_t t = ((int64_t) ts->real.tv_sec * 1000) + (ts->real.tv_nsec / 1000000);
+                int i;
+
+                for (i = 0; i < cfg->nrollups; i++) {
+                        rollup_add(&pub->rollups[i], t, value, pub->format);
+                }
+        }
+
+        if (pub->valid && !force) {
+                int delta = abs(value - pub->pad->state);
+                int changed = (pub->deadband > 0) ? (delta > pub->deadband) : (delta != 0);
+                int stale = (cfg->max_interval > 0) && ((now - pub->t_last) >= (uint64_t) cfg->max_interval);
+
+                /* Drop changes that stay within the deadband */
+                if (!(changed || stale)) {
+                        pub->pending = 0;
+                        return;
+                }
+
+                /* Too early: keep the latest value for a trailing update */
+                if ((cfg->min_interval > 0) && ((now - pub->t_last) < (uint64_t) cfg->min_interval)) {
+                        pub->value = value;
+                        pub->ts = *ts;
+                        pub->pending = 1;
+
+                        if (pub->tag == 0) {
+                                unsigned long delay = cfg->min_interval - (now - pub->t_last);
+                                pub->tag = sys_timeout(delay, (sys_func_t) pub_flush, pub);
+                        }
+
+                        log_debug(3, "%s: update delayed", pub->pad->name);
+                        return;
+                }
+        }
+
+        pub_emit(pub, value, ts, now);
+}
+
+
+int pub_is_connected(pub_t *pub)
+{
+        int i;
+
+        /* Shared memory readers and history cannot be tracked: always wanted */
+        if ((pub->shm_slot != NULL) || (pub->history_series >= 0)) {
+                return 1;
+        }
+
+        if (hk_pad_is_connected(pub->pad)) {
+                return 1;
+        }
+
+        if ((pub->ts_pad != NULL) && hk_pad_is_connected(pub->ts_pad)) {
+                return 1;
+        }
+
+        for (i = 0; i < pub->cfg->nrollups; i++) {
+                rollup_t *rollup = &pub->rollups[i];
+                if (hk_pad_is_connected(rollup->min_pad) || hk_pad_is_connected(rollup->max_pad) || hk_pad_is_connected(rollup->avg_pad)) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Sensor pad publishing with deadband and rate limiting
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_PUB_H__
+#define __HAKIT_PUB_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mod.h"
+#include "sys.h"
+#include "shm.h"
+#include "history.h"
+#include "rollup.h"
+
+typedef struct {
+        struct timespec mono;  // Acquisition time, for latency measurement
+        struct timespec real;  // Acquisition time, for correlation with other sensors
+} pub_ts_t;
+
+typedef struct {
+        int timestamp;         // Publish acquisition time on a companion pad
+        char *deadband;        // Minimum change to publish, in pad value units: "<default>,<pad>:<value>,..."
+        int min_interval;      // Minimum time between two updates (ms)
+        int max_interval;      // Maximum time without update, checked at each sample (ms)
+        int shm;               // Export latest values to shared memory
+        shm_t *shm_region;     // Shared memory region of the object, created on first pad
+        int history;           // Size of the compressed history ring file (KB)
+        history_t *history_ring; // History ring file of the object, opened on first pad
+        int rollups[ROLLUP_MAX_WINDOWS]; // Rollup window lengths (s)
+        int nrollups;
+} pub_cfg_t;
+
+typedef void (*pub_format_t)(char *buf, int size, int value);
+
+typedef struct {
+        hk_pad_t *pad;
+        hk_pad_t *ts_pad;      // Companion timestamp pad '<pad>_ts'
+        pub_cfg_t *cfg;
+        pub_format_t format;   // Publish as string if not NULL
+        int deadband;          // Minimum change to publish for this pad
+        int valid;             // A value was already published
+        int pending;           // A rate-limited value is waiting
+        int value;             // Pending value
+        pub_ts_t ts;           // Pending value acquisition time
+        uint64_t t_last;       // Time of last update (ms)
+        sys_tag_t tag;
+        shm_slot_t *shm_slot;  // Shared memory export slot, if enabled
+        int history_series;    // History series of the pad, -1 if disabled
+        rollup_t rollups[ROLLUP_MAX_WINDOWS];
+} pub_t;
+
+extern void pub_ts_get(pub_ts_t *ts);
+extern void pub_ts_hold(pub_ts_t *ts);
+
+extern void pub_cfg_init(pub_cfg_t *cfg, hk_prop_t *props);
+
+extern void pub_init(pub_t *pub, hk_pad_t *pad, pub_cfg_t *cfg);
+extern void pub_set_format(pub_t *pub, pub_format_t format);
+extern void pub_update(pub_t *pub, int value, pub_ts_t *ts, int force);
+extern int pub_is_connected(pub_t *pub);
+
+#endif /* __HAKIT_PUB_H__ */
@@ -0,0 +1,135 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Streaming min/max/avg rollup windows
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// The 'rollup' property gives a list of window lengths in seconds, e.g.
+// rollup=60,3600. For each published pad and each window, the minimum,
+// maximum and average of all samples, whatever the deadband and rate
+// limiting, are published on pads '<pad>_min<window>', '<pad>_max<window>'
+// and '<pad>_avg<window>' when the window closes.
+//
+// Windows are aligned on multiples of their length in real time, so that
+// e.g. hourly rollups cover wall clock hours. A window is closed by the
+// first sample past its end: nothing is published for windows without
+// samples. Each sample costs a few comparisons and additions per window,
+// with no allocation.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "rollup.h"
+
+
+int rollup_parse(char *str, int *windows, int max)
+{
+        int n = 0;
+
+        while ((str != NULL) && (*str != '\0') && (n < max)) {
+                char *end;
+                long v = strtol(str, &end, 0);
+
+                if (end == str) {
+                        break;
+                }
+
+                if (v > 0) {
+                        windows[n++] = v;
+                }
+
+                str = end;
+                while ((*str == ',') || ((*str != '\0') && (*str <= ' '))) {
+                        str++;
+                }
+        }
+
+        return n;
+}
+
+
+static hk_pad_t *rollup_pad(hk_pad_t *pad, char *stat, int window)
+{
+        char name[strlen(pad->name) + 24];
+        snprintf(name, sizeof(name), "%s_%s%d", pad->name, stat, window);
+        return hk_pad_create(pad->obj, HK_PAD_OUT, name);
+}
+
+
+void rollup_init(rollup_t *rollup, hk_pad_t *pad, int window)
+{
+        memset(rollup, 0, sizeof(rollup_t));
+        rollup->window = window;
+        rollup->min_pad = rollup_pad(pad, "min", window);
+        rollup->max_pad = rollup_pad(pad, "max", window);
+        rollup->avg_pad = rollup_pad(pad, "avg", window);
+}
+
+
+static void rollup_update(hk_pad_t *pad, int value, rollup_format_t format)
+{
+        pad->state = value;
+
+        if (format != NULL) {
+                char str[32];
+                format(str, sizeof(str), value);
+                hk_pad_update_str(pad, str);
+        }
+        else {
+                hk_pad_update_int(pad, value);
+        }
+}
+
+
+static void rollup_close(rollup_t *rollup, rollup_format_t format)
+{
+        int64_t half = rollup->count / 2;
+        int avg;
+
+        /* Average rounded to nearest */
+        if (rollup->sum >= 0) {
+                avg = (rollup->sum + half) / (int64_t) rollup->count;
+        }
+        else {
+                avg = (rollup->sum - half) / (int64_t) rollup->count;
+        }
+
+        rollup_update(rollup->min_pad, rollup->min, format);
+        rollup_update(rollup->max_pad, rollup->max, format);
+        rollup_update(rollup->avg_pad, avg, format);
+}
+
+
+void rollup_add(rollup_t *rollup, int64_t t, int value, rollup_format_t format)
+{
+        int64_t window_ms = (int64_t) rollup->window * 1000;
+
+        /* Sample past the current window: publish it and start a new one */
+        if (t >= rollup->t_end) {
+                if (rollup->count > 0) {
+                        rollup_close(rollup, format);
+                }
+
+                rollup->t_end = (t / window_ms + 1) * window_ms;
+                rollup->min = value;
+                rollup->max = value;
+                rollup->sum = 0;
+                rollup->count = 0;
+        }
+
+        if (value < rollup->min) {
+                rollup->min = value;
+        }
+        if (value > rollup->max) {
+                rollup->max = value;
+        }
+        rollup->sum += value;
+        rollup->count++;
+}
@@ -0,0 +1,39 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Streaming min/max/avg rollup windows
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_ROLLUP_H__
+#define __HAKIT_ROLLUP_H__
+
+#include <stdint.h>
+
+#include "mod.h"
+
+#define ROLLUP_MAX_WINDOWS 4
+
+typedef void (*rollup_format_t)(char *buf, int size, int value);
+
+typedef struct {
+        int window;            // Window length (s)
+        hk_pad_t *min_pad;     // '<pad>_min<window>'
+        hk_pad_t *max_pad;     // '<pad>_max<window>'
+        hk_pad_t *avg_pad;     // '<pad>_avg<window>'
+        int64_t t_end;         // End of the current window (ms since Epoch)
+        int min;
+        int max;
+        int64_t sum;
+        unsigned long count;
+} rollup_t;
+
+extern int rollup_parse(char *str, int *windows, int max);
+extern void rollup_init(rollup_t *rollup, hk_pad_t *pad, int window);
+extern void rollup_add(rollup_t *rollup, int64_t t, int value, rollup_format_t format);
+
+#endif /* __HAKIT_ROLLUP_H__ */
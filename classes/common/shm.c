@@ -0,0 +1,133 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Shared-memory latest-value export
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// When the 'shm' property is set, the latest sample of each published pad
+// is also written to a region /dev/shm/hakit.<object>, so that processes
+// on the same node can poll it at any rate with plain memory reads.
+//
+// Each pad owns a cache-line sized slot, protected by a sequence lock:
+// the counter is odd while the slot is written, and readers retry when
+// it is odd or changed during their copy (see shm_slot_read()). Slots are
+// written by the main loop only, on every sample, regardless of the
+// deadband and rate limiting applied to pad updates. The writer never
+// waits for readers.
+//
+// The layout is fixed and versioned: readers must check magic, version,
+// header and slot sizes before use, and only look at the first 'nslots'
+// slots. The region is recreated at object creation; the writer pid lets
+// readers detect a stale region.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "shm.h"
+
+_Static_assert(sizeof(shm_header_t) == 64, "shm_header_t layout changed");
+_Static_assert(sizeof(shm_slot_t) == 64, "shm_slot_t layout changed");
+
+#define SHM_SIZE (sizeof(shm_header_t) + SHM_MAX_SLOTS * sizeof(shm_slot_t))
+
+
+shm_t *shm_open_object(hk_obj_t *obj, char *hdr)
+{
+        char path[strlen(obj->name) + 32];
+        shm_t *shm;
+        void *map;
+        int fd;
+
+        snprintf(path, sizeof(path), SHM_DIR SHM_PREFIX "%s", obj->name);
+
+        /* Readers of a previous instance keep their own mapping */
+        unlink(path);
+
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+                log_str("ERROR: %sCannot create shared memory region %s: %s", hdr, path, strerror(errno));
+                return NULL;
+        }
+
+        if (ftruncate(fd, SHM_SIZE) < 0) {
+                log_str("ERROR: %sCannot size shared memory region %s: %s", hdr, path, strerror(errno));
+                goto failed;
+        }
+
+        map = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                log_str("ERROR: %sCannot map shared memory region %s: %s", hdr, path, strerror(errno));
+                goto failed;
+        }
+
+        shm = malloc(sizeof(shm_t));
+        shm->fd = fd;
+        shm->header = map;
+        shm->slots = map + sizeof(shm_header_t);
+
+        /* Region is zero-filled by ftruncate(): set header, magic last */
+        shm->header->version = SHM_VERSION;
+        shm->header->header_size = sizeof(shm_header_t);
+        shm->header->slot_size = sizeof(shm_slot_t);
+        shm->header->max_slots = SHM_MAX_SLOTS;
+        shm->header->pid = getpid();
+        strncpy(shm->header->object, obj->name, SHM_NAME_SIZE - 1);
+        __atomic_store_n(&shm->header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+        log_str("%sExporting latest values to %s", hdr, path);
+
+        return shm;
+
+failed:
+        close(fd);
+        unlink(path);
+        return NULL;
+}
+
+
+shm_slot_t *shm_slot_alloc(shm_t *shm, char *name)
+{
+        uint32_t n = shm->header->nslots;
+        shm_slot_t *slot;
+
+        if (n >= SHM_MAX_SLOTS) {
+                log_str("ERROR: %s: No shared memory slot left", name);
+                return NULL;
+        }
+
+        slot = &shm->slots[n];
+        strncpy(slot->name, name, SHM_NAME_SIZE - 1);
+
+        /* Slot becomes visible to readers once named */
+        __atomic_store_n(&shm->header->nslots, n + 1, __ATOMIC_RELEASE);
+
+        return slot;
+}
+
+
+void shm_slot_write(shm_slot_t *slot, int value, struct timespec *mono, struct timespec *real)
+{
+        uint32_t seq = slot->seq;
+
+        __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->count, slot->count + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->mono_ns, (int64_t) mono->tv_sec * 1000000000 + mono->tv_nsec, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->real_ns, (int64_t) real->tv_sec * 1000000000 + real->tv_nsec, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,89 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Shared-memory latest-value export
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_SHM_H__
+#define __HAKIT_SHM_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "mod.h"
+
+#define SHM_DIR "/dev/shm/"
+#define SHM_PREFIX "hakit."
+
+#define SHM_MAGIC 0x48534B48   // "HKSH"
+#define SHM_VERSION 1
+#define SHM_MAX_SLOTS 32
+#define SHM_NAME_SIZE 32
+
+/* Region header, at offset 0 */
+typedef struct {
+        uint32_t magic;        // SHM_MAGIC, written last when the region is ready
+        uint16_t version;      // SHM_VERSION, bumped on any layout change
+        uint16_t header_size;  // sizeof(shm_header_t)
+        uint16_t slot_size;    // sizeof(shm_slot_t)
+        uint16_t max_slots;    // Number of slots in the region
+        uint32_t nslots;       // Number of slots in use, only grows
+        uint32_t pid;          // Writer process
+        uint32_t reserved[3];
+        char object[SHM_NAME_SIZE]; // Object name
+} shm_header_t;
+
+/* Latest sample of a pad, one per cache line */
+typedef struct {
+        uint32_t seq;          // Sequence lock: odd while the slot is being written
+        int32_t value;         // Pad value, in pad units
+        uint64_t count;        // Number of samples written
+        int64_t mono_ns;       // Acquisition time, CLOCK_MONOTONIC
+        int64_t real_ns;       // Acquisition time, CLOCK_REALTIME
+        char name[SHM_NAME_SIZE]; // Pad name, set before the slot is counted in nslots
+} shm_slot_t;
+
+typedef struct {
+        int fd;
+        shm_header_t *header;
+        shm_slot_t *slots;
+} shm_t;
+
+extern shm_t *shm_open_object(hk_obj_t *obj, char *hdr);
+extern shm_slot_t *shm_slot_alloc(shm_t *shm, char *name);
+extern void shm_slot_write(shm_slot_t *slot, int value, struct timespec *mono, struct timespec *real);
+
+
+/* Reader side: get a consistent copy of a slot without any syscall.
+   Returns 0 on success, -1 if the writer kept updating it. */
+static inline int shm_slot_read(shm_slot_t *slot, shm_slot_t *copy)
+{
+        int tries;
+
+        for (tries = 0; tries < 100; tries++) {
+                uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+                if (seq & 1) {
+                        continue;
+                }
+
+                copy->value = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+                copy->count = __atomic_load_n(&slot->count, __ATOMIC_RELAXED);
+                copy->mono_ns = __atomic_load_n(&slot->mono_ns, __ATOMIC_RELAXED);
+                copy->real_ns = __atomic_load_n(&slot->real_ns, __ATOMIC_RELAXED);
+
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+                        copy->seq = seq;
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+#endif /* __HAKIT_SHM_H__ */
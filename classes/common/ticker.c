@@ -0,0 +1,217 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Precise periodic sampling ticker
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Periodic sampling with sys_timeout() drifts with whatever else the main
+// loop is doing, and each timeout is relative to the previous dispatch.
+// When the 'precise' property is set, a class samples from a dedicated
+// thread instead, woken by a timerfd armed with absolute deadlines on
+// CLOCK_MONOTONIC: sample times stay on a fixed grid whatever the
+// processing time, and late wakeups do not accumulate.
+//
+// The lateness of each wakeup against its deadline is recorded in the
+// object i/o statistics as a log2 histogram, along with the samples
+// missed because the thread overran a period or the acquisition was
+// still in progress. The ticker thread gets the same real-time settings
+// as the worker pool.
+//
+// Aligned tickers put their deadlines on multiples of the period since
+// the monotonic clock origin, so that all aligned tickers with the same
+// period fire together, even from different class libraries. A paused
+// ticker is disarmed, and resumes on its original deadline grid.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "log.h"
+#include "worker.h"
+#include "ticker.h"
+
+
+static uint64_t ticker_ns(struct timespec *t)
+{
+        return (uint64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+
+static void ticker_set(struct timespec *t, uint64_t ns)
+{
+        t->tv_sec = ns / 1000000000;
+        t->tv_nsec = ns % 1000000000;
+}
+
+
+static void *ticker_loop(void *arg)
+{
+        ticker_t *ticker = arg;
+        uint64_t period_ns = ticker_ns(&ticker->period);
+
+        while (1) {
+                uint64_t expirations;
+                struct timespec now;
+                uint64_t now_ns, origin_ns;
+
+                if (read(ticker->fd, &expirations, sizeof(expirations)) < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        log_str("PANIC: %sCannot read ticker timer: %s", ticker->hdr, strerror(errno));
+                        break;
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+
+                /* Handle the last expired deadline of the grid */
+                now_ns = ticker_ns(&now);
+                origin_ns = ticker_ns(&ticker->origin);
+                if (now_ns < origin_ns) {
+                        now_ns = origin_ns;
+                }
+                ticker_set(&ticker->deadline, now_ns - ((now_ns - origin_ns) % period_ns));
+
+                ticker->overruns = expirations - 1;
+                iostats_missed(ticker->stats, ticker->overruns);
+
+                ticker->late_us = (ticker_ns(&now) - ticker_ns(&ticker->deadline)) / 1000;
+                iostats_jitter(ticker->stats, ticker->late_us);
+
+                if (ticker->func(ticker->arg) != 0) {
+                        iostats_missed(ticker->stats, 1);
+                }
+        }
+
+        return NULL;
+}
+
+
+static int ticker_arm(ticker_t *ticker)
+{
+        uint64_t period_ns = ticker_ns(&ticker->period);
+        uint64_t origin_ns = ticker_ns(&ticker->origin);
+        struct itimerspec its;
+        struct timespec now;
+        uint64_t now_ns;
+
+        /* Next deadline of the grid */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ns = ticker_ns(&now);
+        if (now_ns < origin_ns) {
+                its.it_value = ticker->origin;
+        }
+        else {
+                ticker_set(&its.it_value, now_ns - ((now_ns - origin_ns) % period_ns) + period_ns);
+        }
+        its.it_interval = ticker->period;
+
+        if (timerfd_settime(ticker->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+                log_str("ERROR: %sCannot arm ticker timer: %s", ticker->hdr, strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+
+void ticker_init(ticker_t *ticker)
+{
+        memset(ticker, 0, sizeof(ticker_t));
+        ticker->fd = -1;
+}
+
+
+int ticker_start(ticker_t *ticker, char *hdr, int period, ticker_func_t func, void *arg, iostats_t *stats)
+{
+        struct timespec now;
+        uint64_t origin_ns;
+        int err;
+
+        /* Already running */
+        if (ticker->fd >= 0) {
+                return 0;
+        }
+
+        ticker->hdr = strdup(hdr);
+        ticker->func = func;
+        ticker->arg = arg;
+        ticker->stats = stats;
+        ticker->period.tv_sec = period / 1000;
+        ticker->period.tv_nsec = (period % 1000) * 1000000L;
+
+        ticker->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (ticker->fd < 0) {
+                log_str("ERROR: %sCannot create ticker timer: %s", hdr, strerror(errno));
+                goto failed;
+        }
+
+        /* First deadline one period from now, then on a fixed grid */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        origin_ns = ticker_ns(&now) + ticker_ns(&ticker->period);
+        if (ticker->align) {
+                origin_ns -= origin_ns % ticker_ns(&ticker->period);
+        }
+        ticker_set(&ticker->origin, origin_ns);
+
+        if (ticker_arm(ticker) < 0) {
+                goto failed;
+        }
+
+        err = pthread_create(&ticker->thr, NULL, ticker_loop, ticker);
+        if (err != 0) {
+                log_str("ERROR: %sFailed to create ticker thread: %s", hdr, strerror(err));
+                goto failed;
+        }
+
+        pthread_detach(ticker->thr);
+        worker_thread_setup(ticker->thr, "tick", hdr);
+
+        log_str("%s%s sampling every %d ms", hdr, ticker->align ? "Aligned":"Precise", period);
+
+        return 0;
+
+failed:
+        if (ticker->fd >= 0) {
+                close(ticker->fd);
+                ticker->fd = -1;
+        }
+
+        if (ticker->hdr != NULL) {
+                free(ticker->hdr);
+                ticker->hdr = NULL;
+        }
+
+        return -1;
+}
+
+
+void ticker_pause(ticker_t *ticker, int paused)
+{
+        struct itimerspec its;
+
+        if (ticker->fd < 0) {
+                return;
+        }
+
+        if (paused) {
+                /* Disarm timer: the thread stays blocked until resumed */
+                memset(&its, 0, sizeof(its));
+                if (timerfd_settime(ticker->fd, 0, &its, NULL) < 0) {
+                        log_str("ERROR: %sCannot disarm ticker timer: %s", ticker->hdr, strerror(errno));
+                }
+        }
+        else {
+                /* Resume on the same deadline grid */
+                ticker_arm(ticker);
+        }
+}
@@ -0,0 +1,43 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Precise periodic sampling ticker
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_TICKER_H__
+#define __HAKIT_TICKER_H__
+
+#include <time.h>
+#include <pthread.h>
+
+#include "iostats.h"
+
+/* Tick handler, run by the ticker thread: returns 0 if a sample was taken,
+   1 if skipped because the previous acquisition is still in progress */
+typedef int (*ticker_func_t)(void *arg);
+
+typedef struct {
+        char *hdr;
+        int fd;                    // Absolute deadline timerfd
+        pthread_t thr;
+        struct timespec period;
+        int align;                 // Align deadlines on multiples of the period
+        struct timespec origin;    // First deadline of the grid
+        struct timespec deadline;  // Deadline of the tick being handled
+        unsigned long late_us;     // Lateness of the tick being handled
+        unsigned long overruns;    // Deadlines skipped before the tick being handled
+        ticker_func_t func;
+        void *arg;
+        iostats_t *stats;          // Jitter histogram and missed samples
+} ticker_t;
+
+extern void ticker_init(ticker_t *ticker);
+extern int ticker_start(ticker_t *ticker, char *hdr, int period, ticker_func_t func, void *arg, iostats_t *stats);
+extern void ticker_pause(ticker_t *ticker, int paused);
+
+#endif /* __HAKIT_TICKER_H__ */
@@ -0,0 +1,446 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Shared asynchronous worker pool
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Blocking bus transactions are run by a small pool of threads shared
+// by all objects of all classes, instead of one private thread each:
+// the common code is built as one library that every class links to.
+// A job is submitted from the main loop, run by the first idle worker,
+// then its completion handler is called back from the main loop, where
+// pads can be safely updated.
+//
+// A job object is embedded in the caller context and can be queued only
+// once: submitting a job that is still pending is a no-op, so that a
+// slow device coalesces triggers instead of piling them up. A job stays
+// claimed until its completion handler returns, so the handler has
+// exclusive access to the job data. Besides the pool, a job can be run
+// directly by another thread, like the precise periodic ticker, or by a
+// private queue thread that hands it back with worker_complete().
+//
+// The pool is sized for short bus transactions (a few ms each), so two
+// threads are enough for a handful of objects. Jobs that hold the bus
+// for much longer, like a flicker burst of several seconds, must not
+// be queued to the pool, where they would delay every other object:
+// worker_spawn() runs them on a thread of their own instead.
+//
+// Completed jobs are signalled through an eventfd watched by the main
+// loop. The pool is created by the first object, and grown by the next
+// ones if they ask for more threads with the 'workers' property.
+//
+// Real-time settings are pool-wide as well: 'rt_priority' (SCHED_FIFO,
+// highest request wins), 'cpu' (affinity, union of requested CPU lists
+// like "3" or "2-3") and 'lock_memory' (mlockall, process-wide). Failing
+// to apply them, typically for lack of privileges, is not fatal.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "sys.h"
+#include "worker.h"
+
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static worker_job_t *worker_queue_head = NULL;  // Jobs waiting for a thread
+static worker_job_t *worker_queue_tail = NULL;
+static worker_job_t *worker_done_head = NULL;   // Jobs waiting for completion
+static worker_job_t *worker_done_tail = NULL;
+static pthread_t worker_threads[WORKER_MAX_THREADS];
+static int worker_nthreads = 0;
+static int worker_rt_priority = 0;
+static cpu_set_t worker_cpus;
+static int worker_ncpus = 0;
+static int worker_locked = 0;
+static int worker_fd = -1;
+static sys_tag_t worker_tag = 0;
+
+
+static void worker_append(worker_job_t **phead, worker_job_t **ptail, worker_job_t *job)
+{
+        job->next = NULL;
+        if (*ptail != NULL) {
+                (*ptail)->next = job;
+        }
+        else {
+                *phead = job;
+        }
+        *ptail = job;
+}
+
+
+void worker_complete(worker_job_t *job)
+{
+        uint64_t one = 1;
+
+        pthread_mutex_lock(&worker_mutex);
+        worker_append(&worker_done_head, &worker_done_tail, job);
+        pthread_mutex_unlock(&worker_mutex);
+
+        if (write(worker_fd, &one, sizeof(one)) < 0) {
+                log_str("PANIC: worker: Cannot signal job completion: %s", strerror(errno));
+        }
+}
+
+
+static void *worker_loop(void *arg)
+{
+        (void) arg;
+
+        while (1) {
+                worker_job_t *job;
+
+                pthread_mutex_lock(&worker_mutex);
+                while (worker_queue_head == NULL) {
+                        pthread_cond_wait(&worker_cond, &worker_mutex);
+                }
+                job = worker_queue_head;
+                worker_queue_head = job->next;
+                if (worker_queue_head == NULL) {
+                        worker_queue_tail = NULL;
+                }
+                pthread_mutex_unlock(&worker_mutex);
+
+                job->func(job->arg);
+                worker_complete(job);
+        }
+
+        return NULL;
+}
+
+
+static int worker_recv(void *user_data, int fd)
+{
+        worker_job_t *job;
+        uint64_t count;
+
+        (void) user_data;
+
+        if (read(fd, &count, sizeof(count)) < 0) {
+                if ((errno != EAGAIN) && (errno != EINTR)) {
+                        log_str("PANIC: worker: Cannot read completion events: %s", strerror(errno));
+                        return 0;
+                }
+        }
+
+        pthread_mutex_lock(&worker_mutex);
+        job = worker_done_head;
+        worker_done_head = NULL;
+        worker_done_tail = NULL;
+        pthread_mutex_unlock(&worker_mutex);
+
+        while (job != NULL) {
+                worker_job_t *next = job->next;
+
+                job->next = NULL;
+                if (job->done != NULL) {
+                        job->done(job->arg);
+                }
+                __atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+
+                job = next;
+        }
+
+        return 1;
+}
+
+
+static int worker_parse_cpus(char *str, cpu_set_t *set)
+{
+        int count = 0;
+
+        CPU_ZERO(set);
+
+        while (*str != '\0') {
+                char *end;
+                long first = strtol(str, &end, 10);
+                long last = first;
+
+                if (end == str) {
+                        return -1;
+                }
+
+                if (*end == '-') {
+                        str = end + 1;
+                        last = strtol(str, &end, 10);
+                        if (end == str) {
+                                return -1;
+                        }
+                }
+
+                if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) {
+                        return -1;
+                }
+
+                for (; first <= last; first++) {
+                        CPU_SET(first, set);
+                        count++;
+                }
+
+                if (*end == ',') {
+                        end++;
+                }
+                else if (*end != '\0') {
+                        return -1;
+                }
+
+                str = end;
+        }
+
+        return count;
+}
+
+
+void worker_thread_setup(pthread_t thr, char *suffix, char *hdr)
+{
+        char name[16];
+        int len;
+        int err;
+
+        /* Name thread after the class, as shown in the message header */
+        len = strcspn(hdr, "(:");
+        if (len > 9) {
+                len = 9;
+        }
+        snprintf(name, sizeof(name), "%.*s/%s", len, hdr, suffix);
+        pthread_setname_np(thr, name);
+
+        if (worker_rt_priority > 0) {
+                struct sched_param param = {
+                        .sched_priority = worker_rt_priority,
+                };
+
+                err = pthread_setschedparam(thr, SCHED_FIFO, &param);
+                if (err != 0) {
+                        log_str("ERROR: %sCannot set worker real-time priority %d: %s", hdr, worker_rt_priority, strerror(err));
+                }
+        }
+
+        if (worker_ncpus > 0) {
+                err = pthread_setaffinity_np(thr, sizeof(worker_cpus), &worker_cpus);
+                if (err != 0) {
+                        log_str("ERROR: %sCannot set worker CPU affinity: %s", hdr, strerror(err));
+                }
+        }
+}
+
+
+static void worker_setup_thread(int index, char *hdr)
+{
+        char suffix[8];
+
+        snprintf(suffix, sizeof(suffix), "w%d", index);
+        worker_thread_setup(worker_threads[index], suffix, hdr);
+}
+
+
+static void worker_setup_rt(hk_prop_t *props, char *hdr)
+{
+        int rt_priority = hk_prop_get_int(props, "rt_priority");
+        char *cpu = hk_prop_get(props, "cpu");
+        int changed = 0;
+        int i;
+
+        if (rt_priority > worker_rt_priority) {
+                int max = sched_get_priority_max(SCHED_FIFO);
+                if (rt_priority > max) {
+                        rt_priority = max;
+                }
+                worker_rt_priority = rt_priority;
+                changed = 1;
+                log_str("%sWorker real-time priority: %d", hdr, rt_priority);
+        }
+
+        if (cpu != NULL) {
+                cpu_set_t set;
+
+                if (worker_parse_cpus(cpu, &set) > 0) {
+                        CPU_OR(&worker_cpus, &worker_cpus, &set);
+                        worker_ncpus = CPU_COUNT(&worker_cpus);
+                        changed = 1;
+                        log_str("%sWorker CPU affinity: %s", hdr, cpu);
+                }
+                else {
+                        log_str("ERROR: %sInvalid CPU list '%s'", hdr, cpu);
+                }
+        }
+
+        if (hk_prop_get_int(props, "lock_memory") && !worker_locked) {
+                if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+                        worker_locked = 1;
+                        log_str("%sProcess memory locked", hdr);
+                }
+                else {
+                        log_str("ERROR: %sCannot lock process memory: %s", hdr, strerror(errno));
+                }
+        }
+
+        /* Apply new settings to already running threads */
+        if (changed) {
+                for (i = 0; i < worker_nthreads; i++) {
+                        worker_setup_thread(i, hdr);
+                }
+        }
+}
+
+
+int worker_init(hk_prop_t *props, char *hdr)
+{
+        int nthreads = hk_prop_get_int(props, "workers");
+
+        if (nthreads <= 0) {
+                nthreads = WORKER_DEFAULT_THREADS;
+        }
+        if (nthreads > WORKER_MAX_THREADS) {
+                nthreads = WORKER_MAX_THREADS;
+        }
+
+        /* Setup completion event */
+        if (worker_fd < 0) {
+                worker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (worker_fd < 0) {
+                        log_str("PANIC: %sCannot create worker completion event: %s", hdr, strerror(errno));
+                        return -1;
+                }
+
+                worker_tag = sys_io_watch(worker_fd, (sys_io_func_t) worker_recv, NULL);
+        }
+
+        worker_setup_rt(props, hdr);
+
+        /* Grow the pool up to the requested number of threads */
+        while (worker_nthreads < nthreads) {
+                pthread_t *thr = &worker_threads[worker_nthreads];
+                int err;
+
+                err = pthread_create(thr, NULL, worker_loop, NULL);
+                if (err != 0) {
+                        log_str("PANIC: %sFailed to create worker thread: %s", hdr, strerror(err));
+                        return (worker_nthreads > 0) ? 0 : -1;
+                }
+
+                pthread_detach(*thr);
+                worker_setup_thread(worker_nthreads, hdr);
+                worker_nthreads++;
+                log_debug(1, "%sWorker pool: %d thread(s)", hdr, worker_nthreads);
+        }
+
+        return 0;
+}
+
+
+void worker_job_init(worker_job_t *job, worker_func_t func, worker_func_t done, void *arg)
+{
+        job->func = func;
+        job->done = done;
+        job->arg = arg;
+        job->busy = 0;
+        job->next = NULL;
+}
+
+
+int worker_claim(worker_job_t *job)
+{
+        return __atomic_exchange_n(&job->busy, 1, __ATOMIC_ACQ_REL) ? 1 : 0;
+}
+
+
+int worker_busy(worker_job_t *job)
+{
+        return __atomic_load_n(&job->busy, __ATOMIC_ACQUIRE);
+}
+
+
+void worker_release(worker_job_t *job)
+{
+        /* Drop a claim taken for work done synchronously by the main loop */
+        __atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+int worker_queue(worker_job_t *job)
+{
+        if (worker_nthreads <= 0) {
+                log_str("PANIC: worker: No worker thread available");
+                __atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+                return -1;
+        }
+
+        pthread_mutex_lock(&worker_mutex);
+        worker_append(&worker_queue_head, &worker_queue_tail, job);
+        pthread_cond_signal(&worker_cond);
+        pthread_mutex_unlock(&worker_mutex);
+
+        return 0;
+}
+
+
+int worker_submit(worker_job_t *job)
+{
+        /* Still pending: let the running job do the work */
+        if (worker_claim(job)) {
+                return 1;
+        }
+
+        return worker_queue(job);
+}
+
+
+static void *worker_spawn_loop(void *arg)
+{
+        worker_job_t *job = arg;
+
+        job->func(job->arg);
+        worker_complete(job);
+
+        return NULL;
+}
+
+
+int worker_spawn(worker_job_t *job, char *suffix, char *hdr)
+{
+        pthread_t thr;
+        int err;
+
+        /* Job is claimed by the caller, as for worker_queue() */
+        err = pthread_create(&thr, NULL, worker_spawn_loop, job);
+        if (err != 0) {
+                log_str("ERROR: %sFailed to create job thread: %s", hdr, strerror(err));
+                __atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+                return -1;
+        }
+
+        pthread_detach(thr);
+        worker_thread_setup(thr, suffix, hdr);
+
+        return 0;
+}
+
+
+int worker_run(worker_job_t *job)
+{
+        if (worker_claim(job)) {
+                return 1;
+        }
+
+        job->func(job->arg);
+        worker_complete(job);
+
+        return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Shared asynchronous worker pool
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_WORKER_H__
+#define __HAKIT_WORKER_H__
+
+#include <pthread.h>
+
+#include "prop.h"
+
+// Default pool size: enough for short bus transactions of a few objects,
+// long jobs are run with worker_spawn() instead
+#define WORKER_DEFAULT_THREADS 2
+#define WORKER_MAX_THREADS 16
+
+typedef void (*worker_func_t)(void *arg);
+
+typedef struct worker_job_s {
+        worker_func_t func;    // Job body, run by a worker thread
+        worker_func_t done;    // Completion handler, run by the main loop
+        void *arg;
+        int busy;              // Job is claimed until its completion handler returns
+        struct worker_job_s *next;
+} worker_job_t;
+
+extern int worker_init(hk_prop_t *props, char *hdr);
+extern void worker_thread_setup(pthread_t thr, char *suffix, char *hdr);
+
+extern void worker_job_init(worker_job_t *job, worker_func_t func, worker_func_t done, void *arg);
+extern int worker_claim(worker_job_t *job);
+extern int worker_busy(worker_job_t *job);
+extern void worker_release(worker_job_t *job);
+extern int worker_queue(worker_job_t *job);
+extern int worker_submit(worker_job_t *job);
+extern int worker_spawn(worker_job_t *job, char *suffix, char *hdr);
+extern int worker_run(worker_job_t *job);
+extern void worker_complete(worker_job_t *job);
+
+#endif /* __HAKIT_WORKER_H__ */
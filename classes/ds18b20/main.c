@@ -17,13 +17,17 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <mqueue.h>
 
 #include "log.h"
 #include "mod.h"
 #include "sys.h"
 #include "prop.h"
+#include "pub.h"
+#include "iostats.h"
+#include "worker.h"
+#include "ticker.h"
+#include "group.h"
+#include "demand.h"
 
 #include "version.h"
 
@@ -31,21 +35,26 @@
 #define CLASS_NAME "ds18b20"
 
 #define SYS_W1_DIR "/sys/bus/w1/devices/"
-#define MSG_MAXSIZE 16
 
 
 typedef struct {
 	hk_obj_t *obj;
 	char *id;
 	char *path;
-	pthread_t thr;
-	mqd_t qin;
-	mqd_t qout;
-	sys_tag_t qout_tag;
+        iostats_t iostats;
+        worker_job_t job;
+        int value;
+        pub_ts_t ts;
 	hk_pad_t *trig;
 	hk_pad_t *out;
+        pub_cfg_t pub_cfg;
+        pub_t out_pub;
         int period;
 	sys_tag_t period_tag;
+        int precise;
+        ticker_t ticker;
+        char *group;
+        demand_t demand;
 } ctx_t;
 
 
@@ -114,10 +123,15 @@ static int read_value(ctx_t *ctx)
 	FILE *f;
 	int crc_ok = 0;
 	int value = -1;
+	int bytes = 0;
+	struct timespec t0;
+
+	iostats_start(&t0);
 
 	f = fopen(ctx->path, "r");
 	if (f == NULL) {
 		log_str("ERROR: " CLASS_NAME "(%s): Cannot open %s: %s", ctx->obj->name, ctx->path, strerror(errno));
+		iostats_record(&ctx->iostats, IOSTATS_READ, &t0, 0, 1);
 		return -1;
 	}
 
@@ -126,6 +140,7 @@ static int read_value(ctx_t *ctx)
 
 		if (fgets(buf, sizeof(buf), f) != NULL) {
 			char *s = buf;
+			bytes += strlen(buf);
 			while (*s >= ' ') {
 				s++;
 			}
@@ -153,130 +168,67 @@ static int read_value(ctx_t *ctx)
 
 	fclose(f);
 
+	/* Missing value means CRC error */
+	iostats_record(&ctx->iostats, IOSTATS_READ, &t0, bytes, (value == -1));
+
 	return value;
 }
 
 
-static void *qin_recv_loop(void *_ctx)
+static void acquire(ctx_t *ctx)
 {
-	ctx_t *ctx = _ctx;
-	int ret = 0;
-
-	while (ret == 0) {
-		char mbuf[MSG_MAXSIZE];
-		ssize_t msize;
-
-		msize = mq_receive(ctx->qin, mbuf, sizeof(mbuf), NULL);
-		if (msize < 0) {
-			if ((errno != EAGAIN) && (errno != EINTR)) {
-				log_str("PANIC: " CLASS_NAME "(%s): Cannot read input queue: %s", ctx->obj->name, strerror(errno));
-			}
-		}
-
-		log_debug(2, CLASS_NAME "(%s): qin_recv_loop -> %d", ctx->obj->name, msize);
-
-		if (msize > 0) {
-			if (mbuf[0] == 0) {
-				int value = read_value(ctx);
-				if (mq_send(ctx->qout, (char *) &value, sizeof(value), 0) < 0) {
-					log_str("PANIC: " CLASS_NAME "(%s): Cannot write output queue: %s", ctx->obj->name, strerror(errno));
-					ret = -1;
-				}
-			}
-			else {
-				ret = 1;
-				log_debug(1, CLASS_NAME "(%s): Leaving input loop", ctx->obj->name);
-			}
-		}
-	}
-
-	return NULL;
+        /* Runs in a worker or ticker thread */
+        pub_ts_get(&ctx->ts);
+        ctx->value = read_value(ctx);
 }
 
 
-static int qout_recv(ctx_t *ctx, int fd)
+static void format_value(char *str, int size, int value100)
 {
-	char mbuf[MSG_MAXSIZE];
-	ssize_t msize;
-
-	msize = mq_receive(ctx->qout, mbuf, sizeof(mbuf), NULL);
-	if (msize < 0) {
-		if ((errno != EAGAIN) && (errno != EINTR)) {
-			log_str("PANIC: " CLASS_NAME "(%s): Cannot receive from output queue: %s", ctx->obj->name, strerror(errno));
-			return 0;
-		}
-	}
-
-	log_debug(2, CLASS_NAME "(%s): qout_recv -> %d", ctx->obj->name, msize);
-
-	if (msize == sizeof(int)) {
-		int *pvalue = (int *) mbuf;
-		int value100 = *pvalue / 100;
+        if (value100 >= 0) {
+                snprintf(str, size, "%d.%d", value100/10, value100%10);
+        }
+        else {
+                value100 = (-value100);
+                snprintf(str, size, "-%d.%d", value100/10, value100%10);
+        }
+}
 
-                if (value100 != ctx->out->state) {
-                        char str[20];
 
-                        ctx->out->state = value100;
+static void acquire_done(ctx_t *ctx)
+{
+        int value100 = ctx->value / 100;
 
-                        if (value100 >= 0) {
-                                snprintf(str, sizeof(str), "%d.%d", value100/10, value100%10);
-                        }
-                        else {
-                                value100 = (-value100);
-                                snprintf(str, sizeof(str), "-%d.%d", value100/10, value100%10);
-                        }
-                        hk_pad_update_str(ctx->out, str);
-                }
-	}
-	else {
-		log_str("PANIC: " CLASS_NAME "(%s): Illegal data received from output queue (%d bytes)", ctx->obj->name, msize);
-	}
+        log_debug(2, CLASS_NAME "(%s): acquire_done -> %d", ctx->obj->name, ctx->value);
 
-	return 1;
+        pub_update(&ctx->out_pub, value100, &ctx->ts, 0);
 }
 
 
-static int create_queue(ctx_t *ctx, char *name, int flags)
+static int trigger(ctx_t *ctx)
 {
-	char qname[128];
-	int mqd;
-
-	snprintf(qname, sizeof(qname), "/hakit-%d-%s-%s", getpid(), ctx->obj->name, name);
-	log_debug(2, CLASS_NAME "(%s): create_queue '%s'", ctx->obj->name, qname);
-
-	int qflags = O_RDWR | O_CLOEXEC | O_CREAT | O_EXCL | flags;
-	struct mq_attr qattr = {
-		.mq_flags   = flags,
-		.mq_maxmsg  = 4,
-		.mq_msgsize = MSG_MAXSIZE,
-	};
-
-	mqd = mq_open(qname, qflags, S_IRUSR | S_IWUSR, &qattr);
-	if (mqd < 0) {
-		log_str("PANIC: " CLASS_NAME "(%s): Cannot create %sput queue: %s", ctx->obj->name, name, strerror(errno));
-		return -1;
-	}
+        /* No consumer: sampling is suspended */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
 
-	/* Hide message queue from other processes */
-	if (mq_unlink(qname) < 0) {
-		log_str("PANIC: " CLASS_NAME "(%s): Cannot unlink %sput queue: %s", ctx->obj->name, name, strerror(errno));
-		mq_close(mqd);
-		return -1;
+        /* A conversion in progress will provide the value */
+	if (worker_submit(&ctx->job) < 0) {
+                return 0;
 	}
 
-	return mqd;
+	return 1;
 }
 
 
-static int trigger(ctx_t *ctx)
+static int tick(ctx_t *ctx)
 {
-	char req = 0;
-	if (mq_send(ctx->qin, &req, sizeof(req), 0) < 0) {
-		log_str("PANIC: " CLASS_NAME "(%s): Cannot write input queue: %s", ctx->obj->name, strerror(errno));
+        /* Runs in the ticker thread */
+        if (!demand_active(&ctx->demand)) {
                 return 0;
-	}
+        }
 
-	return 1;
+        return worker_run(&ctx->job);
 }
 
 
@@ -295,8 +247,12 @@ static int _new(hk_obj_t *obj)
 	memset(ctx, 0, sizeof(ctx_t));
 	ctx->obj = obj;
 	obj->ctx = ctx;
-	ctx->qin = -1;
-	ctx->qout = -1;
+        worker_job_init(&ctx->job, (worker_func_t) acquire, (worker_func_t) acquire_done, ctx);
+
+	/* Init i/o statistics */
+	char hdr[strlen(obj->name) + 16];
+	snprintf(hdr, sizeof(hdr), CLASS_NAME "(%s): ", obj->name);
+	iostats_init(&ctx->iostats, obj, hdr);
 
 	/* Get sensor id */
 	ctx->id = find_id(obj, hk_prop_get(&obj->props, "id"));
@@ -307,6 +263,16 @@ static int _new(hk_obj_t *obj)
         /* Get period property */
 	ctx->period = hk_prop_get_int(&obj->props, "period");
 
+        /* Get precise periodic sampling property */
+	ctx->precise = hk_prop_get_int(&obj->props, "precise");
+        ticker_init(&ctx->ticker);
+
+        /* Get sampling group property */
+	ctx->group = hk_prop_get(&obj->props, "group");
+
+        /* Get publishing properties (deadband in 0.1 degC) */
+        pub_cfg_init(&ctx->pub_cfg, &obj->props);
+
 	/* Setup sensor data path */
 	size = strlen(SYS_W1_DIR) + strlen(ctx->id) + 16;
 	ctx->path = malloc(size);
@@ -317,46 +283,17 @@ static int _new(hk_obj_t *obj)
 
 	/* Create output pad */
 	ctx->out = hk_pad_create(obj, HK_PAD_IN, "out");
-        ctx->out->state = 0x7FFFFFFF;  // Unrealistic value to ensure value will be updated at first trigger
-
-	/* Create input request queue */
-	ctx->qin = create_queue(ctx, "in", 0);
-	if (ctx->qin < 0) {
-		goto failed;
-	}
-
-	/* Create output result queue */
-	ctx->qout = create_queue(ctx, "out", O_NONBLOCK);
-	if (ctx->qout < 0) {
-		goto failed;
-	}
-
-	ctx->qout_tag = sys_io_watch(ctx->qout, (sys_io_func_t) qout_recv, ctx);
+        pub_init(&ctx->out_pub, ctx->out, &ctx->pub_cfg);
+        pub_set_format(&ctx->out_pub, format_value);
 
-	/* Create read thread */
-	if (pthread_create(&ctx->thr, NULL, qin_recv_loop, ctx)) {
-		log_str("PANIC: " CLASS_NAME "(%s): Failed to create thread: %s", obj->name, strerror(errno));
+	/* Attach to shared worker pool */
+	if (worker_init(&obj->props, hdr) < 0) {
 		goto failed;
 	}
 
 	return 0;
 
 failed:
-	if (ctx->qout_tag != 0) {
-		sys_remove(ctx->qout_tag);
-		ctx->qout_tag = 0;
-	}
-
-	if (ctx->qout >= 0) {
-		mq_close(ctx->qout);
-		ctx->qout = -1;
-	}
-
-	if (ctx->qin >= 0) {
-		mq_close(ctx->qin);
-		ctx->qin = -1;
-	}
-
 	if (ctx->path != NULL) {
 		free(ctx->path);
 		ctx->path = NULL;
@@ -367,6 +304,8 @@ failed:
 		ctx->id = NULL;
 	}
 
+	iostats_cleanup(&ctx->iostats);
+
 	free(ctx);
 
 	obj->ctx = NULL;
@@ -375,15 +314,60 @@ failed:
 }
 
 
+static void start_periodic(ctx_t *ctx)
+{
+        if (ctx->period <= 0) {
+                return;
+        }
+
+        if (ctx->group != NULL) {
+                if (group_join(ctx->group, "w1", ctx->period, (ticker_func_t) tick, ctx, &ctx->iostats, ctx->iostats.hdr) == 0) {
+                        return;
+                }
+        }
+
+        if (ctx->precise) {
+                if (ticker_start(&ctx->ticker, ctx->iostats.hdr, ctx->period, (ticker_func_t) tick, ctx, &ctx->iostats) == 0) {
+                        return;
+                }
+        }
+
+        if (ctx->period_tag != 0) {
+                sys_remove(ctx->period_tag);
+        }
+        ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) trigger, ctx);
+}
+
+
+static void demand_changed(ctx_t *ctx, int active)
+{
+        if (active) {
+                ticker_pause(&ctx->ticker, 0);
+                start_periodic(ctx);
+                trigger(ctx);
+        }
+        else {
+                /* Conversions are only started on request: just stop sampling */
+                if (ctx->period_tag != 0) {
+                        sys_remove(ctx->period_tag);
+                        ctx->period_tag = 0;
+                }
+                ticker_pause(&ctx->ticker, 1);
+        }
+}
+
+
 static void _start(hk_obj_t *obj)
 {
 	ctx_t *ctx = obj->ctx;
 
-        trigger(ctx);
+        /* Suspend sampling when no output is consumed */
+        demand_init(&ctx->demand, obj, ctx->iostats.hdr, (demand_func_t) demand_changed, ctx);
+        demand_add_pub(&ctx->demand, &ctx->out_pub);
 
-        if (ctx->period > 0) {
-		ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) trigger, ctx);
-        }
+        trigger(ctx);
+        start_periodic(ctx);
+        demand_start(&ctx->demand);
 }
 
 
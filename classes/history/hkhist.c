@@ -0,0 +1,271 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * History ring file reader
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Prints the samples kept in an object history file (see the 'history'
+// property), e.g. to fetch what an uplink outage missed. The file is
+// mapped read-only, so it can be read while the object is running.
+// Samples are printed as "<pad>,<time>,<value>" lines, oldest first,
+// with time in seconds since Epoch.
+//
+// With -c, runs a round-trip check of the history codec instead: samples
+// covering every delta encoding and block boundaries are appended to a
+// scratch file, then read back and compared.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "history.h"
+
+#define QUERY_MAX 4096
+#define CHECK_SAMPLES 4000
+#define CHECK_SIZE_KB 512
+
+int opt_debug = 0;
+
+
+void log_str(char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+
+static int64_t parse_time(char *str)
+{
+	double t = strtod(str, NULL);
+
+	/* Negative time is relative to now */
+	if (t < 0) {
+		t += (double) time(NULL);
+	}
+
+	return (int64_t) (t * 1000);
+}
+
+
+static void dump_series(history_t *hist, char *name, int64_t from, int64_t to)
+{
+	history_sample_t *buf = malloc(QUERY_MAX * sizeof(history_sample_t));
+	int count;
+	int i;
+
+	do {
+		count = history_query(hist, name, from, to, buf, QUERY_MAX);
+
+		for (i = 0; i < count; i++) {
+			printf("%s,%lld.%03lld,%d\n", name, (long long) (buf[i].t / 1000), (long long) (buf[i].t % 1000), buf[i].value);
+		}
+
+		/* Buffer full: continue after the last sample */
+		if (count > 0) {
+			from = buf[count-1].t + 1;
+		}
+	} while (count == QUERY_MAX);
+
+	free(buf);
+}
+
+
+/*
+ * Codec round-trip check
+ */
+
+static void check_gen(history_sample_t *samples, int n)
+{
+	/* Time delta-of-delta and value delta steps, one per encoding */
+	static const int64_t dods[] = { 0, 0, 0, 5, -60, 200, -250, 1500, -2000, 100000, -3000000, 3000000000LL };
+	static const int64_t deltas[] = { 0, 0, 0, 1, -31, 100, -4000, 1000000, -100000000, 4000000000LL };
+	unsigned int seed = 1;
+	int64_t t = 1700000000000LL;
+	int64_t dt = 1000;
+	int64_t value = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		/* Bring the period back after a time jump */
+		if ((dt < 1) || (dt > 10000000)) {
+			dt = 1000;
+		}
+		dt += dods[rand_r(&seed) % (sizeof(dods) / sizeof(dods[0]))];
+		t += dt;
+		value += deltas[rand_r(&seed) % (sizeof(deltas) / sizeof(deltas[0]))];
+		if ((value < INT32_MIN) || (value > INT32_MAX)) {
+			value = (rand_r(&seed) & 1) ? INT32_MAX : INT32_MIN;
+		}
+
+		samples[i].t = t;
+		samples[i].value = value;
+	}
+}
+
+
+static int check_series(history_t *hist, char *name, history_sample_t *samples, int n)
+{
+	history_sample_t *buf = malloc(n * sizeof(history_sample_t));
+	int count;
+	int i;
+
+	count = history_query(hist, name, INT64_MIN, INT64_MAX, buf, n);
+	if (count != n) {
+		fprintf(stderr, "ERROR: %s: %d samples read back, %d expected\n", name, count, n);
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((buf[i].t != samples[i].t) || (buf[i].value != samples[i].value)) {
+			fprintf(stderr, "ERROR: %s: sample %d is (%lld, %d), expected (%lld, %d)\n", name, i,
+				(long long) buf[i].t, buf[i].value, (long long) samples[i].t, samples[i].value);
+			free(buf);
+			return -1;
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+
+static int check(void)
+{
+	char path[] = "/tmp/hkhist-XXXXXX";
+	history_sample_t *samples = malloc(2 * CHECK_SAMPLES * sizeof(history_sample_t));
+	history_sample_t *a = samples;
+	history_sample_t *b = samples + CHECK_SAMPLES;
+	history_t *hist;
+	int ret = -1;
+	int fd;
+	int sa, sb;
+	int i;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		free(samples);
+		return -1;
+	}
+	close(fd);
+
+	check_gen(a, CHECK_SAMPLES);
+
+	/* Second series: steady period and value, interleaved with the first one */
+	for (i = 0; i < CHECK_SAMPLES; i++) {
+		b[i].t = a[0].t + (int64_t) i * 100;
+		b[i].value = 42 + (i / 1000);
+	}
+
+	hist = history_open(path, CHECK_SIZE_KB, 0, "check: ");
+	if (hist == NULL) {
+		goto done;
+	}
+
+	sa = history_series(hist, "a");
+	sb = history_series(hist, "b");
+	for (i = 0; i < CHECK_SAMPLES; i++) {
+		history_append(hist, sa, a[i].t, a[i].value);
+		history_append(hist, sb, b[i].t, b[i].value);
+	}
+
+	/* Read back from the writer, then from a read-only mapping */
+	if ((check_series(hist, "a", a, CHECK_SAMPLES) < 0) || (check_series(hist, "b", b, CHECK_SAMPLES) < 0)) {
+		history_close(hist);
+		goto done;
+	}
+	history_close(hist);
+
+	hist = history_load(path, "check: ");
+	if (hist == NULL) {
+		goto done;
+	}
+
+	if ((check_series(hist, "a", a, CHECK_SAMPLES) == 0) && (check_series(hist, "b", b, CHECK_SAMPLES) == 0)) {
+		printf("History codec check passed: %d samples\n", 2 * CHECK_SAMPLES);
+		ret = 0;
+	}
+	history_close(hist);
+
+done:
+	unlink(path);
+	free(samples);
+	return ret;
+}
+
+
+static void usage(char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-f time] [-t time] <file.hist> [pad ...]\n", argv0);
+	fprintf(stderr, "       %s -c\n", argv0);
+	fprintf(stderr, "  -f time      Start time, in seconds since Epoch, or before now if negative\n");
+	fprintf(stderr, "  -t time      End time, in seconds since Epoch, or before now if negative\n");
+	fprintf(stderr, "  -c           Run the codec round-trip check\n");
+	fprintf(stderr, "All pads are printed if none is given.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	int64_t from = INT64_MIN;
+	int64_t to = INT64_MAX;
+	history_t *hist;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "f:t:c")) != -1) {
+		switch (opt) {
+		case 'f':
+			from = parse_time(optarg);
+			break;
+		case 't':
+			to = parse_time(optarg);
+			break;
+		case 'c':
+			return (check() == 0) ? 0 : 1;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	hist = history_load(argv[optind], "");
+	if (hist == NULL) {
+		return 2;
+	}
+
+	if (optind + 1 < argc) {
+		for (i = optind + 1; i < argc; i++) {
+			dump_series(hist, argv[i], from, to);
+		}
+	}
+	else {
+		for (i = 0; i < (int) hist->header->nseries; i++) {
+			dump_series(hist, hist->header->series[i], from, to);
+		}
+	}
+
+	history_close(hist);
+
+	return 0;
+}
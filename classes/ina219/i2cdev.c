@@ -115,6 +115,7 @@ static inline __s32 i2c_smbus_write_i2c_block_data(int file, __u8 command,
 #endif
 
 #include "log.h"
+#include "buslog.h"
 #include "i2cdev.h"
 
 #define SYS_I2C_CLASS "/sys/class/i2c-dev/"
@@ -132,6 +133,9 @@ int i2cdev_init(i2cdev_t *i2cdev, char *hdr)
 
 	i2cdev->hdr = strdup(hdr);
 	i2cdev->fd = -1;
+	i2cdev->num = -1;
+	i2cdev->addr = 0;
+	i2cdev->stats = NULL;
 
         return 0;
 }
@@ -152,6 +156,9 @@ int i2cdev_open(i2cdev_t *i2cdev, int num, unsigned char addr)
 
 	log_debug(3, "%si2cdev_open => fd=%d", i2cdev->hdr, i2cdev->fd);
 
+	i2cdev->num = num;
+	i2cdev->addr = addr;
+
 	// Select device address
 	if (ioctl(i2cdev->fd, I2C_SLAVE, addr) < 0) {
 		log_str("ERROR: %sCould not select I2C address 0x%02X on %s: %s\n", i2cdev->hdr, devname, addr, devname, strerror(errno));
@@ -178,7 +185,15 @@ void i2cdev_close(i2cdev_t *i2cdev)
 
 int i2cdev_read(i2cdev_t *i2cdev, uint8_t command, uint8_t size, uint8_t *data)
 {
-	int ret = i2c_smbus_read_i2c_block_data(i2cdev->fd, command, size, data);
+	struct timespec t0, t1;
+	int ret;
+
+	iostats_start(&t0);
+	buslog_start(&t1);
+	ret = i2c_smbus_read_i2c_block_data(i2cdev->fd, command, size, data);
+	buslog_i2c(i2cdev->num, i2cdev->addr, &t1, command, NULL, 0, data, ret, (ret < 0));
+	iostats_record(i2cdev->stats, IOSTATS_READ, &t0, 1+size, (ret < 0));
+
 	if (ret < 0) {
                 log_str("ERROR: %sFailed to read data at 0x%02X: %s", i2cdev->hdr, command, strerror(errno));
 	}
@@ -189,7 +204,15 @@ int i2cdev_read(i2cdev_t *i2cdev, uint8_t command, uint8_t size, uint8_t *data)
 
 int i2cdev_write(i2cdev_t *i2cdev, uint8_t command, uint8_t size, uint8_t *data)
 {
-	int ret = i2c_smbus_write_i2c_block_data(i2cdev->fd, command, size, data);
+	struct timespec t0, t1;
+	int ret;
+
+	iostats_start(&t0);
+	buslog_start(&t1);
+	ret = i2c_smbus_write_i2c_block_data(i2cdev->fd, command, size, data);
+	buslog_i2c(i2cdev->num, i2cdev->addr, &t1, command, data, size, NULL, 0, (ret < 0));
+	iostats_record(i2cdev->stats, IOSTATS_WRITE, &t0, 1+size, (ret < 0));
+
 	if (ret < 0) {
 		log_str("ERROR: %sFailed to write data at 0x%02X: %s", i2cdev->hdr, command, strerror(errno));
 	}
@@ -14,9 +14,14 @@
 
 #include <stdint.h>
 
+#include "iostats.h"
+
 typedef struct {
 	char *hdr;
 	int fd;
+	int num;               // I2C bus number
+	uint8_t addr;          // I2C slave address
+	iostats_t *stats;
 } i2cdev_t;
 
 extern int i2cdev_init(i2cdev_t *i2cdev, char *hdr);
@@ -54,6 +54,7 @@
 #define INA219_CONFIG_MODE_SVOLT_CONTINUOUS     0x0005
 #define INA219_CONFIG_MODE_BVOLT_CONTINUOUS     0x0006
 #define INA219_CONFIG_MODE_SANDBVOLT_CONTINUOUS 0x0007
+#define INA219_CONFIG_MODE_MASK                 0x0007
 
 #define INA219_SHUNT_VOLTAGE 0x01
 #define INA219_BUS_VOLTAGE   0x02
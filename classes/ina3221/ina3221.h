@@ -54,6 +54,7 @@
 #define   INA3221_CONFIG_MODE_SHUNT      1
 #define   INA3221_CONFIG_MODE_BUS        2
 #define   INA3221_CONFIG_MODE_CONTINUOUS 4
+#define   INA3221_CONFIG_MODE_MASK       7
 
 #define INA3221_REG_SHUNT1            0x01
 #define INA3221_REG_BUS1              0x02
@@ -20,6 +20,11 @@
 #include "sys.h"
 #include "version.h"
 #include "i2cdev.h"
+#include "pub.h"
+#include "worker.h"
+#include "ticker.h"
+#include "group.h"
+#include "demand.h"
 #include "ina3221.h"
 
 
@@ -28,15 +33,35 @@
 #define DEFAULT_I2C_BUS 1
 
 
+typedef struct {
+        bool enabled;          // Output pad connected when the job was submitted
+        int value;
+        pub_ts_t ts;
+} sample_t;
+
 typedef struct {
 	hk_obj_t *obj;
 	char *hdr;
 	i2cdev_t i2cdev;
+        iostats_t iostats;
 	hk_pad_t *trig;
 	hk_pad_t *current[INA3221_NUM_CHANNELS];
 	hk_pad_t *voltage[INA3221_NUM_CHANNELS];
+        pub_cfg_t pub_cfg;
+        pub_t current_pub[INA3221_NUM_CHANNELS];
+        pub_t voltage_pub[INA3221_NUM_CHANNELS];
+        worker_job_t job;
+        bool refresh;
+        bool power_pending;    // Power state change waiting for the running acquisition
+        sample_t current_sample[INA3221_NUM_CHANNELS];
+        sample_t voltage_sample[INA3221_NUM_CHANNELS];
         int period;
 	sys_tag_t period_tag;
+        int precise;
+        ticker_t ticker;
+        char *group;
+        demand_t demand;
+        uint16_t config;       // Operating configuration, restored on power up
         float rshunt[INA3221_NUM_CHANNELS];
 } ctx_t;
 
@@ -119,6 +144,82 @@ static void ina3221_set_current_limit(ctx_t *ctx, int ch, char *prop_name, uint8
 }
 
 
+static void select_samples(ctx_t *ctx)
+{
+        int ch;
+
+        /* Job must be claimed: the acquisition reads these flags */
+        for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
+                ctx->voltage_sample[ch].enabled = pub_is_connected(&ctx->voltage_pub[ch]);
+                ctx->current_sample[ch].enabled = pub_is_connected(&ctx->current_pub[ch]);
+        }
+}
+
+
+static void acquire(ctx_t *ctx)
+{
+        int ch;
+
+        /* Runs in a worker or ticker thread */
+        for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
+                sample_t *voltage = &ctx->voltage_sample[ch];
+                sample_t *current = &ctx->current_sample[ch];
+
+                if (voltage->enabled) {
+                        pub_ts_get(&voltage->ts);
+                        voltage->value = ina3221_read_voltage(ctx, ch);
+                }
+
+                if (current->enabled) {
+                        pub_ts_get(&current->ts);
+                        current->value = ina3221_read_current(ctx, ch) / (200 * ctx->rshunt[ch]);
+                }
+        }
+}
+
+
+static void power_apply(ctx_t *ctx)
+{
+        /* Caller owns the acquisition job: no transfer is in flight */
+        if (demand_active(&ctx->demand)) {
+                ina3221_write_u16(&ctx->i2cdev, INA3221_REG_CONFIG, ctx->config);
+        }
+        else {
+                ina3221_write_u16(&ctx->i2cdev, INA3221_REG_CONFIG, (ctx->config & ~INA3221_CONFIG_MODE_MASK) | INA3221_CONFIG_MODE_POWERDOWN);
+        }
+}
+
+
+static void acquire_done(ctx_t *ctx)
+{
+        int ch;
+
+        for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
+                sample_t *voltage = &ctx->voltage_sample[ch];
+                sample_t *current = &ctx->current_sample[ch];
+
+                if (voltage->enabled) {
+                        pub_update(&ctx->voltage_pub[ch], voltage->value, &voltage->ts, ctx->refresh);
+                }
+
+                if (current->enabled) {
+                        pub_update(&ctx->current_pub[ch], current->value, &current->ts, ctx->refresh);
+                }
+        }
+
+        ctx->refresh = false;
+
+        /* Apply the power state change deferred by demand_changed() */
+        if (ctx->power_pending) {
+                ctx->power_pending = false;
+                power_apply(ctx);
+        }
+
+        /* Follow pad connections for the next ticker acquisition */
+        select_samples(ctx);
+}
+
+
 static int _new(hk_obj_t *obj)
 {
         int ch;
@@ -128,16 +229,21 @@ static int _new(hk_obj_t *obj)
 	memset(ctx, 0, sizeof(ctx_t));
 	ctx->obj = obj;
 	obj->ctx = ctx;
+        worker_job_init(&ctx->job, (worker_func_t) acquire, (worker_func_t) acquire_done, ctx);
 
         /* Set debug/error message header */
 	int size = strlen(CLASS_NAME) + strlen(obj->name) + 8;
 	ctx->hdr = malloc(size);
 	snprintf(ctx->hdr, size, CLASS_NAME "(%s): ", obj->name);
 
+        /* Init i/o statistics */
+        iostats_init(&ctx->iostats, obj, ctx->hdr);
+
         /* Init I2C bus interface */
         if (i2cdev_init(&ctx->i2cdev, ctx->hdr) < 0) {
 		goto failed;
         }
+        ctx->i2cdev.stats = &ctx->iostats;
 
 	/* Get I2C bus number property */
 	int bus = hk_prop_get_int(&obj->props, "bus");
@@ -160,6 +266,16 @@ static int _new(hk_obj_t *obj)
         /* Get trigger period property */
 	ctx->period = hk_prop_get_int(&obj->props, "period");
 
+        /* Get precise periodic sampling property */
+	ctx->precise = hk_prop_get_int(&obj->props, "precise");
+        ticker_init(&ctx->ticker);
+
+        /* Get sampling group property */
+	ctx->group = hk_prop_get(&obj->props, "group");
+
+        /* Get publishing properties */
+        pub_cfg_init(&ctx->pub_cfg, &obj->props);
+
         /* Get Rshunt property in ohms */
         for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
                 ctx->rshunt[ch] = 0.1;
@@ -203,11 +319,15 @@ static int _new(hk_obj_t *obj)
         }
 
         /* Get config register */
-        uint16_t config = 0;
-        if (ina3221_read_u16(&ctx->i2cdev, INA3221_REG_CONFIG, &config) < 0) {
+        if (ina3221_read_u16(&ctx->i2cdev, INA3221_REG_CONFIG, &ctx->config) < 0) {
                 goto failed;
         }
-        log_str("%sconfig = 0x%04X", ctx->hdr, config);
+        log_str("%sconfig = 0x%04X", ctx->hdr, ctx->config);
+
+	/* Attach to shared worker pool */
+	if (worker_init(&obj->props, ctx->hdr) < 0) {
+		goto failed;
+	}
 
 	/* Create pads */
         ctx->trig = hk_pad_create(obj, HK_PAD_IN, "trig");
@@ -216,9 +336,11 @@ static int _new(hk_obj_t *obj)
 
                 snprintf(str, sizeof(str), "current%d", ch+1);
                 ctx->current[ch] = hk_pad_create(obj, HK_PAD_OUT, str);
+                pub_init(&ctx->current_pub[ch], ctx->current[ch], &ctx->pub_cfg);
 
                 snprintf(str, sizeof(str), "voltage%d", ch+1);
                 ctx->voltage[ch] = hk_pad_create(obj, HK_PAD_OUT, str);
+                pub_init(&ctx->voltage_pub[ch], ctx->voltage[ch], &ctx->pub_cfg);
 
                 snprintf(str, sizeof(str), "crit%d", ch+1);
                 ina3221_set_current_limit(ctx, ch, str, INA3221_REG_CRIT1);
@@ -231,6 +353,7 @@ static int _new(hk_obj_t *obj)
 
 failed:
 	i2cdev_close(&ctx->i2cdev);
+        iostats_cleanup(&ctx->iostats);
 
 	if (ctx->hdr != NULL) {
 		free(ctx->hdr);
@@ -246,31 +369,36 @@ failed:
 
 static int input_trig(ctx_t *ctx, bool refresh)
 {
-        int ch;
-
-        for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
-                /* Read value */
-                if (hk_pad_is_connected(ctx->voltage[ch])) {
-                        int voltage = ina3221_read_voltage(ctx, ch);
-                        if (refresh || (voltage != ctx->voltage[ch]->state)) {
-                                ctx->voltage[ch]->state = voltage;
-                                hk_pad_update_int(ctx->voltage[ch], voltage);
-                        }
-                }
+        /* No consumer: chip is powered down */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
 
-                if (hk_pad_is_connected(ctx->current[ch])) {
-                        int current = ina3221_read_current(ctx, ch) / (200 * ctx->rshunt[ch]);
-                        if (refresh || (current != ctx->current[ch]->state)) {
-                                ctx->current[ch]->state = current;
-                                hk_pad_update_int(ctx->current[ch], current);
-                        }
-                }
+        /* Acquisition in progress: its result will be published */
+        if (worker_claim(&ctx->job)) {
+                ctx->refresh |= refresh;
+                return 1;
         }
 
+        ctx->refresh = refresh;
+        select_samples(ctx);
+        worker_queue(&ctx->job);
+
         return 1;
 }
 
 
+static int input_tick(ctx_t *ctx)
+{
+        /* Runs in the ticker thread */
+        if (!demand_active(&ctx->demand)) {
+                return 0;
+        }
+
+        return worker_run(&ctx->job);
+}
+
+
 static int input_trig_periodic(ctx_t *ctx)
 {
         return input_trig(ctx, false);
@@ -283,21 +411,86 @@ static int input_trig_async(ctx_t *ctx)
 }
 
 
-static void _start(hk_obj_t *obj)
+static void start_periodic(ctx_t *ctx)
 {
-	ctx_t *ctx = obj->ctx;
-        if (ctx == NULL) {
+        if (ctx->period <= 0) {
                 return;
         }
 
-        input_trig_async(ctx);
+        if (ctx->group != NULL) {
+                char bus[16];
+                snprintf(bus, sizeof(bus), "i2c-%d", ctx->i2cdev.num);
+                if (group_join(ctx->group, bus, ctx->period, (ticker_func_t) input_tick, ctx, &ctx->iostats, ctx->hdr) == 0) {
+                        return;
+                }
+        }
+
+        if (ctx->precise) {
+                if (ticker_start(&ctx->ticker, ctx->hdr, ctx->period, (ticker_func_t) input_tick, ctx, &ctx->iostats) == 0) {
+                        return;
+                }
+        }
+
+        if (ctx->period_tag != 0) {
+                sys_remove(ctx->period_tag);
+        }
+        ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) input_trig_periodic, ctx);
+}
 
-        if (ctx->period > 0) {
+
+static void power_change(ctx_t *ctx)
+{
+        /* Acquisition in progress: its completion handler applies the change */
+        if (worker_claim(&ctx->job)) {
+                ctx->power_pending = true;
+                return;
+        }
+
+        power_apply(ctx);
+        worker_release(&ctx->job);
+}
+
+
+static void demand_changed(ctx_t *ctx, int active)
+{
+        if (active) {
+                /* Power up the chip, then restart sampling */
+                power_change(ctx);
+                ticker_pause(&ctx->ticker, 0);
+                start_periodic(ctx);
+                input_trig_async(ctx);
+        }
+        else {
+                /* Stop sampling (group ticks are skipped), then power down the chip */
                 if (ctx->period_tag != 0) {
                         sys_remove(ctx->period_tag);
+                        ctx->period_tag = 0;
                 }
-                ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) input_trig_periodic, ctx);
+                ticker_pause(&ctx->ticker, 1);
+                power_change(ctx);
+        }
+}
+
+
+static void _start(hk_obj_t *obj)
+{
+	ctx_t *ctx = obj->ctx;
+        int ch;
+
+        if (ctx == NULL) {
+                return;
+        }
+
+        /* Suspend sampling when no output is consumed */
+        demand_init(&ctx->demand, obj, ctx->hdr, (demand_func_t) demand_changed, ctx);
+        for (ch = 0; ch < INA3221_NUM_CHANNELS; ch++) {
+                demand_add_pub(&ctx->demand, &ctx->current_pub[ch]);
+                demand_add_pub(&ctx->demand, &ctx->voltage_pub[ch]);
         }
+
+        input_trig_async(ctx);
+        start_periodic(ctx);
+        demand_start(&ctx->demand);
 }
 
 
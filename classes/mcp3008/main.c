@@ -16,14 +16,21 @@
 #include <malloc.h>
 #include <errno.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <mqueue.h>
+#include <math.h>
 
 #include "log.h"
 #include "mod.h"
 #include "sys.h"
 #include "version.h"
 #include "spidev.h"
+#include "spibus.h"
+#include "pub.h"
+#include "worker.h"
+#include "ticker.h"
+#include "group.h"
+#include "demand.h"
+#include "meter.h"
+#include "spectrum.h"
 
 
 #define CLASS_NAME "mcp3008"
@@ -32,35 +39,115 @@
 #define DEFAULT_SPEED_HZ 1000000
 #define DEFAULT_BITS_PER_WORD 8
 
+/* SPI clock calibration ('speed=auto') */
+#define CALIB_SAMPLES 32       // Conversions of the reference channel per step
+#define CALIB_TOLERANCE 4      // Allowed deviation from the slowest step (ADC counts)
+#define CALIB_MAX_SPREAD 16    // Largest spread accepted at the slowest step (ADC counts)
+
+static const unsigned int calib_speeds[] = {
+        500000, 1000000, 1350000, 1800000, 2400000, 3000000, 3600000,
+};
+#define CALIB_NSPEEDS ((int) (sizeof(calib_speeds) / sizeof(calib_speeds[0])))
+
 #define NCHANS 8
-#define MSG_MAXSIZE 16
+
+#define MIN_TICK 10            // Shortest sequencer tick for per-channel periods (ms)
 
 #define DEFAULT_SCALE (3300.0/1024.0)
 
+/* AC metering outputs */
+enum {
+        METER_VRMS=0,
+        METER_IRMS,
+        METER_POWER,
+        METER_VA,
+        METER_PF,
+        METER_FREQ,
+        METER_NPADS
+};
+
+static char *meter_pad_names[METER_NPADS] = { "vrms", "irms", "power", "va", "pf", "freq" };
+
+#define MCP3008_XFER_SIZE 3   // Bytes per conversion
+#define MCP3008_SCAN_STEP 8   // Conversions per scan step, before letting synchronous calls in
+
 typedef struct {
 	hk_obj_t *obj;
 	char *hdr;
 	spidev_t spidev;
-	pthread_t thr;
-	mqd_t qin;
-	mqd_t qout;
-	sys_tag_t qout_tag;
+        spibus_t *spibus;
+        iostats_t iostats;
+        worker_job_t scan;     // Conversion of all pending channels
+        unsigned int chan_mask; // Enabled channels
+        unsigned int pending;  // Channels to convert at next scan, atomic
+        unsigned int scan_mask; // Channels converted by the last scan
+        int scan_err;
+        unsigned char *scan_buf; // Combined transfer buffer [NCHANS * mean]
+        int values[NCHANS];
+        pub_ts_t scan_ts;
+        sys_tag_t retrig_tag;
 	bool force[NCHANS];
 	unsigned char cfg[NCHANS];
 	hk_pad_t *trig[NCHANS];
 	hk_pad_t *out[NCHANS];
+        pub_cfg_t pub_cfg;
+        pub_t out_pub[NCHANS];
 	hk_pad_t *trig_all;
         int period;
+        int rates[NCHANS];     // Per-channel sampling period (ms), 0 if not sampled periodically
+        int countdown[NCHANS]; // Time left until next sampling of each channel (ms)
+        int tick;              // Sequencer tick: greatest common divisor of channel periods (ms)
         int mean;
 	sys_tag_t period_tag;
+        int precise;
+        ticker_t ticker;
+        char *group;
+        demand_t demand;
         float scale[NCHANS];
+        int metering;          // AC metering enabled ('meter' property)
+        meter_t meter;
+        float vscale;          // Voltage units per ADC count
+        float iscale;          // Current units per ADC count
+        hk_pad_t *meter_pad[METER_NPADS];
+        pub_t meter_pub[METER_NPADS];
+        int spectrum_chan;     // Spectrum analysis channel, -1 if disabled ('spectrum' property)
+        spectrum_t spectrum;
+        hk_pad_t *band[SPECTRUM_MAX_BANDS];
+        pub_t band_pub[SPECTRUM_MAX_BANDS];
+        hk_pad_t *peak;
+        pub_t peak_pub;
 } ctx_t;
 
 
 typedef struct {
-	unsigned int chan;
-	int value;
-} msg_t;
+        ctx_t *ctx;
+        unsigned char *buf;
+        int count;
+        int ret;
+} xfer_t;
+
+
+static void xfer_run(xfer_t *xfer)
+{
+        /* Runs in the SPI bus thread */
+        xfer->ret = spidev_transfer(&xfer->ctx->spidev, xfer->buf, MCP3008_XFER_SIZE, xfer->count);
+}
+
+
+static int bus_transfer(ctx_t *ctx, unsigned char *buf, int count)
+{
+        xfer_t xfer = {
+                .ctx = ctx,
+                .buf = buf,
+                .count = count,
+                .ret = -1,
+        };
+
+        /* Conversions from other threads go through the SPI bus thread too */
+        spibus_call(ctx->spibus, (worker_func_t) xfer_run, &xfer);
+
+        return xfer.ret;
+}
 
 
 static int read_value(ctx_t *ctx, unsigned char cfg)
@@ -77,7 +164,7 @@ static int read_value(ctx_t *ctx, unsigned char cfg)
 	log_debug(2, "%sread_value diff=%u chan=%u", ctx->hdr, (cfg >> 7) & 1, (cfg >> 4) & 0x7);
 	log_debug(2, "%sSPI write %02X %02X %02X", ctx->hdr, buf[0], buf[1], buf[2]);
 
-	size = spidev_write_read(&ctx->spidev, buf, sizeof(buf));
+	size = bus_transfer(ctx, buf, 1);
 	if (size == sizeof(buf)) {
 		value = (((unsigned int) (buf[1] & 0x03)) << 8) | buf[2];
 		log_debug(2, "%sSPI read %02X %02X %02X => %d", ctx->hdr, buf[0], buf[1], buf[2], value);
@@ -87,147 +174,376 @@ static int read_value(ctx_t *ctx, unsigned char cfg)
 }
 
 
-static void *qin_recv_loop(void *_ctx)
+static void acquire(ctx_t *ctx)
 {
-	ctx_t *ctx = _ctx;
-	int ret = 0;
-
-	while (ret == 0) {
-		char mbuf[MSG_MAXSIZE];
-		ssize_t msize;
-
-		msize = mq_receive(ctx->qin, mbuf, sizeof(mbuf), NULL);
-		if (msize < 0) {
-			if ((errno != EAGAIN) && (errno != EINTR)) {
-				log_str("PANIC: %sCannot read input queue: %s", ctx->hdr, strerror(errno));
-			}
-		}
+        unsigned char *buf = ctx->scan_buf;
+        unsigned int mask;
+        int count = 0;
+        int chan;
+        int i;
 
-		log_debug(2, "%sqin_recv_loop -> %d", ctx->hdr, msize);
-
-		if (msize == sizeof(unsigned int)) {
-			unsigned int *pchan = (unsigned int *) mbuf;
-                        unsigned int chan = *pchan;
-
-			if (chan < NCHANS) {
-                                int acc = 0;
-                                int count = 0;
-                                int i;
-
-                                for (i = 0; i < ctx->mean; i++) {
-                                        int value = read_value(ctx, ctx->cfg[chan]);
-                                        if (value < 0) {
-                                                break;
-                                        }
-
-                                        acc += value;
-                                        count++;
-                                }
-
-                                if (count > 1) {
-                                        acc /= count;
-                                }
-
-				msg_t msg = {
-					.chan = chan,
-					.value = acc,
-				};
-
-				if (mq_send(ctx->qout, (char *) &msg, sizeof(msg), 0) < 0) {
-					log_str("PANIC: %sCannot write output queue: %s", ctx->hdr, strerror(errno));
-					ret = -1;
-				}
-			}
-			else {
-				ret = 1;
-				log_debug(1, "%sLeaving input loop", ctx->hdr);
-			}
-		}
-		else {
-			log_str("PANIC: %sIllegal data received from input queue (%d bytes)", ctx->hdr, msize);
-		}
-	}
+        /* Runs in the SPI bus thread: take all pending channels */
+        mask = __atomic_exchange_n(&ctx->pending, 0, __ATOMIC_ACQ_REL);
+        ctx->scan_mask = mask;
+
+        for (chan = 0; chan < NCHANS; chan++) {
+                if (mask & (1 << chan)) {
+                        for (i = 0; i < ctx->mean; i++) {
+                                buf[0] = 0x01;             // Start bit
+                                buf[1] = ctx->cfg[chan];   // SGL/DIF, D2..D0
+                                buf[2] = 0x00;
+                                buf += MCP3008_XFER_SIZE;
+                                count++;
+                        }
+                }
+        }
+
+        log_debug(2, "%sacquire mask=%02X count=%d", ctx->hdr, mask, count);
+
+        /* Conversions of the scan as combined messages, in short steps so
+           that metering and spectrum reads are not held off the bus */
+        pub_ts_get(&ctx->scan_ts);
+        ctx->scan_err = 0;
+        for (i = 0; i < count; i += MCP3008_SCAN_STEP) {
+                int n = (count - i > MCP3008_SCAN_STEP) ? MCP3008_SCAN_STEP : (count - i);
+
+                if (i > 0) {
+                        spibus_yield(ctx->spibus);
+                }
+
+                if (spidev_transfer(&ctx->spidev, ctx->scan_buf + i * MCP3008_XFER_SIZE, MCP3008_XFER_SIZE, n) < 0) {
+                        ctx->scan_err = 1;
+                        break;
+                }
+        }
+
+        buf = ctx->scan_buf;
+        for (chan = 0; chan < NCHANS; chan++) {
+                if (mask & (1 << chan)) {
+                        int acc = 0;
+
+                        for (i = 0; i < ctx->mean; i++) {
+                                acc += (((unsigned int) (buf[1] & 0x03)) << 8) | buf[2];
+                                buf += MCP3008_XFER_SIZE;
+                        }
+
+                        ctx->values[chan] = acc / ctx->mean;
+                }
+        }
+}
 
-	return NULL;
+
+static int retrigger(ctx_t *ctx)
+{
+        ctx->retrig_tag = 0;
+        spibus_submit(ctx->spibus, &ctx->scan);
+        return 0;
 }
 
 
-static int qout_recv(ctx_t *ctx, int fd)
+static void acquire_done(ctx_t *ctx)
 {
-	char mbuf[MSG_MAXSIZE];
-	ssize_t msize;
-
-	msize = mq_receive(ctx->qout, mbuf, sizeof(mbuf), NULL);
-	if (msize < 0) {
-		if ((errno != EAGAIN) && (errno != EINTR)) {
-			log_str("PANIC: %sCannot receive from output queue: %s", ctx->hdr, strerror(errno));
-			return 0;
-		}
-	}
+        int chan;
+
+        if (!ctx->scan_err) {
+                for (chan = 0; chan < NCHANS; chan++) {
+                        if (ctx->scan_mask & (1 << chan)) {
+                                int value = ctx->scale[chan] * ctx->values[chan];
+
+                                log_debug(2, "%sacquire_done chan=%u -> %d", ctx->hdr, chan, ctx->values[chan]);
 
-	log_debug(2, "%sqout_recv -> %d", ctx->hdr, msize);
-
-	if (msize == sizeof(msg_t)) {
-		msg_t *msg = (msg_t *) mbuf;
-		if (msg->chan < NCHANS) {
-                        hk_pad_t *out = ctx->out[msg->chan];
-                        int value = ctx->scale[msg->chan] * msg->value;
-                        if ((ctx->force[msg->chan]) || (value != out->state)) {
-                                ctx->force[msg->chan] = false;
-                                out->state = value;
-                                hk_pad_update_int(out, value);
+                                pub_update(&ctx->out_pub[chan], value, &ctx->scan_ts, ctx->force[chan]);
+                                ctx->force[chan] = false;
                         }
-		}
-		else {
-			log_str("PANIC: %sIllegal channel number received from output queue (%u)", ctx->hdr, msg->chan);
-		}
-	}
-	else {
-		log_str("PANIC: %sIllegal data received from output queue (%d bytes)", ctx->hdr, msize);
-	}
+                }
+        }
 
-	return 1;
+        /* Channels triggered while this scan was running: the job is
+           still claimed until we return, so scan them from the main loop */
+        if ((__atomic_load_n(&ctx->pending, __ATOMIC_ACQUIRE) != 0) && (ctx->retrig_tag == 0)) {
+                ctx->retrig_tag = sys_timeout(0, (sys_func_t) retrigger, ctx);
+        }
+}
+
+
+static int meter_read(ctx_t *ctx, unsigned char vcfg, unsigned char icfg, int *values)
+{
+        unsigned char buf[3 * MCP3008_XFER_SIZE];
+        int i;
+
+        /* Runs in the metering thread: voltage, current, then voltage
+           again, as one message so that conversions are evenly spaced */
+        for (i = 0; i < 3; i++) {
+                unsigned char *p = buf + i * MCP3008_XFER_SIZE;
+                p[0] = 0x01;
+                p[1] = (i == 1) ? icfg : vcfg;
+                p[2] = 0x00;
+        }
+
+        if (bus_transfer(ctx, buf, 3) < 0) {
+                return -1;
+        }
+
+        for (i = 0; i < 3; i++) {
+                unsigned char *p = buf + i * MCP3008_XFER_SIZE;
+                values[i] = (((unsigned int) (p[1] & 0x03)) << 8) | p[2];
+        }
+
+        return 0;
 }
 
 
-static int create_queue(ctx_t *ctx, char *name, int flags)
+static int spectrum_read(ctx_t *ctx, unsigned char cfg)
 {
-	char qname[128];
-	int mqd;
+        /* Runs in the spectrum analysis thread */
+        return read_value(ctx, cfg);
+}
 
-	snprintf(qname, sizeof(qname), "/hakit-%d-%s-%s", getpid(), ctx->obj->name, name);
-	log_debug(2, "%screate_queue '%s'", ctx->hdr, qname);
 
-	int qflags = O_RDWR | O_CLOEXEC | O_CREAT | O_EXCL | flags;
-	struct mq_attr qattr = {
-		.mq_flags   = flags,
-		.mq_maxmsg  = NCHANS,
-		.mq_msgsize = MSG_MAXSIZE,
-	};
+static void meter_done(ctx_t *ctx, meter_result_t *result)
+{
+        int values[METER_NPADS];
+        int i;
 
-	mqd = mq_open(qname, qflags, S_IRUSR | S_IWUSR, &qattr);
-	if (mqd < 0) {
-		log_str("PANIC: %sCannot create %sput queue: %s", ctx->hdr, name, strerror(errno));
-		return -1;
-	}
+        log_debug(2, "%smeter_done n=%lu cycles=%d vrms=%.1f irms=%.1f p=%.1f pf=%.3f f=%.3f", ctx->hdr,
+                  result->n, result->cycles, result->vrms, result->irms, result->power, result->pf, result->freq);
 
-	/* Hide message queue from other processes */
-	if (mq_unlink(qname) < 0) {
-		log_str("PANIC: %sCannot unlink %sput queue: %s", ctx->hdr, name, strerror(errno));
-		mq_close(mqd);
-		return -1;
-	}
+        values[METER_VRMS] = lrint(result->vrms * ctx->vscale);
+        values[METER_IRMS] = lrint(result->irms * ctx->iscale);
+        values[METER_POWER] = lrint(result->power * ctx->vscale * ctx->iscale);
+        values[METER_VA] = lrint(result->va * ctx->vscale * ctx->iscale);
+        values[METER_PF] = lrint(result->pf * 1000);
+        values[METER_FREQ] = lrint(result->freq * 1000);
+
+        for (i = 0; i < METER_NPADS; i++) {
+                pub_update(&ctx->meter_pub[i], values[i], &result->ts, 0);
+        }
+}
+
+
+static void spectrum_done(ctx_t *ctx, spectrum_result_t *result)
+{
+        float scale = ctx->scale[ctx->spectrum_chan];
+        int i;
+
+        log_debug(2, "%sspectrum_done peak=%.2f", ctx->hdr, result->peak);
 
-	return mqd;
+        for (i = 0; i < ctx->spectrum.nbands; i++) {
+                pub_update(&ctx->band_pub[i], lrint(result->band[i] * scale), &result->ts, 0);
+        }
+
+        pub_update(&ctx->peak_pub, lrint(result->peak * 1000), &result->ts, 0);
+}
+
+
+static int parse_bands(ctx_t *ctx, char *str)
+{
+        while ((str != NULL) && (*str != '\0')) {
+                char *end;
+                float lo = strtof(str, &end);
+                float hi;
+
+                if ((end == str) || (*end != '-')) {
+                        return -1;
+                }
+
+                str = end + 1;
+                hi = strtof(str, &end);
+                if ((end == str) || (spectrum_add_band(&ctx->spectrum, lo, hi) < 0)) {
+                        return -1;
+                }
+
+                str = end;
+                while ((*str == ',') || ((*str != '\0') && (*str <= ' '))) {
+                        str++;
+                }
+        }
+
+        return 0;
+}
+
+
+static int parse_channel(char *str, unsigned char *cfg)
+{
+        unsigned char diff = 0x80;
+        char *end;
+
+        while ((*str != '\0') && (*str <= ' ')) {
+                str++;
+        }
+
+        if (*str == '*') {
+                str++;
+                diff = 0x00;
+        }
+
+        unsigned long chan = strtoul(str, &end, 0);
+        if ((end == str) || (chan >= NCHANS)) {
+                return -1;
+        }
+
+        *cfg = diff | ((chan & 0x07) << 4);
+
+        return 0;
+}
+
+
+static int calib_sample(ctx_t *ctx, unsigned char cfg, int *pmean, int *pspread)
+{
+        unsigned char buf[CALIB_SAMPLES * MCP3008_XFER_SIZE];
+        int min = 1023, max = 0;
+        int sum = 0;
+        int i;
+
+        for (i = 0; i < CALIB_SAMPLES; i++) {
+                unsigned char *p = buf + i * MCP3008_XFER_SIZE;
+                p[0] = 0x01;
+                p[1] = cfg;
+                p[2] = 0x00;
+        }
+
+        if (spidev_transfer(&ctx->spidev, buf, MCP3008_XFER_SIZE, CALIB_SAMPLES) < 0) {
+                return -1;
+        }
+
+        for (i = 0; i < CALIB_SAMPLES; i++) {
+                unsigned char *p = buf + i * MCP3008_XFER_SIZE;
+                int value;
+
+                /* The null bit preceding B9 must read low */
+                if (p[1] & 0x04) {
+                        return -1;
+                }
+
+                value = (((unsigned int) (p[1] & 0x03)) << 8) | p[2];
+                if (value < min) {
+                        min = value;
+                }
+                if (value > max) {
+                        max = value;
+                }
+                sum += value;
+        }
+
+        *pmean = sum / CALIB_SAMPLES;
+        *pspread = max - min;
+
+        return 0;
+}
+
+
+static int is_streamed(ctx_t *ctx, unsigned char cfg)
+{
+        int chan = (cfg >> 4) & 0x07;
+
+        /* Read continuously by the metering or spectrum thread */
+        if (ctx->metering && ((chan == ((ctx->meter.vcfg >> 4) & 0x07)) || (chan == ((ctx->meter.icfg >> 4) & 0x07)))) {
+                return 1;
+        }
+
+        return (chan == ctx->spectrum_chan);
+}
+
+
+static void calibrate_speed(ctx_t *ctx, unsigned char cfg)
+{
+        unsigned int configured = ctx->spidev.speed_hz;
+        unsigned int best = 0;
+        int ref_mean = 0, ref_spread = 0;
+        int i;
+
+        /* Sweep up from the slowest clock, which gives the reference
+           conversion results, and stop at the first unreliable step */
+        for (i = 0; i < CALIB_NSPEEDS; i++) {
+                int mean, spread;
+
+                if (spidev_set_speed(&ctx->spidev, calib_speeds[i]) < 0) {
+                        break;
+                }
+
+                if (calib_sample(ctx, cfg, &mean, &spread) < 0) {
+                        log_debug(1, "%sSPI clock %u Hz: transfer or null bit error", ctx->hdr, calib_speeds[i]);
+                        break;
+                }
+
+                log_debug(1, "%sSPI clock %u Hz: mean=%d spread=%d", ctx->hdr, calib_speeds[i], mean, spread);
+
+                if (i == 0) {
+                        /* Reference channel must be steady at the slowest clock */
+                        if (spread > CALIB_MAX_SPREAD) {
+                                break;
+                        }
+                        ref_mean = mean;
+                        ref_spread = spread;
+                }
+                else if ((abs(mean - ref_mean) > CALIB_TOLERANCE) || (spread > (2 * ref_spread) + CALIB_TOLERANCE)) {
+                        break;
+                }
+
+                best = calib_speeds[i];
+        }
+
+        /* Keep the clock the chip was set up with: the slowest step
+           is no safer if the reference channel is just noisy */
+        if (best == 0) {
+                best = configured;
+                log_str("ERROR: %sSPI clock calibration failed on channel %u, using %u Hz", ctx->hdr, (cfg >> 4) & 0x07, best);
+        }
+        else {
+                log_str("%sSPI clock calibrated to %u Hz on channel %u", ctx->hdr, best, (cfg >> 4) & 0x07);
+        }
+
+        spidev_set_speed(&ctx->spidev, best);
 }
 
 
 static int trigger(ctx_t *ctx, unsigned int chan, bool force)
 {
-        ctx->force[chan] = force;
+        /* No consumer: sampling is suspended */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
+
+        /* Keep a pending refresh request until the value is published */
+        if (force) {
+                ctx->force[chan] = true;
+        }
+
+        /* A scan not started yet will include the channel */
+        __atomic_or_fetch(&ctx->pending, 1 << chan, __ATOMIC_ACQ_REL);
+	if (spibus_submit(ctx->spibus, &ctx->scan) < 0) {
+                return 0;
+	}
+
+	return 1;
+}
+
+
+static int trigger_mask(ctx_t *ctx, unsigned int mask, bool force)
+{
+        int chan;
+
+        /* No consumer: sampling is suspended */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
+
+        /* Nothing due */
+        if (mask == 0) {
+                return 1;
+        }
+
+        if (force) {
+                for (chan = 0; chan < NCHANS; chan++) {
+                        if (mask & (1 << chan)) {
+                                ctx->force[chan] = true;
+                        }
+                }
+        }
 
-	if (mq_send(ctx->qin, (char *) &chan, sizeof(chan), 0) < 0) {
-		log_str("PANIC: %sCannot write input queue: %s", ctx->hdr, strerror(errno));
+        /* All channels are converted by one scan */
+        __atomic_or_fetch(&ctx->pending, mask, __ATOMIC_ACQ_REL);
+	if (spibus_submit(ctx->spibus, &ctx->scan) < 0) {
                 return 0;
 	}
 
@@ -237,23 +553,62 @@ static int trigger(ctx_t *ctx, unsigned int chan, bool force)
 
 static int trigger_all(ctx_t *ctx, bool force)
 {
+        return trigger_mask(ctx, ctx->chan_mask, force);
+}
+
+
+static unsigned int sequence(ctx_t *ctx)
+{
+        unsigned int mask = 0;
         int chan;
 
+        /* Channels due on this sequencer tick */
         for (chan = 0; chan < NCHANS; chan++) {
-                if (ctx->trig[chan] != NULL) {
-                        if (!trigger(ctx, chan, force)) {
-                                return 0;
+                if (ctx->rates[chan] > 0) {
+                        ctx->countdown[chan] -= ctx->tick;
+                        if (ctx->countdown[chan] <= 0) {
+                                ctx->countdown[chan] += ctx->rates[chan];
+                                mask |= 1 << chan;
                         }
                 }
         }
 
-	return 1;
+        return mask;
 }
 
 
 static int trigger_periodic(ctx_t *ctx)
 {
-        return trigger_all(ctx, false);
+        return trigger_mask(ctx, sequence(ctx), false);
+}
+
+
+static int trigger_tick(ctx_t *ctx)
+{
+        unsigned int mask;
+
+        /* Runs in the ticker or group thread: the scan is done now, on time */
+        if (!demand_active(&ctx->demand)) {
+                return 0;
+        }
+
+        mask = sequence(ctx);
+        if (mask == 0) {
+                return 0;
+        }
+
+        __atomic_or_fetch(&ctx->pending, mask, __ATOMIC_ACQ_REL);
+
+        /* A scan not started yet will include the channels */
+        if (worker_claim(&ctx->scan)) {
+                return 1;
+        }
+
+        /* Convert in the SPI bus thread, then publish from the main loop */
+        spibus_call(ctx->spibus, (worker_func_t) acquire, ctx);
+        worker_complete(&ctx->scan);
+
+        return 0;
 }
 
 
@@ -263,6 +618,7 @@ static int _new(hk_obj_t *obj)
 	char *id;
 	char *str;
 	int size;
+	int i;
 
 	/* Alloc object context */
 	ctx = malloc(sizeof(ctx_t));
@@ -270,8 +626,7 @@ static int _new(hk_obj_t *obj)
 	ctx->obj = obj;
 	obj->ctx = ctx;
 	spidev_init(&ctx->spidev, DEFAULT_SPEED_HZ, DEFAULT_BITS_PER_WORD);
-	ctx->qin = -1;
-	ctx->qout = -1;
+        worker_job_init(&ctx->scan, (worker_func_t) acquire, (worker_func_t) acquire_done, ctx);
 
 	/* Get SPI device id */
 	id = hk_prop_get(&obj->props, "id");
@@ -284,12 +639,105 @@ static int _new(hk_obj_t *obj)
 	ctx->hdr = malloc(size);
 	snprintf(ctx->hdr, size, CLASS_NAME "(%s): ", ctx->obj->name);
 
+        /* Init i/o statistics */
+        iostats_init(&ctx->iostats, obj, ctx->hdr);
+        ctx->spidev.stats = &ctx->iostats;
+
         /* Get period property */
 	ctx->period = hk_prop_get_int(&obj->props, "period");
 
+        /* Get precise periodic sampling property */
+	ctx->precise = hk_prop_get_int(&obj->props, "precise");
+        ticker_init(&ctx->ticker);
+
+        /* Get sampling group property */
+	ctx->group = hk_prop_get(&obj->props, "group");
+
+        /* Get publishing properties */
+        pub_cfg_init(&ctx->pub_cfg, &obj->props);
+
+        /* Get AC metering channel pair property */
+	str = hk_prop_get(&obj->props, "meter");
+        if (str != NULL) {
+                unsigned char vcfg, icfg;
+                char *comma = strchr(str, ',');
+
+                if ((comma == NULL) || (parse_channel(str, &vcfg) < 0) || (parse_channel(comma+1, &icfg) < 0)) {
+                        log_str("ERROR: %sInvalid AC metering channel pair '%s'", ctx->hdr, str);
+                        goto failed;
+                }
+
+                meter_init(&ctx->meter, vcfg, icfg, hk_prop_get_int(&obj->props, "meter_rate"), hk_prop_get_int(&obj->props, "meter_cycles"));
+                ctx->metering = 1;
+
+                ctx->vscale = 1.0;
+                str = hk_prop_get(&obj->props, "vscale");
+                if (str != NULL) {
+                        ctx->vscale = atof(str);
+                }
+
+                ctx->iscale = 1.0;
+                str = hk_prop_get(&obj->props, "iscale");
+                if (str != NULL) {
+                        ctx->iscale = atof(str);
+                }
+
+                for (i = 0; i < METER_NPADS; i++) {
+                        ctx->meter_pad[i] = hk_pad_create(obj, HK_PAD_OUT, meter_pad_names[i]);
+                        pub_init(&ctx->meter_pub[i], ctx->meter_pad[i], &ctx->pub_cfg);
+                }
+        }
+
+        /* Get spectrum analysis channel property */
+        ctx->spectrum_chan = -1;
+	str = hk_prop_get(&obj->props, "spectrum");
+        if (str != NULL) {
+                unsigned char cfg;
+
+                if (parse_channel(str, &cfg) < 0) {
+                        log_str("ERROR: %sInvalid spectrum analysis channel '%s'", ctx->hdr, str);
+                        goto failed;
+                }
+
+                if (spectrum_init(&ctx->spectrum, ctx->hdr, cfg,
+                                  hk_prop_get_int(&obj->props, "spectrum_rate"),
+                                  hk_prop_get_int(&obj->props, "spectrum_size"),
+                                  hk_prop_get_int(&obj->props, "spectrum_period")) < 0) {
+                        goto failed;
+                }
+
+                ctx->spectrum_chan = (cfg >> 4) & 0x07;
+                ctx->scale[ctx->spectrum_chan] = DEFAULT_SCALE;
+
+                /* Frequency bands, 4 equal bands up to Nyquist by default */
+                str = hk_prop_get(&obj->props, "bands");
+                if (str != NULL) {
+                        if (parse_bands(ctx, str) < 0) {
+                                log_str("ERROR: %sInvalid spectrum bands '%s'", ctx->hdr, str);
+                                goto failed;
+                        }
+                }
+                else {
+                        float width = ctx->spectrum.rate / 8.0;
+                        for (i = 0; i < 4; i++) {
+                                spectrum_add_band(&ctx->spectrum, i * width, (i + 1) * width);
+                        }
+                }
+
+                for (i = 0; i < ctx->spectrum.nbands; i++) {
+                        char buf[16];
+                        snprintf(buf, sizeof(buf), "band%d", i);
+                        ctx->band[i] = hk_pad_create(obj, HK_PAD_OUT, buf);
+                        pub_init(&ctx->band_pub[i], ctx->band[i], &ctx->pub_cfg);
+                }
+
+                ctx->peak = hk_pad_create(obj, HK_PAD_OUT, "peak");
+                pub_init(&ctx->peak_pub, ctx->peak, &ctx->pub_cfg);
+        }
+
 	/* Get list of channels */
 	str = hk_prop_get(&obj->props, "channels");
-	if (str == NULL) {
+	if ((str == NULL) && !ctx->metering && (ctx->spectrum_chan < 0)) {
 		goto failed;
 	}
 
@@ -317,6 +765,7 @@ static int _new(hk_obj_t *obj)
 			char buf[16];
 
                         ctx->cfg[chan] = diff | ((chan & 0x07) << 4);
+                        ctx->chan_mask |= 1 << chan;
 
 			snprintf(buf, sizeof(buf), "trig%u", chan);
 			ctx->trig[chan] = hk_pad_create(obj, HK_PAD_IN, buf);
@@ -325,6 +774,7 @@ static int _new(hk_obj_t *obj)
 			snprintf(buf, sizeof(buf), "out%u", chan);
 			ctx->out[chan] = hk_pad_create(obj, HK_PAD_IN, buf);
 			ctx->out[chan]->state = 0;
+                        pub_init(&ctx->out_pub[chan], ctx->out[chan], &ctx->pub_cfg);
                         ctx->force[chan] = true; // Force value refresh
                         ctx->scale[chan] = DEFAULT_SCALE;
 		}
@@ -332,6 +782,9 @@ static int _new(hk_obj_t *obj)
 		str = end;
 	}
 
+        /* Alloc scan transfer buffer */
+        ctx->scan_buf = malloc(NCHANS * ctx->mean * MCP3008_XFER_SIZE);
+
         /* Create global trigger input */
         ctx->trig_all = hk_pad_create(obj, HK_PAD_IN, "trig");
 
@@ -356,50 +809,134 @@ static int _new(hk_obj_t *obj)
                 str = end;
 	}
 
+	/* Get list of per-channel sampling periods, 'period' by default */
+        for (chan = 0; chan < NCHANS; chan++) {
+                if (ctx->chan_mask & (1 << chan)) {
+                        ctx->rates[chan] = (ctx->period > 0) ? ctx->period : 0;
+                }
+        }
+
+        chan = 0;
+	str = hk_prop_get(&obj->props, "rates");
+	while ((str != NULL) && (chan < NCHANS)) {
+		char *end = strchr(str, ',');
+		if (end != NULL) {
+			*(end++) = '\0';
+		}
+
+                while ((*str != '\0') && (*str <= ' ')) {
+                        str++;
+                }
+
+                if ((*str != '\0') && (ctx->chan_mask & (1 << chan))) {
+                        ctx->rates[chan] = atoi(str);
+                }
+
+                chan++;
+                str = end;
+	}
+
+        /* Sequencer ticks on the greatest common divisor of all periods */
+        int min_rate = 0;
+        ctx->tick = 0;
+        for (chan = 0; chan < NCHANS; chan++) {
+                int a = ctx->rates[chan];
+                int b = ctx->tick;
+
+                if (a <= 0) {
+                        ctx->rates[chan] = 0;
+                        continue;
+                }
+
+                if ((min_rate == 0) || (a < min_rate)) {
+                        min_rate = a;
+                }
+
+                while (b > 0) {
+                        int r = a % b;
+                        a = b;
+                        b = r;
+                }
+                ctx->tick = a;
+        }
+
+        /* Periods with a tiny common divisor, e.g. rates=999,1000, would
+           tick every ms: tick slower, channels are then due on the
+           nearest tick, and keep their period on average */
+        if ((ctx->tick > 0) && (ctx->tick < MIN_TICK) && (ctx->tick < min_rate)) {
+                int tick = (min_rate < MIN_TICK) ? min_rate : MIN_TICK;
+                log_str("ERROR: %sSequencer tick %d ms is too short for the channel periods, using %d ms", ctx->hdr, ctx->tick, tick);
+                ctx->tick = tick;
+        }
+
+        if (ctx->tick > 0) {
+                log_debug(1, "%sSequencer tick: %d ms", ctx->hdr, ctx->tick);
+        }
+
+        /* Get SPI clock speed property, in Hz or 'auto' */
+	str = hk_prop_get(&obj->props, "speed");
+        if ((str != NULL) && (strcmp(str, "auto") != 0)) {
+                int speed_hz = atoi(str);
+                if (speed_hz > 0) {
+                        ctx->spidev.speed_hz = speed_hz;
+                }
+        }
+
 	/* Open SPI device name */
 	if (spidev_open(&ctx->spidev, ctx->hdr, id) < 0) {
 		goto failed;
 	}
 
-	/* Create input request queue */
-	ctx->qin = create_queue(ctx, "in", 0);
-	if (ctx->qin < 0) {
-		goto failed;
-	}
+        /* Find the fastest reliable SPI clock on a reference channel,
+           by default the first sampled channel that carries no AC signal */
+        if ((str != NULL) && (strcmp(str, "auto") == 0)) {
+                unsigned char cfg = 0;
+                int found = 0;
 
-	/* Create output result queue */
-	ctx->qout = create_queue(ctx, "out", O_NONBLOCK);
-	if (ctx->qout < 0) {
-		goto failed;
-	}
+                for (i = NCHANS-1; i >= 0; i--) {
+                        if ((ctx->chan_mask & (1 << i)) && !is_streamed(ctx, ctx->cfg[i])) {
+                                cfg = ctx->cfg[i];
+                                found = 1;
+                        }
+                }
+
+                str = hk_prop_get(&obj->props, "speed_ref");
+                if (str != NULL) {
+                        if (parse_channel(str, &cfg) < 0) {
+                                log_str("ERROR: %sInvalid SPI clock reference channel '%s'", ctx->hdr, str);
+                                goto failed;
+                        }
+                        found = 1;
+                }
 
-	ctx->qout_tag = sys_io_watch(ctx->qout, (sys_io_func_t) qout_recv, ctx);
+                if (found) {
+                        calibrate_speed(ctx, cfg);
+                }
+                else {
+                        log_str("ERROR: %sNo steady channel for SPI clock calibration, set 'speed_ref'. Using %u Hz", ctx->hdr, ctx->spidev.speed_hz);
+                }
+        }
 
-	/* Create read thread */
-	if (pthread_create(&ctx->thr, NULL, qin_recv_loop, ctx)) {
-		log_str("PANIC: %sFailed to create thread: %s", ctx->hdr, strerror(errno));
+	/* Attach to shared worker pool, for real-time settings and completions */
+	if (worker_init(&obj->props, ctx->hdr) < 0) {
 		goto failed;
 	}
 
+        /* Attach to the SPI controller scheduler */
+        ctx->spibus = spibus_attach(ctx->spidev.bus, ctx->hdr);
+        if (ctx->spibus == NULL) {
+                goto failed;
+        }
+
 	return 0;
 
 failed:
-	if (ctx->qout_tag != 0) {
-		sys_remove(ctx->qout_tag);
-		ctx->qout_tag = 0;
-	}
-
-	if (ctx->qout >= 0) {
-		mq_close(ctx->qout);
-		ctx->qout = -1;
-	}
-
-	if (ctx->qin >= 0) {
-		mq_close(ctx->qin);
-		ctx->qin = -1;
-	}
-
 	spidev_close(&ctx->spidev);
+        iostats_cleanup(&ctx->iostats);
+
+        if (ctx->scan_buf != NULL) {
+                free(ctx->scan_buf);
+        }
 
 	if (ctx->hdr != NULL) {
 		free(ctx->hdr);
@@ -414,15 +951,100 @@ failed:
 }
 
 
+static void start_periodic(ctx_t *ctx)
+{
+        if (ctx->tick <= 0) {
+                return;
+        }
+
+        if (ctx->group != NULL) {
+                char bus[16];
+                snprintf(bus, sizeof(bus), "spi-%d", ctx->spidev.bus);
+                if (group_join(ctx->group, bus, ctx->tick, (ticker_func_t) trigger_tick, ctx, &ctx->iostats, ctx->hdr) == 0) {
+                        return;
+                }
+
+                /* The group period is matched against the sequencer tick */
+                if (ctx->tick != ctx->period) {
+                        log_str("ERROR: %sSequencer tick %d ms from 'rates' is not the period of sampling group '%s': sampling outside the group",
+                                ctx->hdr, ctx->tick, ctx->group);
+                }
+        }
+
+        if (ctx->precise) {
+                if (ticker_start(&ctx->ticker, ctx->hdr, ctx->tick, (ticker_func_t) trigger_tick, ctx, &ctx->iostats) == 0) {
+                        return;
+                }
+        }
+
+        if (ctx->period_tag != 0) {
+                sys_remove(ctx->period_tag);
+        }
+        ctx->period_tag = sys_timeout(ctx->tick, (sys_func_t) trigger_periodic, ctx);
+}
+
+
+static void demand_changed(ctx_t *ctx, int active)
+{
+        if (ctx->metering) {
+                meter_pause(&ctx->meter, !active);
+        }
+
+        if (ctx->spectrum_chan >= 0) {
+                spectrum_pause(&ctx->spectrum, !active);
+        }
+
+        if (active) {
+                ticker_pause(&ctx->ticker, 0);
+                start_periodic(ctx);
+                trigger_all(ctx, true);
+        }
+        else {
+                /* The MCP3008 has no power-down command: it enters standby
+                   by itself between conversions, so just stop sampling */
+                if (ctx->period_tag != 0) {
+                        sys_remove(ctx->period_tag);
+                        ctx->period_tag = 0;
+                }
+                ticker_pause(&ctx->ticker, 1);
+        }
+}
+
+
 static void _start(hk_obj_t *obj)
 {
 	ctx_t *ctx = obj->ctx;
+        int chan;
+        int i;
 
-        trigger_all(ctx, true);
+        /* Suspend sampling when no output is consumed */
+        demand_init(&ctx->demand, obj, ctx->hdr, (demand_func_t) demand_changed, ctx);
+        for (chan = 0; chan < NCHANS; chan++) {
+                if (ctx->out[chan] != NULL) {
+                        demand_add_pub(&ctx->demand, &ctx->out_pub[chan]);
+                }
+        }
+
+        if (ctx->metering) {
+                for (i = 0; i < METER_NPADS; i++) {
+                        demand_add_pub(&ctx->demand, &ctx->meter_pub[i]);
+                }
+
+                meter_start(&ctx->meter, ctx->hdr, (meter_read_t) meter_read, (meter_func_t) meter_done, ctx, &ctx->iostats);
+        }
+
+        if (ctx->spectrum_chan >= 0) {
+                for (i = 0; i < ctx->spectrum.nbands; i++) {
+                        demand_add_pub(&ctx->demand, &ctx->band_pub[i]);
+                }
+                demand_add_pub(&ctx->demand, &ctx->peak_pub);
 
-        if (ctx->period > 0) {
-		ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) trigger_periodic, ctx);
+                spectrum_start(&ctx->spectrum, (spectrum_read_t) spectrum_read, (spectrum_func_t) spectrum_done, ctx, &ctx->iostats);
         }
+
+        trigger_all(ctx, true);
+        start_periodic(ctx);
+        demand_start(&ctx->demand);
 }
 
 
@@ -0,0 +1,348 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * AC power metering from a voltage/current ADC channel pair
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// A dedicated thread converts the voltage and current channels back to
+// back at a fixed rate of a few kHz, on an absolute CLOCK_MONOTONIC
+// schedule. Each sample converts the voltage, the current, then the
+// voltage again, as one combined SPI message: conversions of a message
+// are evenly spaced, so the mean of the two voltage conversions is the
+// voltage at the time of the current conversion, whatever the SPI clock
+// and system call overhead.
+//
+// Results are computed over whole mains cycles, delimited by rising zero
+// crossings of the voltage around its DC offset, found with hysteresis
+// and interpolated between samples. Over whole cycles, the DC offsets
+// of the voltage and current sensors are exactly removed by subtracting
+// the window means:
+//
+//   Vrms = sqrt(<v^2> - <v>^2)   Irms = sqrt(<i^2> - <i>^2)
+//   P = <v.i> - <v>.<i>          S = Vrms.Irms    PF = P / S
+//   f = cycles / (last crossing - first crossing)
+//
+// Without mains voltage, no crossing is found: windows of one second are
+// used instead, and the frequency is reported as 0.
+//
+// Results are handed over to the main loop through an eventfd; the
+// sampling lateness is recorded in the object i/o statistics like for
+// the precise ticker.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "worker.h"
+#include "meter.h"
+
+typedef struct {
+        int primed;            // A previous sample is available
+        double offset;         // Voltage DC offset estimate
+        int armed;             // Voltage went below the hysteresis threshold
+        double x_last;         // Last voltage sample, minus offset
+        int64_t t_last;        // Last voltage sample time (ns)
+        int synced;            // Window starts on a zero crossing
+        int64_t t_start;       // Window start time (ns)
+        int64_t t_cross;       // Last zero crossing time (ns)
+        int cycles;            // Whole cycles in the window
+        unsigned long n;
+        double sv, si, svv, sii, svi;
+} meter_acc_t;
+
+
+static int64_t meter_ns(struct timespec *t)
+{
+        return (int64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+
+static void meter_restart(meter_acc_t *acc, int64_t t, int synced)
+{
+        acc->synced = synced;
+        acc->t_start = t;
+        acc->t_cross = t;
+        acc->cycles = 0;
+        acc->n = 0;
+        acc->sv = acc->si = acc->svv = acc->sii = acc->svi = 0;
+}
+
+
+static void meter_close(meter_t *meter, meter_acc_t *acc)
+{
+        meter_result_t result;
+        uint64_t one = 1;
+
+        if (acc->n == 0) {
+                return;
+        }
+
+        double mv = acc->sv / acc->n;
+        double mi = acc->si / acc->n;
+        double vv = (acc->svv / acc->n) - (mv * mv);
+        double ii = (acc->sii / acc->n) - (mi * mi);
+
+        result.n = acc->n;
+        result.cycles = acc->cycles;
+        result.vrms = (vv > 0) ? sqrt(vv) : 0;
+        result.irms = (ii > 0) ? sqrt(ii) : 0;
+        result.power = (acc->svi / acc->n) - (mv * mi);
+        result.va = result.vrms * result.irms;
+        result.pf = (result.va > 0) ? (result.power / result.va) : 0;
+        if (result.pf > 1) {
+                result.pf = 1;
+        }
+        else if (result.pf < -1) {
+                result.pf = -1;
+        }
+        result.freq = (acc->cycles > 0) ? (acc->cycles * 1e9 / (acc->t_cross - acc->t_start)) : 0;
+        pub_ts_get(&result.ts);
+
+        /* Follow the voltage sensor DC offset */
+        acc->offset = mv;
+
+        pthread_mutex_lock(&meter->mutex);
+        meter->result = result;
+        meter->ready = 1;
+        pthread_mutex_unlock(&meter->mutex);
+
+        if (write(meter->fd, &one, sizeof(one)) < 0) {
+                log_str("PANIC: %sCannot signal metering result: %s", meter->hdr, strerror(errno));
+        }
+}
+
+
+static void meter_sample(meter_t *meter, meter_acc_t *acc, double v, int i, int64_t t)
+{
+        double x;
+
+        if (!acc->primed) {
+                acc->primed = 1;
+                acc->x_last = v - acc->offset;
+                acc->t_last = t;
+                meter_restart(acc, t, 0);
+                return;
+        }
+
+        /* Rising zero crossing, with hysteresis */
+        x = v - acc->offset;
+        if (x < -METER_HYSTERESIS) {
+                acc->armed = 1;
+        }
+        else if (acc->armed && (x >= 0)) {
+                int64_t tc = acc->t_last + (int64_t) ((t - acc->t_last) * (-acc->x_last / (x - acc->x_last)));
+                acc->armed = 0;
+
+                if (!acc->synced) {
+                        /* First crossing: start synchronized windows */
+                        meter_restart(acc, tc, 1);
+                }
+                else {
+                        acc->cycles++;
+                        acc->t_cross = tc;
+
+                        if ((meter->cycles > 0) ? (acc->cycles >= meter->cycles) : (tc - acc->t_start >= 1000000000LL)) {
+                                meter_close(meter, acc);
+                                meter_restart(acc, tc, 1);
+                        }
+                }
+        }
+        acc->x_last = x;
+        acc->t_last = t;
+
+        /* No mains voltage: one window per second */
+        if (!acc->synced) {
+                if (t - acc->t_start >= 1000000000LL) {
+                        meter_close(meter, acc);
+                        meter_restart(acc, t, 0);
+                }
+        }
+        else if (t - acc->t_start >= METER_TIMEOUT_NS) {
+                meter_close(meter, acc);
+                meter_restart(acc, t, 0);
+        }
+
+        acc->sv += v;
+        acc->si += i;
+        acc->svv += v * v;
+        acc->sii += (double) i * i;
+        acc->svi += v * i;
+        acc->n++;
+}
+
+
+static void *meter_loop(void *arg)
+{
+        meter_t *meter = arg;
+        int64_t period_ns = 1000000000LL / meter->rate;
+        meter_acc_t acc;
+        struct timespec next, now;
+        int64_t next_ns, now_ns;
+
+        memset(&acc, 0, sizeof(acc));
+        acc.offset = METER_OFFSET;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        next_ns = meter_ns(&now);
+
+        while (1) {
+                int values[3];
+                int ret;
+
+                /* Suspended: check again later, and resync on resume */
+                if (__atomic_load_n(&meter->paused, __ATOMIC_RELAXED)) {
+                        acc.primed = 0;
+                        usleep(100000);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        next_ns = meter_ns(&now);
+                        continue;
+                }
+
+                next_ns += period_ns;
+                next.tv_sec = next_ns / 1000000000;
+                next.tv_nsec = next_ns % 1000000000;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+                ret = meter->read(meter->arg, meter->vcfg, meter->icfg, values);
+
+                /* Deadline is the end of the conversions, which may have
+                   waited for the bus, not the wake-up time */
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                now_ns = meter_ns(&now);
+                iostats_jitter(meter->stats, (now_ns - next_ns) / 1000);
+
+                /* Too late: count and skip the missed samples */
+                if (now_ns - next_ns >= period_ns) {
+                        int64_t missed = (now_ns - next_ns) / period_ns;
+                        iostats_missed(meter->stats, missed);
+                        next_ns += missed * period_ns;
+                }
+
+                if (ret < 0) {
+                        acc.primed = 0;
+                        continue;
+                }
+
+                /* Voltage at the time of the current conversion */
+                meter_sample(meter, &acc, (values[0] + values[2]) / 2.0, values[1], now_ns);
+        }
+
+        return NULL;
+}
+
+
+static int meter_recv(meter_t *meter, int fd)
+{
+        meter_result_t result;
+        uint64_t count;
+        int ready;
+
+        if (read(fd, &count, sizeof(count)) < 0) {
+                if ((errno != EAGAIN) && (errno != EINTR)) {
+                        log_str("PANIC: %sCannot read metering events: %s", meter->hdr, strerror(errno));
+                        return 0;
+                }
+        }
+
+        pthread_mutex_lock(&meter->mutex);
+        ready = meter->ready;
+        result = meter->result;
+        meter->ready = 0;
+        pthread_mutex_unlock(&meter->mutex);
+
+        if (ready) {
+                meter->done(meter->arg, &result);
+        }
+
+        return 1;
+}
+
+
+void meter_init(meter_t *meter, unsigned char vcfg, unsigned char icfg, int rate, int cycles)
+{
+        memset(meter, 0, sizeof(meter_t));
+        meter->vcfg = vcfg;
+        meter->icfg = icfg;
+        meter->rate = (rate > 0) ? rate : METER_DEFAULT_RATE;
+        meter->cycles = (cycles > 0) ? cycles : 0;
+        meter->fd = -1;
+        pthread_mutex_init(&meter->mutex, NULL);
+}
+
+
+int meter_start(meter_t *meter, char *hdr, meter_read_t read, meter_func_t done, void *arg, iostats_t *stats)
+{
+        int err;
+
+        /* Already running */
+        if (meter->fd >= 0) {
+                return 0;
+        }
+
+        meter->hdr = strdup(hdr);
+        meter->read = read;
+        meter->done = done;
+        meter->arg = arg;
+        meter->stats = stats;
+
+        meter->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (meter->fd < 0) {
+                log_str("ERROR: %sCannot create metering result event: %s", hdr, strerror(errno));
+                goto failed;
+        }
+
+        meter->tag = sys_io_watch(meter->fd, (sys_io_func_t) meter_recv, meter);
+
+        err = pthread_create(&meter->thr, NULL, meter_loop, meter);
+        if (err != 0) {
+                log_str("ERROR: %sFailed to create metering thread: %s", hdr, strerror(err));
+                goto failed;
+        }
+
+        pthread_detach(meter->thr);
+        worker_thread_setup(meter->thr, "meter", hdr);
+
+        if (meter->cycles > 0) {
+                log_str("%sAC metering at %d Hz, results every %d cycles", hdr, meter->rate, meter->cycles);
+        }
+        else {
+                log_str("%sAC metering at %d Hz, results every second", hdr, meter->rate);
+        }
+
+        return 0;
+
+failed:
+        if (meter->tag != 0) {
+                sys_remove(meter->tag);
+                meter->tag = 0;
+        }
+
+        if (meter->fd >= 0) {
+                close(meter->fd);
+                meter->fd = -1;
+        }
+
+        if (meter->hdr != NULL) {
+                free(meter->hdr);
+                meter->hdr = NULL;
+        }
+
+        return -1;
+}
+
+
+void meter_pause(meter_t *meter, int paused)
+{
+        __atomic_store_n(&meter->paused, paused, __ATOMIC_RELAXED);
+}
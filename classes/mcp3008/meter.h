@@ -0,0 +1,67 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * AC power metering from a voltage/current ADC channel pair
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_METER_H__
+#define __HAKIT_METER_H__
+
+#include <pthread.h>
+
+#include "sys.h"
+#include "pub.h"
+#include "iostats.h"
+
+#define METER_DEFAULT_RATE 4000   // Sampling rate (Hz)
+#define METER_HYSTERESIS 8        // Zero-crossing hysteresis (ADC counts)
+#define METER_OFFSET 512.0        // Initial DC offset estimate: mid-scale
+#define METER_TIMEOUT_NS 2000000000LL // Longest window without enough cycles
+
+/* Conversion of the voltage, current and voltage channels again as one
+   message: returns 0 with the raw values, or -1 on error */
+typedef int (*meter_read_t)(void *arg, unsigned char vcfg, unsigned char icfg, int values[3]);
+
+typedef struct {
+        unsigned long n;       // Number of samples
+        int cycles;            // Number of whole mains cycles, 0 if not synchronized
+        double vrms;           // RMS voltage (ADC counts)
+        double irms;           // RMS current (ADC counts)
+        double power;          // Real power (counts^2)
+        double va;             // Apparent power (counts^2)
+        double pf;             // Power factor
+        double freq;           // Line frequency (Hz), 0 if unknown
+        pub_ts_t ts;           // Window end time
+} meter_result_t;
+
+typedef void (*meter_func_t)(void *arg, meter_result_t *result);
+
+typedef struct {
+        char *hdr;
+        unsigned char vcfg;    // Voltage channel config byte
+        unsigned char icfg;    // Current channel config byte
+        int rate;              // Sampling rate (Hz)
+        int cycles;            // Mains cycles per result, 0 for one result per second
+        meter_read_t read;     // Channel conversion, run by the metering thread
+        meter_func_t done;     // Result handler, run by the main loop
+        void *arg;
+        iostats_t *stats;      // Sampling jitter and missed samples
+        int fd;                // Result notification eventfd
+        sys_tag_t tag;
+        pthread_t thr;
+        int paused;
+        pthread_mutex_t mutex;
+        meter_result_t result; // Latest result, protected by mutex
+        int ready;
+} meter_t;
+
+extern void meter_init(meter_t *meter, unsigned char vcfg, unsigned char icfg, int rate, int cycles);
+extern int meter_start(meter_t *meter, char *hdr, meter_read_t read, meter_func_t done, void *arg, iostats_t *stats);
+extern void meter_pause(meter_t *meter, int paused);
+
+#endif /* __HAKIT_METER_H__ */
@@ -0,0 +1,443 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Spectrum analysis of an ADC channel
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// A dedicated thread acquires windows of N samples at a fixed rate, on
+// an absolute CLOCK_MONOTONIC schedule, and analyzes each of them in
+// place, so that only band levels and the dominant frequency leave the
+// device:
+//
+// - the window mean is removed and a Hann window applied;
+// - the N real samples are packed as N/2 complex values (even samples
+//   as real parts, odd samples as imaginary parts), in bit-reversed
+//   order, and go through an iterative radix-2 complex FFT;
+// - a split step recovers the N/2+1 bins of the real FFT, and their
+//   power.
+//
+// Data are kept as separate real and imaginary float arrays, and the
+// butterfly twiddles of each stage are stored contiguously, so that
+// butterfly loops walk all their operands with unit stride and can be
+// vectorized by the compiler (e.g. on NEON). All tables are computed
+// once, at object creation.
+//
+// Band levels are RMS amplitudes, compensated for the window power:
+// a sine of amplitude A gives A/sqrt(2) in the band that contains it.
+// The dominant frequency is refined by parabolic interpolation around
+// the highest bin.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "worker.h"
+#include "spectrum.h"
+
+
+static void *spectrum_alloc(int count, int size)
+{
+        void *ptr = NULL;
+
+        if (posix_memalign(&ptr, 16, count * size) != 0) {
+                return NULL;
+        }
+
+        memset(ptr, 0, count * size);
+        return ptr;
+}
+
+
+static int64_t spectrum_ns(struct timespec *t)
+{
+        return (int64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+
+static void spectrum_fft(spectrum_t *spectrum)
+{
+        int m = spectrum->size / 2;
+        float *restrict re = spectrum->re;
+        float *restrict im = spectrum->im;
+        int off = 0;
+        int h, base, j;
+
+        /* Input is in bit-reversed order: decimation in time */
+        for (h = 1; h < m; h <<= 1) {
+                const float *restrict wr = spectrum->tw_re + off;
+                const float *restrict wi = spectrum->tw_im + off;
+
+                for (base = 0; base < m; base += 2*h) {
+                        float *restrict ar = re + base;
+                        float *restrict ai = im + base;
+                        float *restrict br = re + base + h;
+                        float *restrict bi = im + base + h;
+
+                        for (j = 0; j < h; j++) {
+                                float tr = br[j] * wr[j] - bi[j] * wi[j];
+                                float ti = br[j] * wi[j] + bi[j] * wr[j];
+                                br[j] = ar[j] - tr;
+                                bi[j] = ai[j] - ti;
+                                ar[j] = ar[j] + tr;
+                                ai[j] = ai[j] + ti;
+                        }
+                }
+
+                off += h;
+        }
+}
+
+
+static void spectrum_analyze(spectrum_t *spectrum, spectrum_result_t *result)
+{
+        int n = spectrum->size;
+        int m = n / 2;
+        float *x = spectrum->samples;
+        float *w = spectrum->window;
+        float *p = spectrum->power;
+        float mean = 0;
+        float scale;
+        int peak = 1;
+        int i, k;
+
+        for (i = 0; i < n; i++) {
+                mean += x[i];
+        }
+        mean /= n;
+
+        /* Remove DC, apply window, pack real pairs in bit-reversed order */
+        for (k = 0; k < m; k++) {
+                int r = spectrum->rev[k];
+                spectrum->re[r] = (x[2*k] - mean) * w[2*k];
+                spectrum->im[r] = (x[2*k+1] - mean) * w[2*k+1];
+        }
+
+        spectrum_fft(spectrum);
+
+        /* Split the packed transform into the real signal bins */
+        for (k = 0; k <= m; k++) {
+                int k1 = (k < m) ? k : 0;
+                int k2 = (k > 0) ? (m - k) : 0;
+                float zr = spectrum->re[k1];
+                float zi = spectrum->im[k1];
+                float cr = spectrum->re[k2];
+                float ci = -spectrum->im[k2];
+
+                float er = 0.5f * (zr + cr);
+                float ei = 0.5f * (zi + ci);
+                float odr = 0.5f * (zi - ci);
+                float odi = -0.5f * (zr - cr);
+
+                float xr = er + spectrum->sp_re[k] * odr - spectrum->sp_im[k] * odi;
+                float xi = ei + spectrum->sp_re[k] * odi + spectrum->sp_im[k] * odr;
+
+                p[k] = xr * xr + xi * xi;
+        }
+
+        /* Band levels: one-sided power, compensated for the window */
+        scale = 2.0f / (n * spectrum->window_power);
+        for (i = 0; i < spectrum->nbands; i++) {
+                spectrum_band_t *band = &spectrum->bands[i];
+                float sum = 0;
+
+                for (k = 1; k <= m; k++) {
+                        float f = (float) k * spectrum->rate / n;
+                        if ((f >= band->lo) && (f < band->hi)) {
+                                sum += p[k];
+                        }
+                }
+
+                result->band[i] = sqrtf(sum * scale);
+        }
+
+        /* Dominant frequency, interpolated between neighbour bins */
+        for (k = 2; k < m; k++) {
+                if (p[k] > p[peak]) {
+                        peak = k;
+                }
+        }
+
+        float a = sqrtf(p[peak-1]);
+        float b = sqrtf(p[peak]);
+        float c = sqrtf(p[peak+1]);
+        float d = a - 2*b + c;
+        float delta = (d < 0) ? (0.5f * (a - c) / d) : 0;
+
+        result->peak = (peak + delta) * spectrum->rate / n;
+}
+
+
+static void spectrum_publish(spectrum_t *spectrum, spectrum_result_t *result)
+{
+        uint64_t one = 1;
+
+        pthread_mutex_lock(&spectrum->mutex);
+        spectrum->result = *result;
+        spectrum->ready = 1;
+        pthread_mutex_unlock(&spectrum->mutex);
+
+        if (write(spectrum->fd, &one, sizeof(one)) < 0) {
+                log_str("PANIC: %sCannot signal spectrum result: %s", spectrum->hdr, strerror(errno));
+        }
+}
+
+
+static void spectrum_sleep(int64_t t_ns)
+{
+        struct timespec t;
+
+        t.tv_sec = t_ns / 1000000000;
+        t.tv_nsec = t_ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+}
+
+
+static void *spectrum_loop(void *arg)
+{
+        spectrum_t *spectrum = arg;
+        int64_t period_ns = 1000000000LL / spectrum->rate;
+        int64_t window_ns = (int64_t) spectrum->period * 1000000;
+        int64_t start_ns, next_ns, now_ns;
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        start_ns = spectrum_ns(&now);
+
+        while (1) {
+                spectrum_result_t result;
+                int i;
+
+                /* Suspended: check again later */
+                if (__atomic_load_n(&spectrum->paused, __ATOMIC_RELAXED)) {
+                        usleep(100000);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        start_ns = spectrum_ns(&now);
+                        continue;
+                }
+
+                spectrum_sleep(start_ns);
+                pub_ts_get(&result.ts);
+
+                /* Acquire a full window */
+                next_ns = start_ns;
+                for (i = 0; i < spectrum->size; i++) {
+                        int value;
+
+                        spectrum_sleep(next_ns);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        now_ns = spectrum_ns(&now);
+                        iostats_jitter(spectrum->stats, (now_ns - next_ns) / 1000);
+
+                        /* Late samples distort the spectrum, but cannot be skipped */
+                        if (now_ns - next_ns >= period_ns) {
+                                iostats_missed(spectrum->stats, 1);
+                        }
+
+                        value = spectrum->read(spectrum->arg, spectrum->cfg);
+                        if (value < 0) {
+                                break;
+                        }
+
+                        spectrum->samples[i] = value;
+                        next_ns += period_ns;
+                }
+
+                if (i == spectrum->size) {
+                        spectrum_analyze(spectrum, &result);
+                        spectrum_publish(spectrum, &result);
+                }
+
+                /* Next window on a fixed grid, or right away */
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                now_ns = spectrum_ns(&now);
+                if (window_ns > 0) {
+                        start_ns += window_ns;
+                        if (start_ns < now_ns) {
+                                start_ns = now_ns;
+                        }
+                }
+                else {
+                        start_ns = now_ns;
+                }
+        }
+
+        return NULL;
+}
+
+
+static int spectrum_recv(spectrum_t *spectrum, int fd)
+{
+        spectrum_result_t result;
+        uint64_t count;
+        int ready;
+
+        if (read(fd, &count, sizeof(count)) < 0) {
+                if ((errno != EAGAIN) && (errno != EINTR)) {
+                        log_str("PANIC: %sCannot read spectrum events: %s", spectrum->hdr, strerror(errno));
+                        return 0;
+                }
+        }
+
+        pthread_mutex_lock(&spectrum->mutex);
+        ready = spectrum->ready;
+        result = spectrum->result;
+        spectrum->ready = 0;
+        pthread_mutex_unlock(&spectrum->mutex);
+
+        if (ready) {
+                spectrum->done(spectrum->arg, &result);
+        }
+
+        return 1;
+}
+
+
+int spectrum_init(spectrum_t *spectrum, char *hdr, unsigned char cfg, int rate, int size, int period)
+{
+        int m, bits;
+        int i, h, j, off;
+
+        memset(spectrum, 0, sizeof(spectrum_t));
+        spectrum->hdr = strdup(hdr);
+        spectrum->cfg = cfg;
+        spectrum->rate = (rate > 0) ? rate : SPECTRUM_DEFAULT_RATE;
+        spectrum->size = (size > 0) ? size : SPECTRUM_DEFAULT_SIZE;
+        spectrum->period = (period > 0) ? period : 0;
+        spectrum->fd = -1;
+        pthread_mutex_init(&spectrum->mutex, NULL);
+
+        if ((spectrum->size < SPECTRUM_MIN_SIZE) || (spectrum->size > SPECTRUM_MAX_SIZE) ||
+            ((spectrum->size & (spectrum->size - 1)) != 0)) {
+                log_str("ERROR: %sSpectrum size must be a power of 2 between %d and %d", hdr, SPECTRUM_MIN_SIZE, SPECTRUM_MAX_SIZE);
+                return -1;
+        }
+
+        m = spectrum->size / 2;
+        for (bits = 0; (1 << bits) < m; bits++);
+
+        spectrum->samples = spectrum_alloc(spectrum->size, sizeof(float));
+        spectrum->window = spectrum_alloc(spectrum->size, sizeof(float));
+        spectrum->rev = spectrum_alloc(m, sizeof(unsigned short));
+        spectrum->re = spectrum_alloc(m, sizeof(float));
+        spectrum->im = spectrum_alloc(m, sizeof(float));
+        spectrum->tw_re = spectrum_alloc(m, sizeof(float));
+        spectrum->tw_im = spectrum_alloc(m, sizeof(float));
+        spectrum->sp_re = spectrum_alloc(m + 1, sizeof(float));
+        spectrum->sp_im = spectrum_alloc(m + 1, sizeof(float));
+        spectrum->power = spectrum_alloc(m + 1, sizeof(float));
+
+        if ((spectrum->samples == NULL) || (spectrum->window == NULL) || (spectrum->rev == NULL) ||
+            (spectrum->re == NULL) || (spectrum->im == NULL) || (spectrum->tw_re == NULL) || (spectrum->tw_im == NULL) ||
+            (spectrum->sp_re == NULL) || (spectrum->sp_im == NULL) || (spectrum->power == NULL)) {
+                log_str("ERROR: %sCannot allocate spectrum buffers", hdr);
+                return -1;
+        }
+
+        /* Hann window */
+        spectrum->window_power = 0;
+        for (i = 0; i < spectrum->size; i++) {
+                float w = 0.5 * (1 - cos(2 * M_PI * i / spectrum->size));
+                spectrum->window[i] = w;
+                spectrum->window_power += w * w;
+        }
+
+        /* Bit reversal permutation of the packed complex data */
+        for (i = 0; i < m; i++) {
+                int r = 0;
+                for (j = 0; j < bits; j++) {
+                        r = (r << 1) | ((i >> j) & 1);
+                }
+                spectrum->rev[i] = r;
+        }
+
+        /* Butterfly twiddles exp(-i.pi.j/h), for each stage of half-size h */
+        off = 0;
+        for (h = 1; h < m; h <<= 1) {
+                for (j = 0; j < h; j++) {
+                        spectrum->tw_re[off + j] = cos(M_PI * j / h);
+                        spectrum->tw_im[off + j] = -sin(M_PI * j / h);
+                }
+                off += h;
+        }
+
+        /* Split twiddles exp(-2i.pi.k/N) */
+        for (i = 0; i <= m; i++) {
+                spectrum->sp_re[i] = cos(2 * M_PI * i / spectrum->size);
+                spectrum->sp_im[i] = -sin(2 * M_PI * i / spectrum->size);
+        }
+
+        return 0;
+}
+
+
+int spectrum_add_band(spectrum_t *spectrum, float lo, float hi)
+{
+        if ((spectrum->nbands >= SPECTRUM_MAX_BANDS) || (hi <= lo)) {
+                return -1;
+        }
+
+        spectrum->bands[spectrum->nbands].lo = lo;
+        spectrum->bands[spectrum->nbands].hi = hi;
+        spectrum->nbands++;
+
+        return 0;
+}
+
+
+int spectrum_start(spectrum_t *spectrum, spectrum_read_t read, spectrum_func_t done, void *arg, iostats_t *stats)
+{
+        int err;
+
+        /* Already running */
+        if (spectrum->fd >= 0) {
+                return 0;
+        }
+
+        spectrum->read = read;
+        spectrum->done = done;
+        spectrum->arg = arg;
+        spectrum->stats = stats;
+
+        spectrum->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (spectrum->fd < 0) {
+                log_str("ERROR: %sCannot create spectrum result event: %s", spectrum->hdr, strerror(errno));
+                return -1;
+        }
+
+        spectrum->tag = sys_io_watch(spectrum->fd, (sys_io_func_t) spectrum_recv, spectrum);
+
+        err = pthread_create(&spectrum->thr, NULL, spectrum_loop, spectrum);
+        if (err != 0) {
+                log_str("ERROR: %sFailed to create spectrum thread: %s", spectrum->hdr, strerror(err));
+                sys_remove(spectrum->tag);
+                spectrum->tag = 0;
+                close(spectrum->fd);
+                spectrum->fd = -1;
+                return -1;
+        }
+
+        pthread_detach(spectrum->thr);
+        worker_thread_setup(spectrum->thr, "fft", spectrum->hdr);
+
+        log_str("%sSpectrum analysis: %d samples at %d Hz (%.2f Hz resolution)", spectrum->hdr,
+                spectrum->size, spectrum->rate, (float) spectrum->rate / spectrum->size);
+
+        return 0;
+}
+
+
+void spectrum_pause(spectrum_t *spectrum, int paused)
+{
+        __atomic_store_n(&spectrum->paused, paused, __ATOMIC_RELAXED);
+}
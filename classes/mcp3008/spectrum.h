@@ -0,0 +1,80 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Spectrum analysis of an ADC channel
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_SPECTRUM_H__
+#define __HAKIT_SPECTRUM_H__
+
+#include <pthread.h>
+
+#include "sys.h"
+#include "pub.h"
+#include "iostats.h"
+
+#define SPECTRUM_DEFAULT_RATE 2000   // Sampling rate (Hz)
+#define SPECTRUM_DEFAULT_SIZE 512    // Window size (samples)
+#define SPECTRUM_MIN_SIZE 16
+#define SPECTRUM_MAX_SIZE 8192
+#define SPECTRUM_MAX_BANDS 8
+
+/* Conversion of one ADC channel: returns the raw value, or -1 on error */
+typedef int (*spectrum_read_t)(void *arg, unsigned char cfg);
+
+typedef struct {
+        float lo;              // Lower band limit (Hz), included
+        float hi;              // Upper band limit (Hz), excluded
+} spectrum_band_t;
+
+typedef struct {
+        float band[SPECTRUM_MAX_BANDS]; // RMS amplitude in each band (ADC counts)
+        float peak;            // Dominant frequency (Hz)
+        pub_ts_t ts;           // Window start time
+} spectrum_result_t;
+
+typedef void (*spectrum_func_t)(void *arg, spectrum_result_t *result);
+
+typedef struct {
+        char *hdr;
+        unsigned char cfg;     // Channel config byte
+        int rate;              // Sampling rate (Hz)
+        int size;              // Window size N, a power of 2
+        int period;            // Time between window starts (ms), 0 for back to back
+        spectrum_band_t bands[SPECTRUM_MAX_BANDS];
+        int nbands;
+        spectrum_read_t read;  // Channel conversion, run by the analysis thread
+        spectrum_func_t done;  // Result handler, run by the main loop
+        void *arg;
+        iostats_t *stats;      // Sampling jitter and missed samples
+
+        /* Precomputed tables and work buffers, 16-byte aligned, structure of arrays */
+        float *samples;        // Raw window [N]
+        float *window;         // Hann window [N]
+        float window_power;    // Sum of squared window coefficients
+        unsigned short *rev;   // Bit reversal permutation [N/2]
+        float *re, *im;        // Packed complex FFT data [N/2]
+        float *tw_re, *tw_im;  // Butterfly twiddles, contiguous per stage [N/2-1]
+        float *sp_re, *sp_im;  // Real split twiddles exp(-2i.pi.k/N) [N/2+1]
+        float *power;          // One-sided power spectrum [N/2+1]
+
+        int fd;                // Result notification eventfd
+        sys_tag_t tag;
+        pthread_t thr;
+        int paused;
+        pthread_mutex_t mutex;
+        spectrum_result_t result; // Latest result, protected by mutex
+        int ready;
+} spectrum_t;
+
+extern int spectrum_init(spectrum_t *spectrum, char *hdr, unsigned char cfg, int rate, int size, int period);
+extern int spectrum_add_band(spectrum_t *spectrum, float lo, float hi);
+extern int spectrum_start(spectrum_t *spectrum, spectrum_read_t read, spectrum_func_t done, void *arg, iostats_t *stats);
+extern void spectrum_pause(spectrum_t *spectrum, int paused);
+
+#endif /* __HAKIT_SPECTRUM_H__ */
@@ -0,0 +1,239 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Per-controller SPI transfer scheduler
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// All chips wired to the same SPI controller, e.g. two MCP3008 on CE0
+// and CE1, are served by a single thread per controller instead of
+// contending for it from the shared worker pool. Jobs are the usual
+// worker jobs, and follow the same rules: a job is queued only once,
+// stays claimed until its completion handler returns, and completes
+// through the worker pool event in the main loop.
+//
+// Jobs from the different chip selects are run in submission order, so
+// that scans of several chips triggered together are interleaved back
+// to back on the bus. A job issues its scan as combined transfer lists
+// (see spidev_transfer()), to keep the number of system calls low and
+// the bus busy with no gap between conversions, but in steps of a few
+// conversions, calling spibus_yield() in between: a long scan, e.g. with
+// a large 'mean', would otherwise hold the bus for milliseconds and
+// make the 4 kHz metering thread miss its deadlines.
+//
+// Threads that need the result of their transfers right away, i.e. the
+// precise ticker, sampling groups, and the metering and spectrum
+// threads, make synchronous calls instead: the call body runs in the
+// bus thread with the sample time of the caller, while the caller
+// waits. Calls are served before queued jobs, as their callers run on
+// a schedule, and between the steps of a running job.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "pub.h"
+#include "spibus.h"
+
+typedef struct spibus_call_s {
+        worker_func_t func;
+        void *arg;
+        pub_ts_t ts;           // Sample time of the caller, held while func runs
+        int returned;
+        struct spibus_call_s *next;
+} spibus_call_t;
+
+static spibus_t *spibus_list = NULL;
+
+
+static spibus_call_t *spibus_next_call(spibus_t *spibus)
+{
+        spibus_call_t *call = spibus->calls;
+
+        /* Mutex must be locked */
+        if (call != NULL) {
+                spibus->calls = call->next;
+                if (spibus->calls == NULL) {
+                        spibus->calls_tail = NULL;
+                }
+        }
+
+        return call;
+}
+
+
+static void spibus_run_call(spibus_t *spibus, spibus_call_t *call, spibus_call_t *outer)
+{
+        pub_ts_hold(&call->ts);
+        call->func(call->arg);
+
+        /* Back to the sample time of the call that yielded, if any */
+        pub_ts_hold((outer != NULL) ? &outer->ts : NULL);
+
+        pthread_mutex_lock(&spibus->mutex);
+        call->returned = 1;
+        pthread_cond_broadcast(&spibus->done);
+        pthread_mutex_unlock(&spibus->mutex);
+}
+
+
+static void *spibus_loop(void *arg)
+{
+        spibus_t *spibus = arg;
+
+        while (1) {
+                spibus_call_t *call;
+                worker_job_t *job = NULL;
+
+                pthread_mutex_lock(&spibus->mutex);
+                while ((spibus->calls == NULL) && (spibus->head == NULL)) {
+                        pthread_cond_wait(&spibus->cond, &spibus->mutex);
+                }
+                call = spibus_next_call(spibus);
+                if (call == NULL) {
+                        job = spibus->head;
+                        spibus->head = job->next;
+                        if (spibus->head == NULL) {
+                                spibus->tail = NULL;
+                        }
+                }
+                pthread_mutex_unlock(&spibus->mutex);
+
+                if (call != NULL) {
+                        spibus->current = call;
+                        spibus_run_call(spibus, call, NULL);
+                        spibus->current = NULL;
+                }
+                else {
+                        job->func(job->arg);
+                        worker_complete(job);
+                }
+        }
+
+        return NULL;
+}
+
+
+spibus_t *spibus_attach(int bus, char *hdr)
+{
+        spibus_t *spibus;
+        char suffix[8];
+        int err;
+
+        for (spibus = spibus_list; spibus != NULL; spibus = spibus->next) {
+                if (spibus->bus == bus) {
+                        return spibus;
+                }
+        }
+
+        spibus = malloc(sizeof(spibus_t));
+        memset(spibus, 0, sizeof(spibus_t));
+        spibus->bus = bus;
+        pthread_mutex_init(&spibus->mutex, NULL);
+        pthread_cond_init(&spibus->cond, NULL);
+        pthread_cond_init(&spibus->done, NULL);
+
+        err = pthread_create(&spibus->thr, NULL, spibus_loop, spibus);
+        if (err != 0) {
+                log_str("PANIC: %sFailed to create SPI bus thread: %s", hdr, strerror(err));
+                pthread_cond_destroy(&spibus->done);
+                pthread_cond_destroy(&spibus->cond);
+                pthread_mutex_destroy(&spibus->mutex);
+                free(spibus);
+                return NULL;
+        }
+
+        pthread_detach(spibus->thr);
+        snprintf(suffix, sizeof(suffix), "spi%d", bus);
+        worker_thread_setup(spibus->thr, suffix, hdr);
+
+        spibus->next = spibus_list;
+        spibus_list = spibus;
+
+        log_debug(1, "%sSPI bus %d scheduler started", hdr, bus);
+
+        return spibus;
+}
+
+
+int spibus_queue(spibus_t *spibus, worker_job_t *job)
+{
+        job->next = NULL;
+
+        pthread_mutex_lock(&spibus->mutex);
+        if (spibus->tail != NULL) {
+                spibus->tail->next = job;
+        }
+        else {
+                spibus->head = job;
+        }
+        spibus->tail = job;
+        pthread_cond_signal(&spibus->cond);
+        pthread_mutex_unlock(&spibus->mutex);
+
+        return 0;
+}
+
+
+int spibus_submit(spibus_t *spibus, worker_job_t *job)
+{
+        /* Still pending: let the running job do the work */
+        if (worker_claim(job)) {
+                return 1;
+        }
+
+        return spibus_queue(spibus, job);
+}
+
+
+void spibus_call(spibus_t *spibus, worker_func_t func, void *arg)
+{
+        spibus_call_t call = {
+                .func = func,
+                .arg = arg,
+                .returned = 0,
+                .next = NULL,
+        };
+
+        /* Sample time of the calling thread, e.g. a sampling group tick */
+        pub_ts_get(&call.ts);
+
+        pthread_mutex_lock(&spibus->mutex);
+        if (spibus->calls_tail != NULL) {
+                spibus->calls_tail->next = &call;
+        }
+        else {
+                spibus->calls = &call;
+        }
+        spibus->calls_tail = &call;
+        pthread_cond_signal(&spibus->cond);
+
+        while (!call.returned) {
+                pthread_cond_wait(&spibus->done, &spibus->mutex);
+        }
+        pthread_mutex_unlock(&spibus->mutex);
+}
+
+
+void spibus_yield(spibus_t *spibus)
+{
+        spibus_call_t *call;
+
+        /* Runs in the bus thread, between two steps of a job or call */
+        while (1) {
+                pthread_mutex_lock(&spibus->mutex);
+                call = spibus_next_call(spibus);
+                pthread_mutex_unlock(&spibus->mutex);
+
+                if (call == NULL) {
+                        break;
+                }
+
+                spibus_run_call(spibus, call, spibus->current);
+        }
+}
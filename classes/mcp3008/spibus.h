@@ -0,0 +1,39 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Per-controller SPI transfer scheduler
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_SPIBUS_H__
+#define __HAKIT_SPIBUS_H__
+
+#include <pthread.h>
+
+#include "worker.h"
+
+typedef struct spibus_s {
+        int bus;               // SPI controller number
+        pthread_t thr;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;   // Job or call queued
+        pthread_cond_t done;   // Call returned
+        struct spibus_call_s *calls; // Synchronous calls waiting for the bus
+        struct spibus_call_s *calls_tail;
+        struct spibus_call_s *current; // Call being run, owned by the bus thread
+        worker_job_t *head;    // Jobs waiting for the bus
+        worker_job_t *tail;
+        struct spibus_s *next;
+} spibus_t;
+
+extern spibus_t *spibus_attach(int bus, char *hdr);
+extern int spibus_queue(spibus_t *spibus, worker_job_t *job);
+extern int spibus_submit(spibus_t *spibus, worker_job_t *job);
+extern void spibus_call(spibus_t *spibus, worker_func_t func, void *arg);
+extern void spibus_yield(spibus_t *spibus);
+
+#endif /* __HAKIT_SPIBUS_H__ */
@@ -19,6 +19,7 @@
 #include <linux/spi/spidev.h>
 
 #include "log.h"
+#include "buslog.h"
 #include "spidev.h"
 
 
@@ -26,6 +27,9 @@ void spidev_init(spidev_t *spidev, unsigned int speed_hz, unsigned char bits_per
 {
 	spidev->hdr = NULL;
 	spidev->fd = -1;
+	spidev->bus = -1;
+	spidev->cs = -1;
+	spidev->stats = NULL;
 	spidev->speed_hz = speed_hz;
 	spidev->bits_per_word = bits_per_word;
 }
@@ -51,6 +55,11 @@ int spidev_open(spidev_t *spidev, char *hdr, char *id)
 
 	log_debug(2, "%sspidev_open => fd=%d", hdr, spidev->fd);
 
+	if (sscanf(id, "%d.%d", &spidev->bus, &spidev->cs) != 2) {
+		spidev->bus = -1;
+		spidev->cs = -1;
+	}
+
 	ret = ioctl(spidev->fd, SPI_IOC_WR_MODE, &mode);
 	if (ret < 0){
 		log_str("PANIC: %sCannot setup %s write mode: %s", hdr, devname, strerror(errno));
@@ -110,6 +119,19 @@ void spidev_close(spidev_t *spidev)
 }
 
 
+int spidev_set_speed(spidev_t *spidev, unsigned int speed_hz)
+{
+	if (ioctl(spidev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0) {
+		log_str("ERROR: %sCannot set SPI speed %u Hz: %s", spidev->hdr, speed_hz, strerror(errno));
+		return -1;
+	}
+
+	spidev->speed_hz = speed_hz;
+
+	return 0;
+}
+
+
 int spidev_write_read(spidev_t *spidev, unsigned char *buf, int size)
 {
 	struct spi_ioc_transfer spi = {
@@ -121,14 +143,88 @@ int spidev_write_read(spidev_t *spidev, unsigned char *buf, int size)
                 .bits_per_word = spidev->bits_per_word,
                 .cs_change = 0,
         };
+	struct timespec t0;
 	int ret;
 
 	log_debug(2, "%sspidev_write_read fd=%d size=%d", spidev->hdr, spidev->fd, size);
 
-	ret = ioctl(spidev->fd, SPI_IOC_MESSAGE(1), &spi);
+	iostats_start(&t0);
+
+	if (buslog_enabled()) {
+		/* Keep request bytes, the transfer is done in place */
+		unsigned char tx[size];
+		memcpy(tx, buf, size);
+		ret = ioctl(spidev->fd, SPI_IOC_MESSAGE(1), &spi);
+		buslog_spi(spidev->bus, spidev->cs, &t0, tx, buf, size, (ret < 0));
+	}
+	else {
+		ret = ioctl(spidev->fd, SPI_IOC_MESSAGE(1), &spi);
+	}
+
+	iostats_record(spidev->stats, IOSTATS_XFER, &t0, size, (ret < 0));
+
 	if (ret < 0) {
 		log_str("ERROR: %sSPI transfer error: %s", spidev->hdr, strerror(errno));
 	}
 
 	return ret;
 }
+
+
+/*
+ * Run 'count' transfers of 'size' bytes each, in place in 'buf', with the
+ * chip select released between them, as combined messages of up to
+ * SPIDEV_MAX_XFERS transfers.
+ */
+int spidev_transfer(spidev_t *spidev, unsigned char *buf, int size, int count)
+{
+	struct spi_ioc_transfer spi[SPIDEV_MAX_XFERS];
+	int total = 0;
+
+	log_debug(2, "%sspidev_transfer fd=%d size=%d count=%d", spidev->hdr, spidev->fd, size, count);
+
+	while (count > 0) {
+		int n = (count > SPIDEV_MAX_XFERS) ? SPIDEV_MAX_XFERS : count;
+		struct timespec t0;
+		int ret;
+		int i;
+
+		memset(spi, 0, n * sizeof(spi[0]));
+		for (i = 0; i < n; i++) {
+			spi[i].tx_buf = (unsigned long) (buf + i * size);
+			spi[i].rx_buf = (unsigned long) (buf + i * size);
+			spi[i].len = size;
+			spi[i].speed_hz = spidev->speed_hz;
+			spi[i].bits_per_word = spidev->bits_per_word;
+			spi[i].cs_change = (i < (n - 1)) ? 1 : 0;
+		}
+
+		iostats_start(&t0);
+
+		if (buslog_enabled()) {
+			/* Keep request bytes, the transfers are done in place */
+			unsigned char tx[n * size];
+			memcpy(tx, buf, n * size);
+			ret = ioctl(spidev->fd, SPI_IOC_MESSAGE(n), spi);
+			for (i = 0; i < n; i++) {
+				buslog_spi(spidev->bus, spidev->cs, &t0, tx + i * size, buf + i * size, size, (ret < 0));
+			}
+		}
+		else {
+			ret = ioctl(spidev->fd, SPI_IOC_MESSAGE(n), spi);
+		}
+
+		iostats_record(spidev->stats, IOSTATS_XFER, &t0, n * size, (ret < 0));
+
+		if (ret < 0) {
+			log_str("ERROR: %sSPI transfer error: %s", spidev->hdr, strerror(errno));
+			return ret;
+		}
+
+		buf += n * size;
+		count -= n;
+		total += ret;
+	}
+
+	return total;
+}
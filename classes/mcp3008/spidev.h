@@ -12,9 +12,16 @@
 #ifndef __HAKIT_SPIDEV_H__
 #define __HAKIT_SPIDEV_H__
 
+#include "iostats.h"
+
+#define SPIDEV_MAX_XFERS 64    // Transfers per combined message
+
 typedef struct {
 	char *hdr;
 	int fd;
+	int bus;               // SPI bus number
+	int cs;                // SPI chip select
+	iostats_t *stats;
 	unsigned int speed_hz;
 	unsigned char bits_per_word;
 } spidev_t;
@@ -22,7 +29,9 @@ typedef struct {
 extern void spidev_init(spidev_t *spidev, unsigned int speed_hz, unsigned char bits_per_word);
 extern int spidev_open(spidev_t *spidev, char *hdr, char *id);
 extern void spidev_close(spidev_t *spidev);
+extern int spidev_set_speed(spidev_t *spidev, unsigned int speed_hz);
 
 extern int spidev_write_read(spidev_t *spidev, unsigned char *buf, int size);
+extern int spidev_transfer(spidev_t *spidev, unsigned char *buf, int size, int count);
 
 #endif /* __HAKIT_SPIDEV_H__ */
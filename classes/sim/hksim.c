@@ -0,0 +1,841 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator for Raspberry Pi sensor classes
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// This library is loaded with LD_PRELOAD in front of hakit-engine (or
+// any other program using the classes). It intercepts accesses to the
+// I2C, SPI and 1-wire device nodes, and serves them from register
+// level models of the chips supported by the classes, so that every
+// class can run, be benchmarked and be tested without any hardware.
+//
+// Environment:
+//   HKSIM_DEVICES      Comma separated list of simulated devices:
+//                        ina219@<bus>:<addr>, ina3221@<bus>:<addr>,
+//                        tcs34725@<bus>:<addr>, mcp3008@<bus>.<cs>,
+//                        ds18b20@<id>
+//                      Set it empty to simulate no device, e.g. for replay
+//   HKSIM_LATENCY_US   Fixed latency added to each bus transaction
+//   HKSIM_I2C_HZ       I2C clock used to compute transfer time (100000)
+//   HKSIM_SPI_MAX_HZ   Max reliable SPI clock of MCP3008 chips (3600000)
+//   HKSIM_W1_MS        DS18B20 conversion time in milliseconds (750)
+//   HKSIM_REPLAY       Bus log recorded with HAKIT_BUSLOG to replay in place
+//                      of the device models
+//   HKSIM_REPLAY_SPEED Replay speed factor, 0 for no delay (1)
+//   HKSIM_DEBUG        Log intercepted accesses to stderr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+
+#include "buslog.h"
+#include "hksim.h"
+
+#define SYS_W1_DIR "/sys/bus/w1/devices"
+#define SYS_I2C_DEV_DIR "/sys/class/i2c-dev"
+
+#define DEFAULT_DEVICES "ina219@1:0x40,ina3221@1:0x41,tcs34725@1:0x29,mcp3008@0.0,mcp3008@0.1,ds18b20@28-000000000001"
+
+#define MAX_FDS 1024
+
+#define debug(args...) if (sim_debug) { fprintf(stderr, "[hksim] " args); fputc('\n', stderr); }
+
+typedef enum {
+	FD_NONE=0,
+	FD_I2C,
+	FD_SPI,
+} fd_type_t;
+
+typedef struct {
+	fd_type_t type;
+	int bus;
+	int addr;
+	hksim_spi_dev_t *spi;
+	uint8_t mode;
+	uint8_t bits_per_word;
+	uint32_t speed_hz;
+} sim_fd_t;
+
+static int sim_debug = 0;
+static int sim_latency_us = 0;
+static int sim_i2c_hz = 100000;
+static char sim_w1_dir[64] = "";
+
+static hksim_i2c_dev_t *sim_i2c_devs = NULL;
+static hksim_spi_dev_t *sim_spi_devs = NULL;
+static hksim_w1_dev_t *sim_w1_devs = NULL;
+
+static sim_fd_t sim_fds[MAX_FDS];
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sim_t0 = 0;
+
+static int (*real_open)(const char *path, int flags, ...) = NULL;
+static int (*real_open64)(const char *path, int flags, ...) = NULL;
+static int (*real_close)(int fd) = NULL;
+static int (*real_ioctl)(int fd, unsigned long request, ...) = NULL;
+static int (*real_access)(const char *path, int mode) = NULL;
+static DIR *(*real_opendir)(const char *path) = NULL;
+static FILE *(*real_fopen)(const char *path, const char *mode) = NULL;
+static FILE *(*real_fopen64)(const char *path, const char *mode) = NULL;
+
+
+/*
+ * Simulation environment
+ */
+
+uint64_t hksim_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+double hksim_time(void)
+{
+	return ((double) (hksim_now_us() - sim_t0)) / 1e6;
+}
+
+
+int hksim_getenv_int(char *name, int dflt)
+{
+	char *str = getenv(name);
+
+	if ((str == NULL) || (*str == '\0')) {
+		return dflt;
+	}
+
+	return strtol(str, NULL, 0);
+}
+
+
+double hksim_getenv_float(char *name, double dflt)
+{
+	char *str = getenv(name);
+
+	if ((str == NULL) || (*str == '\0')) {
+		return dflt;
+	}
+
+	return strtod(str, NULL);
+}
+
+
+double hksim_noise(double amplitude)
+{
+	return amplitude * ((2.0 * rand() / RAND_MAX) - 1.0);
+}
+
+
+static void sim_delay_us(uint64_t us)
+{
+	struct timespec ts;
+
+	us += sim_latency_us;
+	if (us == 0) {
+		return;
+	}
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while ((nanosleep(&ts, &ts) < 0) && (errno == EINTR));
+}
+
+
+static int starts_with(const char *str, const char *prefix)
+{
+	return (strncmp(str, prefix, strlen(prefix)) == 0);
+}
+
+
+/*
+ * Device list
+ */
+
+static void sim_add_device(char *spec)
+{
+	char *model = spec;
+	char *loc = strchr(spec, '@');
+
+	if (loc == NULL) {
+		fprintf(stderr, "[hksim] Invalid device spec '%s'\n", spec);
+		return;
+	}
+
+	*(loc++) = '\0';
+
+	if (strcmp(model, "ds18b20") == 0) {
+		hksim_w1_dev_t *dev = hksim_ds18b20_new(loc);
+		dev->next = sim_w1_devs;
+		sim_w1_devs = dev;
+	}
+	else if (strcmp(model, "mcp3008") == 0) {
+		int bus = 0, cs = 0;
+		if (sscanf(loc, "%d.%d", &bus, &cs) != 2) {
+			fprintf(stderr, "[hksim] Invalid SPI location '%s'\n", loc);
+			return;
+		}
+		hksim_spi_dev_t *dev = hksim_mcp3008_new(bus, cs);
+		dev->next = sim_spi_devs;
+		sim_spi_devs = dev;
+	}
+	else {
+		hksim_i2c_dev_t *dev = NULL;
+		int bus = 1;
+		int addr = 0;
+		char *s = strchr(loc, ':');
+
+		if (s == NULL) {
+			fprintf(stderr, "[hksim] Invalid I2C location '%s'\n", loc);
+			return;
+		}
+
+		bus = strtol(loc, NULL, 0);
+		addr = strtol(s+1, NULL, 0);
+
+		if (strcmp(model, "ina219") == 0) {
+			dev = hksim_ina219_new(bus, addr);
+		}
+		else if (strcmp(model, "ina3221") == 0) {
+			dev = hksim_ina3221_new(bus, addr);
+		}
+		else if (strcmp(model, "tcs34725") == 0) {
+			dev = hksim_tcs34725_new(bus, addr);
+		}
+		else {
+			fprintf(stderr, "[hksim] Unknown device model '%s'\n", model);
+			return;
+		}
+
+		dev->next = sim_i2c_devs;
+		sim_i2c_devs = dev;
+	}
+}
+
+
+static void sim_w1_setup(void)
+{
+	hksim_w1_dev_t *dev = sim_w1_devs;
+	char path[128];
+
+	if (dev == NULL) {
+		return;
+	}
+
+	/* Build a fake 1-wire device directory for directory scans */
+	snprintf(sim_w1_dir, sizeof(sim_w1_dir), "/tmp/hksim-w1-XXXXXX");
+	if (mkdtemp(sim_w1_dir) == NULL) {
+		fprintf(stderr, "[hksim] Cannot create 1-wire directory: %s\n", strerror(errno));
+		sim_w1_dir[0] = '\0';
+		return;
+	}
+
+	while (dev != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", sim_w1_dir, dev->id);
+		mkdir(path, 0755);
+		dev = dev->next;
+	}
+}
+
+
+static void sim_w1_cleanup(void)
+{
+	hksim_w1_dev_t *dev = sim_w1_devs;
+	char path[128];
+
+	if (sim_w1_dir[0] == '\0') {
+		return;
+	}
+
+	while (dev != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", sim_w1_dir, dev->id);
+		rmdir(path);
+		dev = dev->next;
+	}
+
+	rmdir(sim_w1_dir);
+}
+
+
+static hksim_i2c_dev_t *sim_i2c_find(int bus, int addr)
+{
+	hksim_i2c_dev_t *dev = sim_i2c_devs;
+
+	while (dev != NULL) {
+		if ((dev->bus == bus) && (dev->addr == addr)) {
+			return dev;
+		}
+		dev = dev->next;
+	}
+
+	return NULL;
+}
+
+
+static hksim_spi_dev_t *sim_spi_find(int bus, int cs)
+{
+	hksim_spi_dev_t *dev = sim_spi_devs;
+
+	while (dev != NULL) {
+		if ((dev->bus == bus) && (dev->cs == cs)) {
+			return dev;
+		}
+		dev = dev->next;
+	}
+
+	return NULL;
+}
+
+
+static hksim_w1_dev_t *sim_w1_find(const char *path)
+{
+	hksim_w1_dev_t *dev = sim_w1_devs;
+
+	while (dev != NULL) {
+		if ((strstr(path, dev->id) != NULL) && (strstr(path, "w1_slave") != NULL)) {
+			return dev;
+		}
+		dev = dev->next;
+	}
+
+	return NULL;
+}
+
+
+__attribute__((constructor))
+static void sim_init(void)
+{
+	char *str;
+	char *spec;
+	char *s1;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_access = dlsym(RTLD_NEXT, "access");
+	real_opendir = dlsym(RTLD_NEXT, "opendir");
+	real_fopen = dlsym(RTLD_NEXT, "fopen");
+	real_fopen64 = dlsym(RTLD_NEXT, "fopen64");
+
+	sim_t0 = hksim_now_us();
+	sim_debug = hksim_getenv_int("HKSIM_DEBUG", 0);
+	sim_latency_us = hksim_getenv_int("HKSIM_LATENCY_US", 0);
+	sim_i2c_hz = hksim_getenv_int("HKSIM_I2C_HZ", 100000);
+	if (sim_i2c_hz <= 0) {
+		sim_i2c_hz = 100000;
+	}
+
+	str = getenv("HKSIM_DEVICES");
+	str = strdup((str != NULL) ? str : DEFAULT_DEVICES);
+
+	for (spec = strtok_r(str, ",", &s1); spec != NULL; spec = strtok_r(NULL, ",", &s1)) {
+		sim_add_device(spec);
+	}
+
+	free(str);
+
+	str = getenv("HKSIM_REPLAY");
+	if ((str != NULL) && (*str != '\0')) {
+		hksim_replay_init(str);
+	}
+
+	sim_w1_setup();
+}
+
+
+__attribute__((destructor))
+static void sim_exit(void)
+{
+	sim_w1_cleanup();
+}
+
+
+/*
+ * I2C bus
+ */
+
+static uint64_t sim_i2c_time_us(int wlen, int rlen)
+{
+	/* Address byte for each direction, 9 clocks per byte */
+	int bytes = wlen + rlen + 1 + ((wlen > 0) && (rlen > 0) ? 1 : 0);
+	return ((uint64_t) bytes * 9 * 1000000) / sim_i2c_hz;
+}
+
+
+static int sim_i2c_xfer(sim_fd_t *sfd, int addr, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen)
+{
+	hksim_i2c_dev_t *dev = sim_i2c_find(sfd->bus, addr);
+	int ret;
+
+	if (hksim_replay_has(BUSLOG_I2C, sfd->bus, addr)) {
+		return hksim_replay_xfer(BUSLOG_I2C, sfd->bus, addr, wbuf, wlen, rbuf, rlen);
+	}
+
+	sim_delay_us(sim_i2c_time_us(wlen, rlen));
+
+	if (dev == NULL) {
+		/* No device acknowledged its address */
+		errno = EREMOTEIO;
+		return -1;
+	}
+
+	pthread_mutex_lock(&sim_mutex);
+	ret = dev->xfer(dev, wbuf, wlen, rbuf, rlen);
+	pthread_mutex_unlock(&sim_mutex);
+
+	if (ret < 0) {
+		errno = EREMOTEIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int sim_i2c_smbus(sim_fd_t *sfd, struct i2c_smbus_ioctl_data *args)
+{
+	union i2c_smbus_data *data = args->data;
+	uint8_t wbuf[I2C_SMBUS_BLOCK_MAX+2];
+	int len;
+
+	debug("i2c-%d@0x%02X: smbus %s cmd=0x%02X size=%u", sfd->bus, sfd->addr,
+	      (args->read_write == I2C_SMBUS_READ) ? "read" : "write", args->command, args->size);
+
+	wbuf[0] = args->command;
+
+	switch (args->size) {
+	case I2C_SMBUS_QUICK:
+		return sim_i2c_xfer(sfd, sfd->addr, NULL, 0, NULL, 0);
+
+	case I2C_SMBUS_BYTE:
+		if (args->read_write == I2C_SMBUS_READ) {
+			return sim_i2c_xfer(sfd, sfd->addr, NULL, 0, &data->byte, 1);
+		}
+		return sim_i2c_xfer(sfd, sfd->addr, wbuf, 1, NULL, 0);
+
+	case I2C_SMBUS_BYTE_DATA:
+		if (args->read_write == I2C_SMBUS_READ) {
+			return sim_i2c_xfer(sfd, sfd->addr, wbuf, 1, &data->byte, 1);
+		}
+		wbuf[1] = data->byte;
+		return sim_i2c_xfer(sfd, sfd->addr, wbuf, 2, NULL, 0);
+
+	case I2C_SMBUS_WORD_DATA:
+		if (args->read_write == I2C_SMBUS_READ) {
+			uint8_t rbuf[2];
+			if (sim_i2c_xfer(sfd, sfd->addr, wbuf, 1, rbuf, 2) < 0) {
+				return -1;
+			}
+			data->word = rbuf[0] | (rbuf[1] << 8);
+			return 0;
+		}
+		wbuf[1] = data->word & 0xFF;
+		wbuf[2] = data->word >> 8;
+		return sim_i2c_xfer(sfd, sfd->addr, wbuf, 3, NULL, 0);
+
+	case I2C_SMBUS_I2C_BLOCK_BROKEN:
+	case I2C_SMBUS_I2C_BLOCK_DATA:
+		len = data->block[0];
+		if (len > I2C_SMBUS_BLOCK_MAX) {
+			len = I2C_SMBUS_BLOCK_MAX;
+		}
+		if (args->read_write == I2C_SMBUS_READ) {
+			return sim_i2c_xfer(sfd, sfd->addr, wbuf, 1, &data->block[1], len);
+		}
+		memcpy(&wbuf[1], &data->block[1], len);
+		return sim_i2c_xfer(sfd, sfd->addr, wbuf, len+1, NULL, 0);
+
+	default:
+		break;
+	}
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+
+static int sim_i2c_rdwr(sim_fd_t *sfd, struct i2c_rdwr_ioctl_data *args)
+{
+	int i;
+
+	for (i = 0; i < (int) args->nmsgs; i++) {
+		struct i2c_msg *msg = &args->msgs[i];
+		struct i2c_msg *next = (i+1 < (int) args->nmsgs) ? &args->msgs[i+1] : NULL;
+		int ret;
+
+		if (msg->flags & I2C_M_RD) {
+			ret = sim_i2c_xfer(sfd, msg->addr, NULL, 0, msg->buf, msg->len);
+		}
+		else if ((next != NULL) && (next->flags & I2C_M_RD) && (next->addr == msg->addr)) {
+			/* Write followed by a read: repeated start */
+			ret = sim_i2c_xfer(sfd, msg->addr, msg->buf, msg->len, next->buf, next->len);
+			i++;
+		}
+		else {
+			ret = sim_i2c_xfer(sfd, msg->addr, msg->buf, msg->len, NULL, 0);
+		}
+
+		if (ret < 0) {
+			return -1;
+		}
+	}
+
+	return args->nmsgs;
+}
+
+
+static int sim_i2c_ioctl(sim_fd_t *sfd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case I2C_SLAVE:
+	case I2C_SLAVE_FORCE:
+		sfd->addr = (long) arg;
+		debug("i2c-%d: select address 0x%02X", sfd->bus, sfd->addr);
+		return 0;
+	case I2C_FUNCS:
+		*((unsigned long *) arg) = I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+		return 0;
+	case I2C_RETRIES:
+	case I2C_TIMEOUT:
+	case I2C_TENBIT:
+	case I2C_PEC:
+		return 0;
+	case I2C_SMBUS:
+		return sim_i2c_smbus(sfd, arg);
+	case I2C_RDWR:
+		return sim_i2c_rdwr(sfd, arg);
+	default:
+		break;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+
+/*
+ * SPI bus
+ */
+
+static int sim_spi_message(sim_fd_t *sfd, struct spi_ioc_transfer *xfers, int n)
+{
+	hksim_spi_dev_t *dev = sfd->spi;
+	uint64_t bits = 0;
+	int total = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct spi_ioc_transfer *xfer = &xfers[i];
+		uint32_t speed_hz = xfer->speed_hz ? xfer->speed_hz : sfd->speed_hz;
+		uint8_t *tx = (uint8_t *) (unsigned long) xfer->tx_buf;
+		uint8_t *rx = (uint8_t *) (unsigned long) xfer->rx_buf;
+		uint8_t txz[xfer->len];
+		uint8_t rxz[xfer->len];
+
+		/* Transfers may be done in place: keep a copy of request bytes */
+		if (tx != NULL) {
+			memcpy(txz, tx, xfer->len);
+		}
+		else {
+			memset(txz, 0, xfer->len);
+		}
+		tx = txz;
+		if (rx == NULL) {
+			rx = rxz;
+		}
+
+		if (hksim_replay_has(BUSLOG_SPI, sfd->bus, sfd->addr)) {
+			if (hksim_replay_xfer(BUSLOG_SPI, sfd->bus, sfd->addr, tx, xfer->len, rx, xfer->len) < 0) {
+				return -1;
+			}
+			total += xfer->len;
+			continue;
+		}
+
+		pthread_mutex_lock(&sim_mutex);
+		dev->xfer(dev, tx, rx, xfer->len, speed_hz);
+		pthread_mutex_unlock(&sim_mutex);
+
+		if (speed_hz > 0) {
+			bits += ((uint64_t) xfer->len * 8 * 1000000) / speed_hz;
+		}
+		bits += xfer->delay_usecs;
+		total += xfer->len;
+	}
+
+	sim_delay_us(bits);
+
+	return total;
+}
+
+
+static int sim_spi_ioctl(sim_fd_t *sfd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case SPI_IOC_WR_MODE:
+		sfd->mode = *((uint8_t *) arg);
+		return 0;
+	case SPI_IOC_RD_MODE:
+		*((uint8_t *) arg) = sfd->mode;
+		return 0;
+	case SPI_IOC_WR_BITS_PER_WORD:
+		sfd->bits_per_word = *((uint8_t *) arg);
+		return 0;
+	case SPI_IOC_RD_BITS_PER_WORD:
+		*((uint8_t *) arg) = sfd->bits_per_word;
+		return 0;
+	case SPI_IOC_WR_MAX_SPEED_HZ:
+		sfd->speed_hz = *((uint32_t *) arg);
+		debug("spidev%d.%d: speed %u Hz", sfd->bus, sfd->addr, sfd->speed_hz);
+		return 0;
+	case SPI_IOC_RD_MAX_SPEED_HZ:
+		*((uint32_t *) arg) = sfd->speed_hz;
+		return 0;
+	default:
+		break;
+	}
+
+	/* SPI_IOC_MESSAGE(n) encodes the transfer array size */
+	if ((_IOC_TYPE(request) == SPI_IOC_MAGIC) && (_IOC_NR(request) == 0) && (_IOC_DIR(request) == _IOC_WRITE)) {
+		int size = _IOC_SIZE(request);
+		if ((size % sizeof(struct spi_ioc_transfer)) == 0) {
+			return sim_spi_message(sfd, arg, size / sizeof(struct spi_ioc_transfer));
+		}
+		errno = EINVAL;
+		return -1;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+
+/*
+ * Device node interception
+ */
+
+static int sim_open(const char *path, int *ret)
+{
+	sim_fd_t sfd;
+	int num, cs;
+	int fd;
+
+	memset(&sfd, 0, sizeof(sfd));
+
+	if (sscanf(path, "/dev/i2c-%d", &num) == 1) {
+		sfd.type = FD_I2C;
+		sfd.bus = num;
+		sfd.addr = -1;
+	}
+	else if (sscanf(path, "/dev/spidev%d.%d", &num, &cs) == 2) {
+		sfd.spi = sim_spi_find(num, cs);
+		if ((sfd.spi == NULL) && !hksim_replay_has(BUSLOG_SPI, num, cs)) {
+			errno = ENOENT;
+			*ret = -1;
+			return 1;
+		}
+		sfd.type = FD_SPI;
+		sfd.bus = num;
+		sfd.addr = cs;
+		sfd.bits_per_word = 8;
+		sfd.speed_hz = 500000;
+	}
+	else {
+		return 0;
+	}
+
+	/* Back simulated devices with a real descriptor */
+	fd = real_open("/dev/null", O_RDWR | O_CLOEXEC);
+	if ((fd >= 0) && (fd < MAX_FDS)) {
+		sim_fds[fd] = sfd;
+	}
+
+	debug("open %s => fd=%d", path, fd);
+
+	*ret = fd;
+	return 1;
+}
+
+
+static int sim_open_mode(int flags, va_list ap)
+{
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		return va_arg(ap, int);
+	}
+	return 0;
+}
+
+
+int open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode;
+	int ret;
+
+	if (sim_open(path, &ret)) {
+		return ret;
+	}
+
+	va_start(ap, flags);
+	mode = sim_open_mode(flags, ap);
+	va_end(ap);
+
+	return real_open(path, flags, mode);
+}
+
+
+int open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode;
+	int ret;
+
+	if (sim_open(path, &ret)) {
+		return ret;
+	}
+
+	va_start(ap, flags);
+	mode = sim_open_mode(flags, ap);
+	va_end(ap);
+
+	return real_open64(path, flags, mode);
+}
+
+
+int __open_2(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+
+int __open64_2(const char *path, int flags)
+{
+	return open64(path, flags);
+}
+
+
+int close(int fd)
+{
+	if ((fd >= 0) && (fd < MAX_FDS) && (sim_fds[fd].type != FD_NONE)) {
+		debug("close fd=%d", fd);
+		sim_fds[fd].type = FD_NONE;
+	}
+
+	return real_close(fd);
+}
+
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if ((fd >= 0) && (fd < MAX_FDS)) {
+		sim_fd_t *sfd = &sim_fds[fd];
+
+		if (sfd->type == FD_I2C) {
+			return sim_i2c_ioctl(sfd, request, arg);
+		}
+		if (sfd->type == FD_SPI) {
+			return sim_spi_ioctl(sfd, request, arg);
+		}
+	}
+
+	return real_ioctl(fd, request, arg);
+}
+
+
+int access(const char *path, int mode)
+{
+	if (starts_with(path, SYS_I2C_DEV_DIR)) {
+		/* Pretend the i2c-dev driver is loaded */
+		return 0;
+	}
+
+	if (starts_with(path, SYS_W1_DIR) && (sim_w1_dir[0] != '\0')) {
+		return 0;
+	}
+
+	return real_access(path, mode);
+}
+
+
+DIR *opendir(const char *path)
+{
+	if (starts_with(path, SYS_W1_DIR) && (sim_w1_dir[0] != '\0')) {
+		debug("opendir %s => %s", path, sim_w1_dir);
+		return real_opendir(sim_w1_dir);
+	}
+
+	return real_opendir(path);
+}
+
+
+static FILE *sim_fopen(const char *path)
+{
+	static __thread char buf[256];
+	hksim_w1_dev_t *dev;
+	int len;
+
+	if (!starts_with(path, SYS_W1_DIR)) {
+		return NULL;
+	}
+
+	dev = sim_w1_find(path);
+	if (dev == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	/* The model blocks for the conversion time, like the w1 driver */
+	len = dev->read(dev, buf, sizeof(buf));
+	debug("read %s => %d bytes", path, len);
+
+	return fmemopen(buf, len, "r");
+}
+
+
+FILE *fopen(const char *path, const char *mode)
+{
+	if (starts_with(path, SYS_W1_DIR)) {
+		return sim_fopen(path);
+	}
+
+	return real_fopen(path, mode);
+}
+
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	if (starts_with(path, SYS_W1_DIR)) {
+		return sim_fopen(path);
+	}
+
+	return real_fopen64(path, mode);
+}
@@ -0,0 +1,69 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator for Raspberry Pi sensor classes
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_HKSIM_H__
+#define __HAKIT_HKSIM_H__
+
+#include <stdint.h>
+
+/* I2C device model: one transaction writes wlen bytes then reads rlen bytes (repeated start) */
+typedef struct hksim_i2c_dev_s hksim_i2c_dev_t;
+struct hksim_i2c_dev_s {
+	char *model;
+	int bus;
+	int addr;
+	int (*xfer)(hksim_i2c_dev_t *dev, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen);
+	void *state;
+	hksim_i2c_dev_t *next;
+};
+
+/* SPI device model: one full-duplex transfer with chip select asserted */
+typedef struct hksim_spi_dev_s hksim_spi_dev_t;
+struct hksim_spi_dev_s {
+	char *model;
+	int bus;
+	int cs;
+	unsigned int max_speed_hz;   // Transfers above this clock are corrupted
+	int (*xfer)(hksim_spi_dev_t *dev, uint8_t *tx, uint8_t *rx, int len, unsigned int speed_hz);
+	void *state;
+	hksim_spi_dev_t *next;
+};
+
+/* 1-wire device model: w1_slave file content */
+typedef struct hksim_w1_dev_s hksim_w1_dev_t;
+struct hksim_w1_dev_s {
+	char *model;
+	char *id;
+	int (*read)(hksim_w1_dev_t *dev, char *buf, int size);
+	void *state;
+	hksim_w1_dev_t *next;
+};
+
+/* Simulation clock and environment */
+extern uint64_t hksim_now_us(void);
+extern double hksim_time(void);
+extern int hksim_getenv_int(char *name, int dflt);
+extern double hksim_getenv_float(char *name, double dflt);
+extern double hksim_noise(double amplitude);
+
+/* Device models */
+extern hksim_i2c_dev_t *hksim_ina219_new(int bus, int addr);
+extern hksim_i2c_dev_t *hksim_ina3221_new(int bus, int addr);
+extern hksim_i2c_dev_t *hksim_tcs34725_new(int bus, int addr);
+extern hksim_spi_dev_t *hksim_mcp3008_new(int bus, int cs);
+extern hksim_w1_dev_t *hksim_ds18b20_new(char *id);
+
+/* Bus log replay */
+extern int hksim_replay_init(char *path);
+extern int hksim_replay_has(int type, int bus, int addr);
+extern int hksim_replay_xfer(int type, int bus, int addr, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen);
+
+#endif /* __HAKIT_HKSIM_H__ */
@@ -0,0 +1,485 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator: I2C chip models (INA219, INA3221, TCS34725)
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hksim.h"
+
+
+static hksim_i2c_dev_t *i2c_dev_new(char *model, int bus, int addr, void *state,
+				    int (*xfer)(hksim_i2c_dev_t *dev, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen))
+{
+	hksim_i2c_dev_t *dev = calloc(1, sizeof(hksim_i2c_dev_t));
+
+	dev->model = model;
+	dev->bus = bus;
+	dev->addr = addr;
+	dev->xfer = xfer;
+	dev->state = state;
+
+	return dev;
+}
+
+
+/*
+ * 16-bit big-endian register file with a register pointer,
+ * common to the INA219 and INA3221.
+ */
+
+typedef struct {
+	uint8_t ptr;
+	uint16_t regs[256];
+	int (*update)(void *state);
+	void (*written)(void *state, uint8_t reg);
+} ina_t;
+
+
+static int ina_xfer(hksim_i2c_dev_t *dev, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen)
+{
+	ina_t *ina = dev->state;
+	int i;
+
+	if (wlen > 0) {
+		/* The class drivers set the SMBus command bit, which the
+		   chips ignore for the low register addresses */
+		uint8_t reg = wbuf[0];
+		if ((reg & 0x80) && (reg < 0xFE)) {
+			reg &= 0x7F;
+		}
+		ina->ptr = reg;
+
+		if (wlen >= 3) {
+			ina->regs[reg] = (wbuf[1] << 8) | wbuf[2];
+			ina->written(ina, reg);
+		}
+	}
+
+	if (rlen > 0) {
+		ina->update(ina);
+
+		for (i = 0; i < rlen; i++) {
+			uint16_t value = ina->regs[ina->ptr];
+			rbuf[i] = (i & 1) ? (value & 0xFF) : (value >> 8);
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * INA219
+ */
+
+#define INA219_CONFIG        0x00
+#define INA219_SHUNT_VOLTAGE 0x01
+#define INA219_BUS_VOLTAGE   0x02
+#define INA219_POWER         0x03
+#define INA219_CURRENT       0x04
+#define INA219_CALIBRATION   0x05
+
+#define INA219_CONFIG_RESET  0x399F
+#define INA219_SHUNT_OHMS    0.1
+
+
+static int ina219_update(void *state)
+{
+	ina_t *ina = state;
+	uint16_t config = ina->regs[INA219_CONFIG];
+	double t = hksim_time();
+	double amps, volts;
+	int16_t shunt, current;
+	int bus;
+
+	/* Power-down and ADC-off modes freeze the conversion registers */
+	if ((config & 0x07) == 0 || (config & 0x07) == 4) {
+		return 0;
+	}
+
+	amps = 0.5 + 0.2 * sin(2 * M_PI * t / 10.0) + hksim_noise(0.002);
+	volts = 12.0 + hksim_noise(0.01);
+
+	shunt = (int16_t) lrint(amps * INA219_SHUNT_OHMS / 10e-6);  // 10uV LSB
+	bus = lrint(volts / 4e-3);                                   // 4mV LSB
+	current = (int16_t) (((int32_t) shunt * ina->regs[INA219_CALIBRATION]) / 4096);
+
+	ina->regs[INA219_SHUNT_VOLTAGE] = (uint16_t) shunt;
+	ina->regs[INA219_BUS_VOLTAGE] = (bus << 3) | 0x02;             // CNVR
+	ina->regs[INA219_CURRENT] = (uint16_t) current;
+	ina->regs[INA219_POWER] = (uint16_t) (((int32_t) current * bus) / 5000);
+
+	return 0;
+}
+
+
+static void ina219_written(void *state, uint8_t reg)
+{
+	ina_t *ina = state;
+
+	if ((reg == INA219_CONFIG) && (ina->regs[INA219_CONFIG] & 0x8000)) {
+		memset(ina->regs, 0, sizeof(ina->regs));
+		ina->regs[INA219_CONFIG] = INA219_CONFIG_RESET;
+	}
+}
+
+
+hksim_i2c_dev_t *hksim_ina219_new(int bus, int addr)
+{
+	ina_t *ina = calloc(1, sizeof(ina_t));
+
+	ina->regs[INA219_CONFIG] = INA219_CONFIG_RESET;
+	ina->update = ina219_update;
+	ina->written = ina219_written;
+
+	return i2c_dev_new("ina219", bus, addr, ina, ina_xfer);
+}
+
+
+/*
+ * INA3221
+ */
+
+#define INA3221_CONFIG       0x00
+#define INA3221_SHUNT(ch)    (0x01 + (ch)*2)
+#define INA3221_BUS(ch)      (0x02 + (ch)*2)
+#define INA3221_MASK_ENABLE  0x0F
+#define INA3221_MANUFACTURER 0xFE
+#define INA3221_DIE          0xFF
+
+#define INA3221_CONFIG_RESET 0x7127
+#define INA3221_SHUNT_OHMS   0.1
+
+
+static int ina3221_update(void *state)
+{
+	static const double bus_volts[3] = { 5.0, 12.0, 3.3 };
+	ina_t *ina = state;
+	uint16_t config = ina->regs[INA3221_CONFIG];
+	double t = hksim_time();
+	int ch;
+
+	/* Power-down mode freezes the conversion registers */
+	if ((config & 0x07) == 0) {
+		return 0;
+	}
+
+	for (ch = 0; ch < 3; ch++) {
+		double amps, volts;
+		int16_t shunt;
+		int16_t bus;
+
+		if ((config & (0x4000 >> ch)) == 0) {
+			continue;
+		}
+
+		amps = 0.1 * (ch+1) * (1.0 + 0.3 * sin(2 * M_PI * t / (5.0 * (ch+1)))) + hksim_noise(0.001);
+		volts = bus_volts[ch] + hksim_noise(0.008);
+
+		shunt = (int16_t) lrint(amps * INA3221_SHUNT_OHMS / 40e-6);  // 40uV LSB
+		bus = (int16_t) lrint(volts / 8e-3);                         // 8mV LSB
+
+		ina->regs[INA3221_SHUNT(ch)] = (uint16_t) (shunt << 3);
+		ina->regs[INA3221_BUS(ch)] = (uint16_t) (bus << 3);
+	}
+
+	ina->regs[INA3221_MASK_ENABLE] |= 0x0001;  // CVRF
+
+	return 0;
+}
+
+
+static void ina3221_written(void *state, uint8_t reg)
+{
+	ina_t *ina = state;
+
+	if ((reg == INA3221_CONFIG) && (ina->regs[INA3221_CONFIG] & 0x8000)) {
+		memset(ina->regs, 0, sizeof(ina->regs));
+		ina->regs[INA3221_CONFIG] = INA3221_CONFIG_RESET;
+		ina->regs[INA3221_MANUFACTURER] = 0x5449;
+		ina->regs[INA3221_DIE] = 0x3220;
+	}
+}
+
+
+hksim_i2c_dev_t *hksim_ina3221_new(int bus, int addr)
+{
+	ina_t *ina = calloc(1, sizeof(ina_t));
+
+	ina->regs[INA3221_CONFIG] = INA3221_CONFIG_RESET | 0x8000;
+	ina->update = ina3221_update;
+	ina->written = ina3221_written;
+	ina3221_written(ina, INA3221_CONFIG);
+
+	return i2c_dev_new("ina3221", bus, addr, ina, ina_xfer);
+}
+
+
+/*
+ * TCS34725
+ */
+
+#define TCS_COMMAND_BIT 0x80
+#define TCS_TYPE(cmd)   (((cmd) >> 5) & 0x03)
+#define TCS_TYPE_REPEAT 0
+#define TCS_TYPE_AUTOINC 1
+#define TCS_TYPE_SF     3
+#define TCS_SF_AINT_CLR 0x06
+
+#define TCS_ENABLE  0x00
+#define TCS_ATIME   0x01
+#define TCS_WTIME   0x03
+#define TCS_AILTL   0x04
+#define TCS_AIHTL   0x06
+#define TCS_PERS    0x0C
+#define TCS_CONFIG  0x0D
+#define TCS_CONTROL 0x0F
+#define TCS_ID      0x12
+#define TCS_STATUS  0x13
+#define TCS_CDATAL  0x14
+
+#define TCS_ENABLE_AIEN 0x10
+#define TCS_ENABLE_WEN  0x08
+#define TCS_ENABLE_AEN  0x02
+#define TCS_ENABLE_PON  0x01
+
+#define TCS_STATUS_AINT   0x10
+#define TCS_STATUS_AVALID 0x01
+
+#define TCS_CYCLE_US 2400
+#define TCS_INIT_US  2400
+#define TCS_FLICKER_HZ 100.0
+
+typedef struct {
+	uint8_t ptr;
+	uint8_t regs[32];
+	uint64_t t_start;      // Time RGBC was enabled
+	uint64_t cycles;       // Completed RGBC cycles
+	int persist;           // Out-of-range cycle counter
+	double flicker;        // Flicker modulation depth
+} tcs_t;
+
+static const double tcs_base[4] = { 300.0, 120.0, 110.0, 90.0 };  // C, R, G, B counts per 2.4ms at 1x
+static const int tcs_gain[4] = { 1, 4, 16, 60 };
+static const int tcs_persist[16] = { 0, 1, 2, 3, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60 };
+
+
+static uint64_t tcs_integ_us(tcs_t *tcs)
+{
+	return (uint64_t) (256 - tcs->regs[TCS_ATIME]) * TCS_CYCLE_US;
+}
+
+
+static uint64_t tcs_wait_us(tcs_t *tcs)
+{
+	uint64_t us;
+
+	if ((tcs->regs[TCS_ENABLE] & TCS_ENABLE_WEN) == 0) {
+		return 0;
+	}
+
+	us = (uint64_t) (256 - tcs->regs[TCS_WTIME]) * TCS_CYCLE_US;
+	if (tcs->regs[TCS_CONFIG] & 0x02) {
+		us *= 12;
+	}
+
+	return us;
+}
+
+
+static double tcs_light(tcs_t *tcs, double t0, double t1)
+{
+	/* Slowly varying light level, with mains flicker averaged over the integration window */
+	double w = 2 * M_PI * TCS_FLICKER_HZ;
+	double level = 1.0 + 0.3 * sin(2 * M_PI * t1 / 60.0);
+	double avg = 0;
+
+	if (t1 > t0) {
+		avg = (cos(w * t0) - cos(w * t1)) / (w * (t1 - t0));
+	}
+
+	return level * (1.0 + tcs->flicker * avg);
+}
+
+
+static void tcs_cycle(tcs_t *tcs, uint64_t t_end)
+{
+	uint64_t integ = tcs_integ_us(tcs);
+	double t1 = ((double) t_end) / 1e6;
+	double t0 = t1 - ((double) integ) / 1e6;
+	double light = tcs_light(tcs, t0, t1);
+	int cycles = 256 - tcs->regs[TCS_ATIME];
+	int gain = tcs_gain[tcs->regs[TCS_CONTROL] & 0x03];
+	int max = (cycles >= 64) ? 65535 : cycles * 1024;
+	uint16_t clear = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		double counts = tcs_base[i] * light * gain * cycles + hksim_noise(2.0);
+		int value = lrint(counts);
+
+		if (value < 0) {
+			value = 0;
+		}
+		if (value > max) {
+			value = max;
+		}
+
+		if (i == 0) {
+			clear = value;
+		}
+
+		tcs->regs[TCS_CDATAL + 2*i] = value & 0xFF;
+		tcs->regs[TCS_CDATAL + 2*i + 1] = value >> 8;
+	}
+
+	tcs->regs[TCS_STATUS] |= TCS_STATUS_AVALID;
+
+	/* Clear channel interrupt with persistence filter */
+	if (tcs->regs[TCS_ENABLE] & TCS_ENABLE_AIEN) {
+		uint16_t low = tcs->regs[TCS_AILTL] | (tcs->regs[TCS_AILTL+1] << 8);
+		uint16_t high = tcs->regs[TCS_AIHTL] | (tcs->regs[TCS_AIHTL+1] << 8);
+		int pers = tcs_persist[tcs->regs[TCS_PERS] & 0x0F];
+
+		if ((clear < low) || (clear > high)) {
+			tcs->persist++;
+		}
+		else {
+			tcs->persist = 0;
+		}
+
+		if ((pers == 0) || (tcs->persist >= pers)) {
+			tcs->regs[TCS_STATUS] |= TCS_STATUS_AINT;
+		}
+	}
+}
+
+
+static void tcs_update(tcs_t *tcs)
+{
+	uint64_t now = hksim_now_us();
+	uint64_t integ, period, first;
+	uint64_t n;
+
+	if ((tcs->regs[TCS_ENABLE] & (TCS_ENABLE_PON | TCS_ENABLE_AEN)) != (TCS_ENABLE_PON | TCS_ENABLE_AEN)) {
+		return;
+	}
+
+	integ = tcs_integ_us(tcs);
+	period = integ + tcs_wait_us(tcs);
+	first = tcs->t_start + TCS_INIT_US + integ;
+
+	if (now < first) {
+		return;
+	}
+
+	n = 1 + (now - first) / period;
+
+	if (n > tcs->cycles) {
+		/* Replay at most a few missed cycles for the persistence filter */
+		uint64_t i = (n - tcs->cycles > 64) ? n - 64 : tcs->cycles + 1;
+
+		for (; i <= n; i++) {
+			tcs_cycle(tcs, first + (i-1) * period);
+		}
+
+		tcs->cycles = n;
+	}
+}
+
+
+static void tcs_write(tcs_t *tcs, uint8_t reg, uint8_t value)
+{
+	if (reg == TCS_ENABLE) {
+		uint8_t old = tcs->regs[TCS_ENABLE];
+		int was_on = (old & TCS_ENABLE_PON) && (old & TCS_ENABLE_AEN);
+		int is_on = (value & TCS_ENABLE_PON) && (value & TCS_ENABLE_AEN);
+
+		if ((value & TCS_ENABLE_PON) == 0) {
+			tcs->regs[TCS_STATUS] = 0;
+		}
+
+		if (is_on && !was_on) {
+			tcs->t_start = hksim_now_us();
+			tcs->cycles = 0;
+			tcs->persist = 0;
+		}
+	}
+
+	if ((reg != TCS_ID) && (reg != TCS_STATUS) && (reg < TCS_CDATAL)) {
+		tcs->regs[reg] = value;
+	}
+}
+
+
+static int tcs_xfer(hksim_i2c_dev_t *dev, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen)
+{
+	tcs_t *tcs = dev->state;
+	int autoinc = 0;
+	int i;
+
+	if (wlen > 0) {
+		uint8_t cmd = wbuf[0];
+
+		if ((cmd & TCS_COMMAND_BIT) == 0) {
+			/* Not a command byte: NACK */
+			return -1;
+		}
+
+		if (TCS_TYPE(cmd) == TCS_TYPE_SF) {
+			if ((cmd & 0x1F) == TCS_SF_AINT_CLR) {
+				tcs->regs[TCS_STATUS] &= ~TCS_STATUS_AINT;
+				tcs->persist = 0;
+			}
+			return 0;
+		}
+
+		tcs->ptr = cmd & 0x1F;
+		autoinc = (TCS_TYPE(cmd) == TCS_TYPE_AUTOINC);
+
+		tcs_update(tcs);
+
+		for (i = 1; i < wlen; i++) {
+			tcs_write(tcs, tcs->ptr, wbuf[i]);
+			if (autoinc) {
+				tcs->ptr = (tcs->ptr + 1) & 0x1F;
+			}
+		}
+	}
+
+	if (rlen > 0) {
+		tcs_update(tcs);
+
+		for (i = 0; i < rlen; i++) {
+			rbuf[i] = tcs->regs[tcs->ptr];
+			if (autoinc) {
+				tcs->ptr = (tcs->ptr + 1) & 0x1F;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+hksim_i2c_dev_t *hksim_tcs34725_new(int bus, int addr)
+{
+	tcs_t *tcs = calloc(1, sizeof(tcs_t));
+
+	tcs->regs[TCS_ATIME] = 0xFF;
+	tcs->regs[TCS_WTIME] = 0xFF;
+	tcs->regs[TCS_ID] = 0x44;
+	tcs->flicker = hksim_getenv_float("HKSIM_TCS_FLICKER", 0.2);
+
+	return i2c_dev_new("tcs34725", bus, addr, tcs, tcs_xfer);
+}
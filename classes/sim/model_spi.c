@@ -0,0 +1,162 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator: SPI chip models (MCP3008)
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hksim.h"
+
+#define MCP3008_CHANNELS 8
+#define MCP3008_MAX 1023
+
+typedef struct {
+	int cs;
+} mcp3008_t;
+
+
+static double mcp3008_signal(mcp3008_t *mcp, int chan, double t)
+{
+	double w = 2 * M_PI * 50.0;  // Mains frequency
+
+	switch (chan) {
+	case 0:  // Mains voltage sensor
+		return 512 + 400 * sin(w * t);
+	case 1:  // Mains current sensor, lagging load
+		return 512 + 200 * sin(w * t - 0.5) + 20 * sin(3 * w * t);
+	case 2:  // Vibration sensor
+		return 512 + 100 * sin(2 * M_PI * 120.0 * t) + 50 * sin(2 * M_PI * 310.0 * t);
+	default:  // Slowly moving DC levels
+		return 128 * chan + 50 * sin(2 * M_PI * t / (10.0 * chan)) + 16 * mcp->cs;
+	}
+}
+
+
+static int mcp3008_convert(mcp3008_t *mcp, int config)
+{
+	int chan = config & 0x07;
+	double value;
+
+	if (config & 0x08) {
+		/* Single-ended input */
+		value = mcp3008_signal(mcp, chan, hksim_time());
+	}
+	else {
+		/* Pseudo-differential pair IN+/IN- */
+		int pair = chan & 0x06;
+		int pos = (chan & 1) ? pair+1 : pair;
+		int neg = (chan & 1) ? pair : pair+1;
+		double t = hksim_time();
+		value = mcp3008_signal(mcp, pos, t) - mcp3008_signal(mcp, neg, t);
+	}
+
+	value += hksim_noise(1.0);
+
+	if (value < 0) {
+		value = 0;
+	}
+	if (value > MCP3008_MAX) {
+		value = MCP3008_MAX;
+	}
+
+	return lrint(value);
+}
+
+
+static int get_bit(uint8_t *buf, int i)
+{
+	return (buf[i/8] >> (7 - (i%8))) & 1;
+}
+
+
+static void set_bit(uint8_t *buf, int i, int bit)
+{
+	if (bit) {
+		buf[i/8] |= 0x80 >> (i%8);
+	}
+	else {
+		buf[i/8] &= ~(0x80 >> (i%8));
+	}
+}
+
+
+static int mcp3008_xfer(hksim_spi_dev_t *dev, uint8_t *tx, uint8_t *rx, int len, unsigned int speed_hz)
+{
+	mcp3008_t *mcp = dev->state;
+	int nbits = len * 8;
+	int start = -1;
+	int value;
+	int i;
+
+	memset(rx, 0, len);
+
+	/* Look for the start bit; DOUT stays high-Z until the null bit */
+	for (i = 0; i < nbits; i++) {
+		if (get_bit(tx, i)) {
+			start = i;
+			break;
+		}
+	}
+
+	if ((start < 0) || (start + 4 >= nbits)) {
+		return 0;
+	}
+
+	value = mcp3008_convert(mcp, (get_bit(tx, start+1) << 3) | (get_bit(tx, start+2) << 2) |
+				(get_bit(tx, start+3) << 1) | get_bit(tx, start+4));
+
+	/* Clocking faster than the sample capacitor can settle corrupts the result */
+	if ((dev->max_speed_hz > 0) && (speed_hz > dev->max_speed_hz)) {
+		double excess = ((double) speed_hz / dev->max_speed_hz) - 1.0;
+		int noise = (int) (excess * 64);
+
+		value ^= rand() & ((1 << (noise < 10 ? noise : 10)) - 1);
+		if ((excess > 0.5) && (rand() & 1)) {
+			set_bit(rx, start+6 < nbits ? start+6 : nbits-1, 1);
+		}
+	}
+
+	/* Null bit, then B9..B0 MSB first, then B1..B9 LSB first */
+	for (i = 0; i < 10; i++) {
+		int k = start + 7 + i;
+		if (k < nbits) {
+			set_bit(rx, k, (value >> (9-i)) & 1);
+		}
+	}
+
+	for (i = 1; i < 10; i++) {
+		int k = start + 16 + i;
+		if (k < nbits) {
+			set_bit(rx, k, (value >> i) & 1);
+		}
+	}
+
+	return 0;
+}
+
+
+hksim_spi_dev_t *hksim_mcp3008_new(int bus, int cs)
+{
+	hksim_spi_dev_t *dev = calloc(1, sizeof(hksim_spi_dev_t));
+	mcp3008_t *mcp = calloc(1, sizeof(mcp3008_t));
+
+	mcp->cs = cs;
+
+	dev->model = "mcp3008";
+	dev->bus = bus;
+	dev->cs = cs;
+	dev->max_speed_hz = hksim_getenv_int("HKSIM_SPI_MAX_HZ", 3600000);
+	dev->xfer = mcp3008_xfer;
+	dev->state = mcp;
+
+	return dev;
+}
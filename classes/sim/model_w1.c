@@ -0,0 +1,113 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator: 1-wire chip models (DS18B20)
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include "hksim.h"
+
+typedef struct {
+	int conv_ms;
+	double offset;
+} ds18b20_t;
+
+
+static uint8_t ds18b20_crc(uint8_t *data, int len)
+{
+	uint8_t crc = 0;
+	int i, j;
+
+	/* Dallas/Maxim CRC8, polynomial x^8 + x^5 + x^4 + 1 */
+	for (i = 0; i < len; i++) {
+		uint8_t byte = data[i];
+		for (j = 0; j < 8; j++) {
+			uint8_t mix = (crc ^ byte) & 0x01;
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			byte >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+
+static int ds18b20_read(hksim_w1_dev_t *dev, char *buf, int size)
+{
+	ds18b20_t *ds = dev->state;
+	struct timespec ts;
+	uint8_t sp[9];
+	double celsius;
+	int16_t raw;
+	int len = 0;
+	int i;
+
+	/* The w1 driver blocks while the conversion is running */
+	ts.tv_sec = ds->conv_ms / 1000;
+	ts.tv_nsec = (ds->conv_ms % 1000) * 1000000;
+	while ((nanosleep(&ts, &ts) < 0) && (errno == EINTR));
+
+	celsius = 21.0 + ds->offset + 2.0 * sin(2 * M_PI * hksim_time() / 600.0) + hksim_noise(0.05);
+	raw = (int16_t) lrint(celsius * 16);
+
+	/* Scratchpad: temperature, TH, TL, config (12 bits), reserved, CRC */
+	sp[0] = raw & 0xFF;
+	sp[1] = (raw >> 8) & 0xFF;
+	sp[2] = 0x4B;
+	sp[3] = 0x46;
+	sp[4] = 0x7F;
+	sp[5] = 0xFF;
+	sp[6] = 0x0C;
+	sp[7] = 0x10;
+	sp[8] = ds18b20_crc(sp, 8);
+
+	for (i = 0; i < 9; i++) {
+		len += snprintf(buf+len, size-len, "%02x ", sp[i]);
+	}
+	len += snprintf(buf+len, size-len, ": crc=%02x YES\n", sp[8]);
+
+	for (i = 0; i < 9; i++) {
+		len += snprintf(buf+len, size-len, "%02x ", sp[i]);
+	}
+	len += snprintf(buf+len, size-len, "t=%d\n", (raw * 1000) / 16);
+
+	return len;
+}
+
+
+hksim_w1_dev_t *hksim_ds18b20_new(char *id)
+{
+	hksim_w1_dev_t *dev = calloc(1, sizeof(hksim_w1_dev_t));
+	ds18b20_t *ds = calloc(1, sizeof(ds18b20_t));
+	char *s;
+	int sum = 0;
+
+	/* Give each probe its own temperature */
+	for (s = id; *s != '\0'; s++) {
+		sum += *s;
+	}
+
+	ds->conv_ms = hksim_getenv_int("HKSIM_W1_MS", 750);
+	ds->offset = (double) (sum % 5);
+
+	dev->model = "ds18b20";
+	dev->id = strdup(id);
+	dev->read = ds18b20_read;
+	dev->state = ds;
+
+	return dev;
+}
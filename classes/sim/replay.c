@@ -0,0 +1,265 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Device simulator: bus transaction log replay
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Transactions recorded with HAKIT_BUSLOG are served back to the classes
+// in place of the device models. Each device (bus type, bus number and
+// address) has its own stream of records. An incoming transaction is
+// matched against the next records of its device stream, looking for the
+// same request bytes, so that the replay survives small divergences like
+// an extra configuration write. A request that matches none of them fails
+// with EIO, and leaves the stream where it was.
+//
+// Timing is kept relative to the first replayed transaction of each
+// stream, and scaled by the HKSIM_REPLAY_SPEED factor (0 = as fast as
+// possible). A stream restarts from the beginning with a new time anchor
+// when exhausted, without disturbing the timing of the other streams.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "buslog.h"
+#include "hksim.h"
+
+#define REPLAY_LOOKAHEAD 32
+
+typedef struct {
+	uint8_t type;
+	uint8_t bus;
+	uint8_t addr;
+	int nrecs;
+	buslog_rec_t **recs;
+	int cursor;
+	uint64_t rec0;         // Record time of anchor (ns)
+	uint64_t play0;        // Replay time of anchor (ns), 0 if not anchored yet
+	unsigned long mismatches;
+} replay_stream_t;
+
+static replay_stream_t *replay_streams = NULL;
+static int replay_nstreams = 0;
+static double replay_speed = 1.0;
+static pthread_mutex_t replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+
+static void sleep_until_ns(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000,
+		.tv_nsec = t % 1000000000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+
+static replay_stream_t *replay_find(int type, int bus, int addr)
+{
+	int i;
+
+	for (i = 0; i < replay_nstreams; i++) {
+		replay_stream_t *stream = &replay_streams[i];
+		if ((stream->type == type) && (stream->bus == bus) && (stream->addr == addr)) {
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void replay_add(buslog_rec_t *rec)
+{
+	replay_stream_t *stream = replay_find(rec->type, rec->bus, rec->addr);
+
+	if (stream == NULL) {
+		replay_streams = realloc(replay_streams, (replay_nstreams+1) * sizeof(replay_stream_t));
+		stream = &replay_streams[replay_nstreams++];
+		memset(stream, 0, sizeof(replay_stream_t));
+		stream->type = rec->type;
+		stream->bus = rec->bus;
+		stream->addr = rec->addr;
+	}
+
+	stream->recs = realloc(stream->recs, (stream->nrecs+1) * sizeof(buslog_rec_t *));
+	stream->recs[stream->nrecs++] = rec;
+}
+
+
+int hksim_replay_init(char *path)
+{
+	buslog_hdr_t *hdr;
+	struct stat st;
+	uint8_t *map;
+	size_t ofs;
+	int count = 0;
+	int fd;
+
+	replay_speed = hksim_getenv_float("HKSIM_REPLAY_SPEED", 1.0);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "[hksim] Cannot open replay log %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t) sizeof(buslog_hdr_t))) {
+		fprintf(stderr, "[hksim] Replay log %s is empty\n", path);
+		close(fd);
+		return -1;
+	}
+
+	/* The mapping stays alive for the process lifetime */
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "[hksim] Cannot map replay log %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	hdr = (buslog_hdr_t *) map;
+	if ((memcmp(hdr->magic, BUSLOG_MAGIC, 4) != 0) || (hdr->version != BUSLOG_VERSION) ||
+	    (hdr->rec_size != sizeof(buslog_rec_t))) {
+		fprintf(stderr, "[hksim] %s is not a supported bus log\n", path);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	ofs = sizeof(buslog_hdr_t);
+	while ((ofs + sizeof(buslog_rec_t)) <= (size_t) st.st_size) {
+		buslog_rec_t *rec = (buslog_rec_t *) (map + ofs);
+		size_t size = sizeof(buslog_rec_t) + rec->tx_len + rec->rx_len;
+
+		if ((ofs + size) > (size_t) st.st_size) {
+			/* Truncated last record */
+			break;
+		}
+
+		replay_add(rec);
+		ofs += size;
+		count++;
+	}
+
+	fprintf(stderr, "[hksim] Replaying %d transactions on %d devices from %s (speed=%g)\n",
+		count, replay_nstreams, path, replay_speed);
+
+	return 0;
+}
+
+
+int hksim_replay_has(int type, int bus, int addr)
+{
+	return (replay_find(type, bus, addr) != NULL);
+}
+
+
+static int replay_match(buslog_rec_t *rec, uint8_t *wbuf, int wlen, int rlen)
+{
+	uint8_t *data = (uint8_t *) (rec + 1);
+
+	if ((rec->tx_len != wlen) || (memcmp(data, wbuf, wlen) != 0)) {
+		return 0;
+	}
+
+	return (rec->status != 0) || (rec->rx_len == rlen);
+}
+
+
+int hksim_replay_xfer(int type, int bus, int addr, uint8_t *wbuf, int wlen, uint8_t *rbuf, int rlen)
+{
+	replay_stream_t *stream = replay_find(type, bus, addr);
+	buslog_rec_t *rec = NULL;
+	uint64_t target = 0;
+	int i;
+
+	if ((stream == NULL) || (stream->nrecs == 0)) {
+		errno = EREMOTEIO;
+		return -1;
+	}
+
+	pthread_mutex_lock(&replay_mutex);
+
+	/* Look for the same request in the next records, wrapping around
+	   to the beginning of the stream */
+	for (i = 0; (i < REPLAY_LOOKAHEAD) && (i < stream->nrecs); i++) {
+		int k = (stream->cursor + i) % stream->nrecs;
+		if (replay_match(stream->recs[k], wbuf, wlen, rlen)) {
+			if (k < stream->cursor) {
+				/* Stream exhausted: start over with a new time anchor */
+				stream->play0 = 0;
+			}
+			rec = stream->recs[k];
+			stream->cursor = k + 1;
+			break;
+		}
+	}
+
+	/* Serving an unrelated record would feed the class with garbage */
+	if (rec == NULL) {
+		if (stream->mismatches++ == 0) {
+			fprintf(stderr, "[hksim] Replay: no record matches a %d-byte request to %s-%d@0x%02X\n",
+				wlen, (type == BUSLOG_SPI) ? "spi" : "i2c", bus, addr);
+		}
+		pthread_mutex_unlock(&replay_mutex);
+		errno = EIO;
+		return -1;
+	}
+
+	if (stream->play0 == 0) {
+		stream->play0 = now_ns();
+		stream->rec0 = rec->t;
+	}
+
+	if ((replay_speed > 0) && (rec->t >= stream->rec0)) {
+		target = stream->play0 + (uint64_t) ((rec->t - stream->rec0) / replay_speed);
+		target += (uint64_t) (rec->duration / replay_speed);
+	}
+
+	if (stream->cursor >= stream->nrecs) {
+		/* Stream exhausted: start over with a new time anchor */
+		stream->cursor = 0;
+		stream->play0 = 0;
+	}
+
+	pthread_mutex_unlock(&replay_mutex);
+
+	if (target > 0) {
+		sleep_until_ns(target);
+	}
+
+	if (rec->status != 0) {
+		errno = rec->status;
+		return -1;
+	}
+
+	if (rlen > 0) {
+		memset(rbuf, 0, rlen);
+		memcpy(rbuf, ((uint8_t *) (rec + 1)) + rec->tx_len, (rec->rx_len < rlen) ? rec->rx_len : rlen);
+	}
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Light flicker analysis
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// Only a handful of candidate frequencies are relevant for mains-powered
+// lighting, so a Goertzel filter per candidate is much cheaper than a
+// full FFT over the sample buffer.
+
+#include <math.h>
+
+#include "flicker.h"
+
+#define MIN_AMPLITUDE 0.01  // Ignore ripple below 1% of mean level
+
+static const float freqs[] = { 50, 60, 100, 120 };
+#define NFREQS ((int) (sizeof(freqs) / sizeof(freqs[0])))
+
+
+static float goertzel(uint16_t *buf, int size, float mean, float f, float fs)
+{
+        float coeff = 2 * cosf(2 * M_PI * f / fs);
+        float s1 = 0;
+        float s2 = 0;
+        int i;
+
+        for (i = 0; i < size; i++) {
+                float s = (buf[i] - mean) + (coeff * s1) - s2;
+                s2 = s1;
+                s1 = s;
+        }
+
+        float power = (s1 * s1) + (s2 * s2) - (coeff * s1 * s2);
+        if (power < 0) {
+                power = 0;
+        }
+
+        /* Peak amplitude of the sine component */
+        return 2 * sqrtf(power) / size;
+}
+
+
+int flicker_analyze(uint16_t *buf, int size, float fs, flicker_t *result)
+{
+        unsigned int min = 0xFFFF;
+        unsigned int max = 0;
+        float sum = 0;
+        int i;
+
+        result->percent = 0;
+        result->freq = 0;
+        result->amplitude = 0;
+
+        if (size <= 0) {
+                return -1;
+        }
+
+        for (i = 0; i < size; i++) {
+                unsigned int v = buf[i];
+                if (v < min) {
+                        min = v;
+                }
+                if (v > max) {
+                        max = v;
+                }
+                sum += v;
+        }
+
+        float mean = sum / size;
+        if (mean <= 0) {
+                return 0;
+        }
+
+        result->percent = (100.0 * (max - min)) / (max + min);
+
+        /* Find dominant frequency among those below Nyquist */
+        for (i = 0; i < NFREQS; i++) {
+                if (freqs[i] < (fs / 2)) {
+                        float amplitude = goertzel(buf, size, mean, freqs[i], fs) / mean;
+                        if (amplitude > result->amplitude) {
+                                result->amplitude = amplitude;
+                                result->freq = freqs[i];
+                        }
+                }
+        }
+
+        if (result->amplitude < MIN_AMPLITUDE) {
+                result->freq = 0;
+        }
+
+        return 0;
+}
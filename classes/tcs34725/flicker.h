@@ -0,0 +1,25 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Light flicker analysis
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __FLICKER_H__
+#define __FLICKER_H__
+
+#include <stdint.h>
+
+typedef struct {
+        float percent;     // Percent flicker: 100 * (max-min) / (max+min)
+        float freq;        // Dominant flicker frequency in Hz, 0 if none found
+        float amplitude;   // Dominant frequency amplitude, relative to mean level
+} flicker_t;
+
+extern int flicker_analyze(uint16_t *buf, int size, float fs, flicker_t *result);
+
+#endif /* __FLICKER_H__ */
@@ -0,0 +1,255 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Linux sysfs GPIO interrupt primitives
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+// The sysfs GPIO value file signals edges with POLLPRI, which the
+// HAKit main loop does not watch. A helper thread waits for the edges
+// and forwards them through a pipe the main loop can watch. Closing the
+// device signals an eventfd polled along with the GPIO, and joins the
+// thread before its file descriptors are released.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "gpiodev.h"
+
+#define SYS_GPIO_CLASS "/sys/class/gpio/"
+
+
+static int gpiodev_sysfs_write(gpiodev_t *gpiodev, char *name, char *value)
+{
+	char path[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), SYS_GPIO_CLASS "%s", name);
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		log_str("ERROR: %sCannot open %s: %s", gpiodev->hdr, path, strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "%s\n", value);
+	fclose(f);
+
+	return 0;
+}
+
+
+static void *gpiodev_irq_loop(void *_gpiodev)
+{
+	gpiodev_t *gpiodev = _gpiodev;
+	struct pollfd pfd[2] = {
+		{
+			.fd = gpiodev->fd,
+			.events = POLLPRI | POLLERR,
+		},
+		{
+			.fd = gpiodev->stop_fd,
+			.events = POLLIN,
+		},
+	};
+	char c;
+
+	/* Clear initial state */
+	lseek(gpiodev->fd, 0, SEEK_SET);
+	if (read(gpiodev->fd, &c, 1) < 0) {
+		log_str("ERROR: %sCannot read GPIO%d: %s", gpiodev->hdr, gpiodev->num, strerror(errno));
+	}
+
+	while (1) {
+		int ret = poll(pfd, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_str("PANIC: %sCannot poll GPIO%d: %s", gpiodev->hdr, gpiodev->num, strerror(errno));
+			break;
+		}
+
+		/* Device is being closed */
+		if (pfd[1].revents != 0) {
+			break;
+		}
+
+		lseek(gpiodev->fd, 0, SEEK_SET);
+		if (read(gpiodev->fd, &c, 1) < 0) {
+			log_str("ERROR: %sCannot read GPIO%d: %s", gpiodev->hdr, gpiodev->num, strerror(errno));
+			continue;
+		}
+
+		log_debug(3, "%sGPIO%d interrupt, value=%c", gpiodev->hdr, gpiodev->num, c);
+
+		if (write(gpiodev->pipe[1], &c, 1) < 0) {
+			log_str("PANIC: %sCannot forward GPIO%d interrupt: %s", gpiodev->hdr, gpiodev->num, strerror(errno));
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+void gpiodev_init(gpiodev_t *gpiodev)
+{
+	gpiodev->hdr = NULL;
+	gpiodev->num = -1;
+	gpiodev->fd = -1;
+	gpiodev->pipe[0] = -1;
+	gpiodev->pipe[1] = -1;
+	gpiodev->stop_fd = -1;
+	gpiodev->running = 0;
+}
+
+
+int gpiodev_open(gpiodev_t *gpiodev, char *hdr, int num, char *edge)
+{
+	char str[64];
+	int err;
+
+	gpiodev->hdr = strdup(hdr);
+	gpiodev->num = num;
+
+	log_debug(1, "%sOpening GPIO%d interrupt on %s edge", hdr, num, edge);
+
+	/* Export GPIO port, if not already done */
+	snprintf(str, sizeof(str), SYS_GPIO_CLASS "gpio%d", num);
+	if (access(str, F_OK) != 0) {
+		snprintf(str, sizeof(str), "%d", num);
+		if (gpiodev_sysfs_write(gpiodev, "export", str) < 0) {
+			goto failed;
+		}
+	}
+
+	/* Setup GPIO input with edge detection */
+	snprintf(str, sizeof(str), "gpio%d/direction", num);
+	if (gpiodev_sysfs_write(gpiodev, str, "in") < 0) {
+		goto failed;
+	}
+
+	snprintf(str, sizeof(str), "gpio%d/edge", num);
+	if (gpiodev_sysfs_write(gpiodev, str, edge) < 0) {
+		goto failed;
+	}
+
+	/* Open GPIO value */
+	snprintf(str, sizeof(str), SYS_GPIO_CLASS "gpio%d/value", num);
+	gpiodev->fd = open(str, O_RDONLY | O_CLOEXEC);
+	if (gpiodev->fd < 0) {
+		log_str("ERROR: %sCannot open %s: %s", hdr, str, strerror(errno));
+		goto failed;
+	}
+
+	/* Create interrupt forwarding pipe */
+	if (pipe2(gpiodev->pipe, O_CLOEXEC) < 0) {
+		log_str("PANIC: %sCannot create GPIO%d interrupt pipe: %s", hdr, num, strerror(errno));
+		goto failed;
+	}
+
+	fcntl(gpiodev->pipe[0], F_SETFL, O_NONBLOCK);
+
+	/* Create interrupt thread stop event */
+	gpiodev->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (gpiodev->stop_fd < 0) {
+		log_str("PANIC: %sCannot create GPIO%d stop event: %s", hdr, num, strerror(errno));
+		goto failed;
+	}
+
+	/* Create interrupt thread */
+	err = pthread_create(&gpiodev->thr, NULL, gpiodev_irq_loop, gpiodev);
+	if (err != 0) {
+		log_str("PANIC: %sFailed to create GPIO%d interrupt thread: %s", hdr, num, strerror(err));
+		goto failed;
+	}
+
+	gpiodev->running = 1;
+
+	return gpiodev->pipe[0];
+
+failed:
+	gpiodev_close(gpiodev);
+
+	return -1;
+}
+
+
+void gpiodev_close(gpiodev_t *gpiodev)
+{
+	/* Stop interrupt thread before releasing what it uses */
+	if (gpiodev->running) {
+		uint64_t one = 1;
+
+		if (write(gpiodev->stop_fd, &one, sizeof(one)) < 0) {
+			log_str("PANIC: %sCannot stop GPIO%d interrupt thread: %s", gpiodev->hdr, gpiodev->num, strerror(errno));
+			pthread_cancel(gpiodev->thr);
+		}
+
+		pthread_join(gpiodev->thr, NULL);
+		gpiodev->running = 0;
+	}
+
+	if (gpiodev->stop_fd >= 0) {
+		close(gpiodev->stop_fd);
+		gpiodev->stop_fd = -1;
+	}
+
+	if (gpiodev->pipe[0] >= 0) {
+		close(gpiodev->pipe[0]);
+		gpiodev->pipe[0] = -1;
+	}
+
+	if (gpiodev->pipe[1] >= 0) {
+		close(gpiodev->pipe[1]);
+		gpiodev->pipe[1] = -1;
+	}
+
+	if (gpiodev->fd >= 0) {
+		close(gpiodev->fd);
+		gpiodev->fd = -1;
+	}
+
+	if (gpiodev->hdr != NULL) {
+		free(gpiodev->hdr);
+		gpiodev->hdr = NULL;
+	}
+}
+
+
+int gpiodev_irq_fd(gpiodev_t *gpiodev)
+{
+	return gpiodev->pipe[0];
+}
+
+
+int gpiodev_irq_ack(gpiodev_t *gpiodev)
+{
+	char buf[16];
+	int count = 0;
+	int ret;
+
+	/* Drain pending interrupt notifications */
+	while ((ret = read(gpiodev->pipe[0], buf, sizeof(buf))) > 0) {
+		count += ret;
+	}
+
+	return count;
+}
@@ -0,0 +1,34 @@
+/*
+ * HAKit - The Home Automation KIT
+ * Copyright (C) 2026 HAKit contributors
+ *
+ * Linux sysfs GPIO interrupt primitives
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+#ifndef __HAKIT_GPIODEV_H__
+#define __HAKIT_GPIODEV_H__
+
+#include <pthread.h>
+
+typedef struct {
+	char *hdr;
+	int num;
+	int fd;
+	int pipe[2];
+	int stop_fd;           // Interrupt thread stop event
+	pthread_t thr;
+	int running;
+} gpiodev_t;
+
+extern void gpiodev_init(gpiodev_t *gpiodev);
+extern int gpiodev_open(gpiodev_t *gpiodev, char *hdr, int num, char *edge);
+extern void gpiodev_close(gpiodev_t *gpiodev);
+
+extern int gpiodev_irq_fd(gpiodev_t *gpiodev);
+extern int gpiodev_irq_ack(gpiodev_t *gpiodev);
+
+#endif /* __HAKIT_GPIODEV_H__ */
@@ -63,6 +63,12 @@ static inline __s32 i2c_smbus_read_byte_data(int file, __u8 command)
 		return 0x0FF & data.byte;
 }
 
+static inline __s32 i2c_smbus_write_byte(int file, __u8 value)
+{
+	return i2c_smbus_access(file,I2C_SMBUS_WRITE,value,
+	                        I2C_SMBUS_BYTE,NULL);
+}
+
 static inline __s32 i2c_smbus_write_byte_data(int file, __u8 command, 
                                               __u8 value)
 {
@@ -95,6 +101,7 @@ static inline __s32 i2c_smbus_read_i2c_block_data(int file, __u8 command,
 #endif
 
 #include "log.h"
+#include "buslog.h"
 #include "i2cdev.h"
 
 #define SYS_I2C_CLASS "/sys/class/i2c-dev/"
@@ -112,6 +119,9 @@ int i2cdev_init(i2cdev_t *i2cdev, char *hdr)
 
 	i2cdev->hdr = strdup(hdr);
 	i2cdev->fd = -1;
+	i2cdev->num = -1;
+	i2cdev->addr = 0;
+	i2cdev->stats = NULL;
 
         return 0;
 }
@@ -132,6 +142,9 @@ int i2cdev_open(i2cdev_t *i2cdev, int num, unsigned char addr)
 
 	log_debug(3, "%si2cdev_open => fd=%d", i2cdev->hdr, i2cdev->fd);
 
+	i2cdev->num = num;
+	i2cdev->addr = addr;
+
 	// Select device address
 	if (ioctl(i2cdev->fd, I2C_SLAVE, addr) < 0) {
 		log_str("ERROR: %sCould not select I2C address 0x%02X on %s: %s\n", i2cdev->hdr, devname, addr, devname, strerror(errno));
@@ -158,7 +171,15 @@ void i2cdev_close(i2cdev_t *i2cdev)
 
 int i2cdev_read(i2cdev_t *i2cdev, uint8_t command, uint8_t size, uint8_t *data)
 {
-	int ret = i2c_smbus_read_i2c_block_data(i2cdev->fd, command, size, data);
+	struct timespec t0, t1;
+	int ret;
+
+	iostats_start(&t0);
+	buslog_start(&t1);
+	ret = i2c_smbus_read_i2c_block_data(i2cdev->fd, command, size, data);
+	buslog_i2c(i2cdev->num, i2cdev->addr, &t1, command, NULL, 0, data, ret, (ret < 0));
+	iostats_record(i2cdev->stats, IOSTATS_READ, &t0, 1+size, (ret < 0));
+
 	if (ret < 0) {
                 log_str("ERROR: %sFailed to read data from command 0x%02X: %s", i2cdev->hdr, command, strerror(errno));
 	}
@@ -183,9 +204,35 @@ int i2cdev_read_16le(i2cdev_t *i2cdev, uint8_t command, uint16_t *value)
 
 int i2cdev_write(i2cdev_t *i2cdev, uint8_t reg, uint8_t value)
 {
-	int ret = i2c_smbus_write_byte_data(i2cdev->fd, reg, value);
+	struct timespec t0, t1;
+	int ret;
+
+	iostats_start(&t0);
+	buslog_start(&t1);
+	ret = i2c_smbus_write_byte_data(i2cdev->fd, reg, value);
+	buslog_i2c(i2cdev->num, i2cdev->addr, &t1, reg, &value, 1, NULL, 0, (ret < 0));
+	iostats_record(i2cdev->stats, IOSTATS_WRITE, &t0, 2, (ret < 0));
+
 	if (ret < 0) {
 		log_str("ERROR: %sFailed to write register 0x%02X: %s", i2cdev->hdr, reg, strerror(errno));
 	}
         return ret;
 }
+
+
+int i2cdev_command(i2cdev_t *i2cdev, uint8_t command)
+{
+	struct timespec t0, t1;
+	int ret;
+
+	iostats_start(&t0);
+	buslog_start(&t1);
+	ret = i2c_smbus_write_byte(i2cdev->fd, command);
+	buslog_i2c(i2cdev->num, i2cdev->addr, &t1, command, NULL, 0, NULL, 0, (ret < 0));
+	iostats_record(i2cdev->stats, IOSTATS_WRITE, &t0, 1, (ret < 0));
+
+	if (ret < 0) {
+		log_str("ERROR: %sFailed to send command 0x%02X: %s", i2cdev->hdr, command, strerror(errno));
+	}
+        return ret;
+}
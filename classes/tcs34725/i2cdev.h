@@ -14,9 +14,14 @@
 
 #include <stdint.h>
 
+#include "iostats.h"
+
 typedef struct {
 	char *hdr;
 	int fd;
+	int num;               // I2C bus number
+	uint8_t addr;          // I2C slave address
+	iostats_t *stats;
 } i2cdev_t;
 
 extern int i2cdev_init(i2cdev_t *i2cdev, char *hdr);
@@ -26,5 +31,6 @@ extern void i2cdev_close(i2cdev_t *i2cdev);
 extern int i2cdev_read(i2cdev_t *i2cdev, uint8_t command, uint8_t size, uint8_t *data);
 extern int i2cdev_read_16le(i2cdev_t *i2cdev, uint8_t command, uint16_t *value);
 extern int i2cdev_write(i2cdev_t *i2cdev, uint8_t reg, uint8_t value);
+extern int i2cdev_command(i2cdev_t *i2cdev, uint8_t command);
 
 #endif /* __HAKIT_I2CDEV_H__ */
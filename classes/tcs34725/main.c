@@ -15,14 +15,19 @@
 #include <malloc.h>
 #include <errno.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <mqueue.h>
+#include <time.h>
+#include <endian.h>
 
 #include "log.h"
 #include "mod.h"
 #include "sys.h"
 #include "version.h"
 #include "i2cdev.h"
+#include "gpiodev.h"
+#include "flicker.h"
+#include "pub.h"
+#include "worker.h"
+#include "demand.h"
 #include "tcs34725.h"
 
 
@@ -32,10 +37,54 @@
 
 #define DEFAULT_GAIN TCS34725_GAIN_4X
 
+#define DEFAULT_IRQ_WINDOW 10   // Clear channel threshold window, in % of last reading
+#define DEFAULT_IRQ_PERSIST 5   // Consecutive out-of-window cycles required to raise an interrupt
+
+#define CYCLE_US 2400           // Duration of an integration cycle (ATIME step)
+#define PON_DELAY_US 10000      // Delay between power-on and ADC enable
+
+#define WAIT_MAX_STEPS 256       // WTIME register range
+#define WAIT_LONG_FACTOR 12      // WLONG multiplies wait steps by 12
+
+#define LUX_DF 310.0            // Device factor
+#define LUX_R_COEF 0.136
+#define LUX_G_COEF 1.0
+#define LUX_B_COEF -0.444
+#define CCT_COEF 3810.0
+#define CCT_OFFSET 1391
+
+#define FLICKER_MAX_SAMPLES 2048
+#define FLICKER_POLL_US 200      // Status polling interval while waiting for a burst sample
+#define FLICKER_TIMEOUT_US (4 * CYCLE_US) // Longest wait for a burst sample
+
+#define AE_MIN_COUNT 500        // Minimum clear count for a useful colour resolution
+#define AE_LOW_PCT 20           // Lower minimum for short integration times, in % of full scale
+#define AE_HIGH_PCT 80          // Clear count above this % of full scale is too close to saturation
+#define AE_TARGET_PCT 50        // Clear count target upper limit when selecting a new setting
+
 typedef struct {
 	hk_obj_t *obj;
 	char *hdr;
 	i2cdev_t i2cdev;
+        iostats_t iostats;
+        uint8_t enable;
+        gpiodev_t gpiodev;
+        sys_tag_t irq_tag;
+        int irq_window;
+        uint8_t atime_reg;
+        uint8_t gain_reg;
+        int ae;
+        int lowpower;
+        int oneshot;            // Power down between samples
+        int powered;
+        unsigned int wait_us;   // Wait time between integration cycles
+        uint64_t ready_us;      // Time when a fresh integration is available
+        sys_tag_t read_tag;
+        worker_job_t read_job;  // Colour read in progress in a worker thread
+        int read_check;         // Check integration is complete before reading
+        int read_result;        // 0 = read, 1 = integration not complete, -1 = failed
+        uint16_t read_crgb[4];
+        pub_ts_t read_ts;
 	hk_pad_t *trig;
 	hk_pad_t *atime;
 	hk_pad_t *gain;
@@ -43,11 +92,70 @@ typedef struct {
 	hk_pad_t *r;
 	hk_pad_t *g;
 	hk_pad_t *b;
+	hk_pad_t *lux;
+	hk_pad_t *cct;
+        pub_cfg_t pub_cfg;
+        pub_t crgb_pub[4];
+        pub_t lux_pub;
+        pub_t cct_pub;
+        pub_t flicker_pub;
+        pub_t freq_pub;
+        float ga;               // Glass attenuation factor
+        int flicker_size;       // Number of samples per flicker burst
+        uint16_t *flicker_buf;
+        worker_job_t flicker_job; // Flicker burst in progress: bus is owned by the burst thread
+        uint8_t flicker_atime;  // Settings handed over to the burst while it owns the bus
+        uint8_t flicker_enable;
+        int flicker_powered;
+        int flicker_percent;
+        int flicker_freq;
+        pub_ts_t flicker_ts;
+        int flicker_period;     // Time between flicker bursts (ms), 0 if triggered only
+        sys_tag_t flicker_tag;
+        int flicker_pending;    // Burst requested while a colour read owns the bus
+	hk_pad_t *flicker_trig;
+	hk_pad_t *flicker;
+	hk_pad_t *freq;
         int period;
 	sys_tag_t period_tag;
+        demand_t demand;
 } ctx_t;
 
 
+/* Auto-exposure settings by increasing sensitivity.
+   Gain is raised first to keep the shortest possible integration time. */
+static const struct {
+        uint8_t atime;
+        uint8_t gain;
+} ae_ladder[] = {
+        { TCS34725_ATIME_2_4MS, TCS34725_GAIN_1X },
+        { TCS34725_ATIME_2_4MS, TCS34725_GAIN_4X },
+        { TCS34725_ATIME_2_4MS, TCS34725_GAIN_16X },
+        { TCS34725_ATIME_2_4MS, TCS34725_GAIN_60X },
+        { TCS34725_ATIME_24MS, TCS34725_GAIN_60X },
+        { TCS34725_ATIME_50MS, TCS34725_GAIN_60X },
+        { TCS34725_ATIME_101MS, TCS34725_GAIN_60X },
+        { TCS34725_ATIME_154MS, TCS34725_GAIN_60X },
+        { TCS34725_ATIME_700MS, TCS34725_GAIN_60X },
+};
+
+#define AE_NSTEPS ((int) (sizeof(ae_ladder) / sizeof(ae_ladder[0])))
+
+
+static uint64_t now_us(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((uint64_t) ts.tv_sec) * 1000000 + (ts.tv_nsec / 1000);
+}
+
+
+static inline unsigned int integration_us(uint8_t atime_reg)
+{
+        return (256 - atime_reg) * CYCLE_US;
+}
+
+
 static int tcs34725_check_id(i2cdev_t *i2cdev)
 {
         int ret = 0;
@@ -69,45 +177,63 @@ static int tcs34725_check_id(i2cdev_t *i2cdev)
 }
 
 
-static int tcs34725_enable_aen(i2cdev_t *i2cdev)
+static int tcs34725_enable_aen(ctx_t *ctx)
 {
-        i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, (TCS34725_ENABLE_PON | TCS34725_ENABLE_AEN));
+        /* Bus is owned by a flicker burst, which sets ENABLE on return */
+        if (worker_busy(&ctx->flicker_job)) {
+                return 0;
+        }
+
+        i2cdev_write(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, ctx->enable);
         return 0;
 }
 
 
-static int tcs34725_enable(i2cdev_t *i2cdev)
+static int tcs34725_enable(ctx_t *ctx)
 {
         /* Set Power-on enable flag */
-        if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, TCS34725_ENABLE_PON) < 0) {
+        if (i2cdev_write(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, TCS34725_ENABLE_PON) < 0) {
                 return -1;
         }
 
-        /* Wait 10ms then set the ADC enable flag */
-        sys_timeout(10, (sys_func_t) tcs34725_enable_aen, i2cdev);
+        ctx->powered = 1;
+
+        /* Wait 10ms then set the ADC (and interrupt) enable flags */
+        sys_timeout(PON_DELAY_US / 1000, (sys_func_t) tcs34725_enable_aen, ctx);
+
+        /* First integration completes after the ADC warm-up cycle */
+        ctx->ready_us = now_us() + PON_DELAY_US + CYCLE_US + integration_us(ctx->atime_reg);
 
         return 0;
 }
 
 
-#if 0
-static int tcs34725_disable(i2cdev_t *i2cdev)
+static int tcs34725_disable(ctx_t *ctx)
 {
-        uint8_t reg = 0;
+        uint8_t reg = ctx->enable & ~(TCS34725_ENABLE_PON | TCS34725_ENABLE_AEN);
 
-        if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, 1, &reg) != 1) {
+        if (i2cdev_write(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, reg) < 0) {
                 return -1;
         }
 
-        reg &= ~(TCS34725_ENABLE_PON | TCS34725_ENABLE_AEN);
+        ctx->powered = 0;
+
+        return 0;
+}
+
 
-        if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, reg) < 0) {
+static int tcs34725_set_wait_time(i2cdev_t *i2cdev, uint8_t wtime, int wlong)
+{
+        if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_WTIME, wtime) < 0) {
+                return -1;
+        }
+
+        if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_CONFIG, wlong ? TCS34725_CONFIG_WLONG : 0) < 0) {
                 return -1;
         }
 
         return 0;
 }
-#endif
 
 
 static int tcs34725_set_integration_time(i2cdev_t *i2cdev, uint8_t atime)
@@ -130,12 +256,67 @@ static int tcs34725_set_gain(i2cdev_t *i2cdev, uint8_t gain)
 }
 
 
+static int tcs34725_set_persistence(i2cdev_t *i2cdev, int cycles)
+{
+        static const int tab[] = { 0, 1, 2, 3, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60 };
+        uint8_t pers = 0;
+
+        while ((pers < 15) && (tab[pers] < cycles)) {
+                pers++;
+        }
+
+        if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_PERS, pers) < 0) {
+                return -1;
+        }
+
+        return tab[pers];
+}
+
+
+static int tcs34725_set_threshold(i2cdev_t *i2cdev, uint16_t low, uint16_t high)
+{
+        uint8_t buf[4] = { low & 0xFF, low >> 8, high & 0xFF, high >> 8 };
+        int i;
+
+        for (i = 0; i < (int) sizeof(buf); i++) {
+                if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|(TCS34725_AILTL+i), buf[i]) < 0) {
+                        return -1;
+                }
+        }
+
+        log_debug(2, "%stcs34725_set_threshold low=%u high=%u", i2cdev->hdr, low, high);
+
+        return 0;
+}
+
+
+static int tcs34725_clear_interrupt(i2cdev_t *i2cdev)
+{
+        if (i2cdev_command(i2cdev, TCS34725_COMMAND_BIT|TCS34725_COMMAND_SF|TCS34725_SF_AINT_CLR) < 0) {
+                return -1;
+        }
+
+        return 0;
+}
+
+
+static int tcs34725_get_status(i2cdev_t *i2cdev, uint8_t *status)
+{
+        if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_STATUS, 1, status) != 1) {
+                return -1;
+        }
+
+        return 0;
+}
+
+
 static int tcs34725_get_raw_data(i2cdev_t *i2cdev, uint16_t crgb[4])
 {
         uint8_t buf[8];
         int i;
 
-        if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_CDATAL, sizeof(buf), buf) < 0) {
+        /* Auto-increment block read: all channels come from the same integration cycle */
+        if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_COMMAND_AUTOINC|TCS34725_CDATAL, sizeof(buf), buf) < 0) {
                 return -1;
         }
 
@@ -163,6 +344,610 @@ static int tcs34725_get_raw_data(i2cdev_t *i2cdev, uint16_t crgb[4])
 }
 
 
+static void publish(ctx_t *ctx, uint16_t crgb[4], int lux, int cct, pub_ts_t *ts)
+{
+        int i;
+
+        for (i = 0; i < 4; i++) {
+                pub_update(&ctx->crgb_pub[i], crgb[i], ts, 0);
+        }
+
+        /* Derived values are not available when the sensor saturates */
+        if (lux >= 0) {
+                pub_update(&ctx->lux_pub, lux, ts, 0);
+                pub_update(&ctx->cct_pub, cct, ts, 0);
+        }
+}
+
+
+static void set_wait_time(ctx_t *ctx)
+{
+        uint8_t enable = ctx->enable & ~TCS34725_ENABLE_WEN;
+        int wait = (ctx->period * 1000) - integration_us(ctx->atime_reg);
+        int steps = 0;
+        int wlong = 0;
+
+        /* Stretch the chip conversion cycle to the sampling period */
+        if (wait >= CYCLE_US) {
+                steps = wait / CYCLE_US;
+                if (steps > WAIT_MAX_STEPS) {
+                        steps = wait / (CYCLE_US * WAIT_LONG_FACTOR);
+                        wlong = 1;
+                }
+                if (steps > WAIT_MAX_STEPS) {
+                        steps = WAIT_MAX_STEPS;
+                }
+
+                if (tcs34725_set_wait_time(&ctx->i2cdev, WAIT_MAX_STEPS - steps, wlong) < 0) {
+                        return;
+                }
+
+                enable |= TCS34725_ENABLE_WEN;
+        }
+
+        ctx->wait_us = steps * CYCLE_US * (wlong ? WAIT_LONG_FACTOR : 1);
+
+        log_debug(1, "%sWait time: %u ms", ctx->hdr, ctx->wait_us / 1000);
+
+        if (enable != ctx->enable) {
+                ctx->enable = enable;
+                if (ctx->powered) {
+                        i2cdev_write(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, ctx->enable);
+                }
+        }
+}
+
+
+static void set_integration_time(ctx_t *ctx, uint8_t atime)
+{
+        unsigned int prev_us = integration_us(ctx->atime_reg);
+
+        if (tcs34725_set_integration_time(&ctx->i2cdev, atime) < 0) {
+                return;
+        }
+
+        /* The running cycle ends with the old setting, the next one gives valid data */
+        ctx->atime_reg = atime;
+        ctx->ready_us = now_us() + prev_us + integration_us(atime);
+
+        /* Keep chip cycle matched with the sampling period */
+        if (ctx->lowpower && !ctx->oneshot) {
+                set_wait_time(ctx);
+        }
+}
+
+
+static void set_gain(ctx_t *ctx, uint8_t gain)
+{
+        if (tcs34725_set_gain(&ctx->i2cdev, gain) < 0) {
+                return;
+        }
+
+        /* Discard the integration cycle in progress */
+        ctx->gain_reg = gain;
+        ctx->ready_us = now_us() + 2 * integration_us(ctx->atime_reg);
+}
+
+
+static inline unsigned int gain_factor(uint8_t gain_reg)
+{
+        static const unsigned int tab[] = { 1, 4, 16, 60 };
+        return tab[gain_reg & 0x03];
+}
+
+
+static inline unsigned int full_scale(uint8_t atime_reg)
+{
+        unsigned int max = (256 - atime_reg) * 1024;
+        return (max > 65535) ? 65535 : max;
+}
+
+
+static inline unsigned int sensitivity(ctx_t *ctx)
+{
+        return (256 - ctx->atime_reg) * gain_factor(ctx->gain_reg);
+}
+
+
+static inline unsigned int ae_min_count(uint8_t atime_reg)
+{
+        /* Full scale is only 1024 at 2.4 ms: leave room for a wide enough band */
+        unsigned int min = (full_scale(atime_reg) * AE_LOW_PCT) / 100;
+        return (min < AE_MIN_COUNT) ? min : AE_MIN_COUNT;
+}
+
+
+static int ae_find_step(uint8_t atime_reg, uint8_t gain_reg)
+{
+        int i;
+
+        for (i = 0; i < AE_NSTEPS; i++) {
+                if ((ae_ladder[i].atime == atime_reg) && (ae_ladder[i].gain == gain_reg)) {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+
+static void ae_update(ctx_t *ctx, unsigned int clear)
+{
+        unsigned int sens = sensitivity(ctx);
+        unsigned int full = full_scale(ctx->atime_reg);
+        unsigned int low = ae_min_count(ctx->atime_reg);
+        unsigned int high = (full * AE_HIGH_PCT) / 100;
+        int step = ae_find_step(ctx->atime_reg, ctx->gain_reg);
+
+        /* Keep current setting while clear count stays in band,
+           or when already at the ladder end it would move to */
+        if (step >= 0) {
+                if ((clear >= low) && (clear <= high)) {
+                        return;
+                }
+                if ((clear < low) && (step == AE_NSTEPS - 1)) {
+                        return;
+                }
+                if ((clear > high) && (step == 0)) {
+                        return;
+                }
+        }
+
+        /* Estimate light level in counts per sensitivity unit.
+           Saturated readings only tell the light is brighter: assume 8 times. */
+        float rate = (clear > 0) ? clear : 1;
+        if (clear >= full) {
+                rate *= 8;
+        }
+        rate /= sens;
+
+        /* Pick the least sensitive (i.e. shortest) setting that gives enough counts
+           without getting close to saturation */
+        int i;
+        int best = 0;
+        for (i = 0; i < AE_NSTEPS; i++) {
+                uint8_t atime = ae_ladder[i].atime;
+                float count = rate * (256 - atime) * gain_factor(ae_ladder[i].gain);
+
+                if (count > (full_scale(atime) * AE_TARGET_PCT) / 100) {
+                        break;
+                }
+
+                best = i;
+                if (count >= 2 * ae_min_count(atime)) {
+                        break;
+                }
+        }
+
+        if (best == step) {
+                return;
+        }
+
+        log_debug(1, "%sAuto-exposure: clear=%u => ATIME=%.1fms gain=%ux", ctx->hdr, clear,
+                  (256 - ae_ladder[best].atime) * 2.4, gain_factor(ae_ladder[best].gain));
+
+        if (ae_ladder[best].atime != ctx->atime_reg) {
+                set_integration_time(ctx, ae_ladder[best].atime);
+        }
+
+        if (ae_ladder[best].gain != ctx->gain_reg) {
+                set_gain(ctx, ae_ladder[best].gain);
+        }
+}
+
+
+static int compute_lux(ctx_t *ctx, uint16_t crgb[4], int *pcct)
+{
+        /* IR-compensated lux and CCT, as per ams DN40 application note */
+        int c = crgb[0];
+        int r = crgb[1];
+        int g = crgb[2];
+        int b = crgb[3];
+
+        if (c >= (int) full_scale(ctx->atime_reg)) {
+                log_debug(2, "%sClear channel saturated: no lux/cct", ctx->hdr);
+                return -1;
+        }
+
+        int ir = (r + g + b - c) / 2;
+        if (ir < 0) {
+                ir = 0;
+        }
+
+        r -= ir;
+        g -= ir;
+        b -= ir;
+
+        /* Counts per lux */
+        float cpl = (integration_us(ctx->atime_reg) / 1000.0) * gain_factor(ctx->gain_reg) / (ctx->ga * LUX_DF);
+
+        float lux = ((LUX_R_COEF * r) + (LUX_G_COEF * g) + (LUX_B_COEF * b)) / cpl;
+        if (lux < 0) {
+                lux = 0;
+        }
+
+        if (r > 0) {
+                *pcct = ((CCT_COEF * b) / r) + CCT_OFFSET;
+        }
+        else {
+                *pcct = 0;
+        }
+
+        return lux + 0.5;
+}
+
+
+static void sample(ctx_t *ctx, uint16_t crgb[4], pub_ts_t *ts)
+{
+        int cct = 0;
+        int lux = compute_lux(ctx, crgb, &cct);
+
+        ctx->ready_us = now_us() + ctx->wait_us + integration_us(ctx->atime_reg);
+        publish(ctx, crgb, lux, cct, ts);
+
+        if (ctx->ae) {
+                ae_update(ctx, crgb[0]);
+        }
+}
+
+
+static int irq_arm(ctx_t *ctx, unsigned int clear)
+{
+        unsigned int full = full_scale(ctx->atime_reg);
+
+        if (clear > full) {
+                clear = full;
+        }
+
+        /* Program clear channel window around the last reading */
+        int delta = (clear * ctx->irq_window) / 100;
+        if (delta < 1) {
+                delta = 1;
+        }
+
+        int low = clear - delta;
+        if (low < 0) {
+                low = 0;
+        }
+
+        int high = clear + delta;
+        if (high > 0xFFFF) {
+                high = 0xFFFF;
+        }
+
+        if (tcs34725_set_threshold(&ctx->i2cdev, low, high) < 0) {
+                return -1;
+        }
+
+        /* Acknowledge the interrupt that led us here, if any */
+        return tcs34725_clear_interrupt(&ctx->i2cdev);
+}
+
+
+static int flicker_wait(i2cdev_t *i2cdev, struct timespec *t)
+{
+        uint8_t status;
+        int waited = 0;
+
+        /* One interrupt per integration cycle: poll for the next one */
+        while (1) {
+                if (tcs34725_get_status(i2cdev, &status) < 0) {
+                        return -1;
+                }
+
+                if (status & TCS34725_STATUS_AINT) {
+                        clock_gettime(CLOCK_MONOTONIC, t);
+                        return 0;
+                }
+
+                if (waited >= FLICKER_TIMEOUT_US) {
+                        log_str("ERROR: %sFlicker burst: integration cycle timeout", i2cdev->hdr);
+                        return -1;
+                }
+
+                usleep(FLICKER_POLL_US);
+                waited += FLICKER_POLL_US;
+        }
+}
+
+
+static int flicker_burst(ctx_t *ctx, flicker_t *result)
+{
+        i2cdev_t *i2cdev = &ctx->i2cdev;
+        uint8_t atime = ctx->flicker_atime;
+        uint8_t pers = 0;
+        struct timespec t, t0 = {0}, t1 = {0};
+        int ret = -1;
+        int i;
+
+        /* Single shot mode: the sensor is powered for the burst only */
+        if (!ctx->flicker_powered) {
+                if (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, TCS34725_ENABLE_PON) < 0) {
+                        return -1;
+                }
+                ctx->flicker_powered = 1;
+                usleep(PON_DELAY_US);
+        }
+
+        if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_PERS, 1, &pers) != 1) {
+                return -1;
+        }
+
+        /* Switch to shortest integration time, with no wait state and
+           an interrupt flag raised at the end of every cycle to tell
+           when a sample is ready */
+        if ((tcs34725_set_integration_time(i2cdev, TCS34725_ATIME_2_4MS) < 0) ||
+            (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_PERS, TCS34725_PERS_NONE) < 0) ||
+            (i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE,
+                          (ctx->flicker_enable & ~TCS34725_ENABLE_WEN) | TCS34725_ENABLE_PON | TCS34725_ENABLE_AEN | TCS34725_ENABLE_AIEN) < 0)) {
+                goto done;
+        }
+
+        /* Let the cycle in progress complete, then start on a fresh one */
+        usleep(integration_us(atime) + 2 * CYCLE_US);
+        if (tcs34725_clear_interrupt(i2cdev) < 0) {
+                goto done;
+        }
+
+        /* Read clear channel once per completed integration cycle */
+        for (i = 0; i < ctx->flicker_size; i++) {
+                if (flicker_wait(i2cdev, &t) < 0) {
+                        goto done;
+                }
+                if (i == 0) {
+                        t0 = t;
+                }
+                t1 = t;
+
+                if (i2cdev_read(i2cdev, TCS34725_COMMAND_BIT|TCS34725_COMMAND_AUTOINC|TCS34725_CDATAL, 2, (uint8_t *) &ctx->flicker_buf[i]) != 2) {
+                        goto done;
+                }
+                ctx->flicker_buf[i] = le16toh(ctx->flicker_buf[i]);
+
+                if (tcs34725_clear_interrupt(i2cdev) < 0) {
+                        goto done;
+                }
+
+                /* Sleep until the end of the next cycle is close */
+                t.tv_nsec += (CYCLE_US - 2 * FLICKER_POLL_US) * 1000;
+                if (t.tv_nsec >= 1000000000) {
+                        t.tv_nsec -= 1000000000;
+                        t.tv_sec++;
+                }
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        }
+
+        /* Use actual sampling rate, from first to last sample */
+        float dt = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+        float fs = (dt > 0) ? ((ctx->flicker_size - 1) / dt) : (1e6 / CYCLE_US);
+
+        ret = flicker_analyze(ctx->flicker_buf, ctx->flicker_size, fs, result);
+
+        log_debug(1, "%sFlicker burst: %d samples at %.1f Hz => %.1f%%, %.0f Hz (%.3f)", ctx->hdr,
+                  ctx->flicker_size, fs, result->percent, result->freq, result->amplitude);
+
+done:
+        /* Restore integration time and interrupt settings */
+        tcs34725_set_integration_time(i2cdev, atime);
+        i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_PERS, pers);
+        i2cdev_write(i2cdev, TCS34725_COMMAND_BIT|TCS34725_ENABLE, ctx->flicker_enable);
+        tcs34725_clear_interrupt(i2cdev);
+
+        return ret;
+}
+
+
+static void flicker_acquire(ctx_t *ctx)
+{
+        flicker_t result;
+
+        /* Runs in a worker thread */
+        ctx->flicker_percent = -1;
+        ctx->flicker_freq = -1;
+
+        pub_ts_get(&ctx->flicker_ts);
+        if (flicker_burst(ctx, &result) == 0) {
+                ctx->flicker_percent = result.percent + 0.5;
+                ctx->flicker_freq = result.freq;
+        }
+}
+
+
+static void flicker_done(ctx_t *ctx)
+{
+        log_debug(2, "%sflicker_done -> %d%%", ctx->hdr, ctx->flicker_percent);
+
+        /* Bus is back to the main loop */
+        ctx->powered = ctx->flicker_powered;
+        ctx->ready_us = now_us() + 2 * integration_us(ctx->atime_reg);
+
+        if (ctx->flicker_percent >= 0) {
+                pub_update(&ctx->flicker_pub, ctx->flicker_percent, &ctx->flicker_ts, 0);
+                pub_update(&ctx->freq_pub, ctx->flicker_freq, &ctx->flicker_ts, 0);
+        }
+
+        /* Sampling was suspended during the burst, or single shot with
+           no colour read waiting for the bus: power down */
+        if (!demand_active(&ctx->demand) || (ctx->oneshot && (ctx->read_tag == 0) && !worker_busy(&ctx->read_job))) {
+                tcs34725_disable(ctx);
+        }
+}
+
+
+static int flicker_start(ctx_t *ctx)
+{
+        /* A burst is already in progress */
+        if (worker_claim(&ctx->flicker_job)) {
+                return 1;
+        }
+
+        /* Hand the bus and the chip settings over to the burst thread,
+           until flicker_done() */
+        ctx->flicker_atime = ctx->atime_reg;
+        ctx->flicker_enable = ctx->enable;
+        ctx->flicker_powered = ctx->powered;
+
+        /* A burst lasts up to seconds: keep it out of the shared worker pool */
+        return worker_spawn(&ctx->flicker_job, "flk", ctx->hdr);
+}
+
+
+static int input_read(ctx_t *ctx)
+{
+        ctx->read_tag = 0;
+
+        /* Bus is owned by a flicker burst: retry when it completes */
+        if (worker_busy(&ctx->flicker_job)) {
+                ctx->read_tag = sys_timeout(CYCLE_US / 1000 + 1, (sys_func_t) input_read, ctx);
+                return 0;
+        }
+
+        /* Integration time was changed by a burst meanwhile: wait for a fresh cycle */
+        uint64_t now = now_us();
+        if (now < ctx->ready_us) {
+                ctx->read_tag = sys_timeout((ctx->ready_us - now + 999) / 1000, (sys_func_t) input_read, ctx);
+                return 0;
+        }
+
+        /* A read is in progress: its result will be published */
+        if (worker_claim(&ctx->read_job)) {
+                return 0;
+        }
+
+        /* Hand the bus over to a worker thread */
+        ctx->read_check = 1;
+        worker_queue(&ctx->read_job);
+
+        return 0;
+}
+
+
+static void read_acquire(ctx_t *ctx)
+{
+        uint8_t status = 0;
+
+        /* Runs in a worker thread */
+        ctx->read_result = -1;
+
+        /* Make sure the integration cycle is complete */
+        if (ctx->read_check) {
+                if (tcs34725_get_status(&ctx->i2cdev, &status) < 0) {
+                        return;
+                }
+
+                if ((status & TCS34725_STATUS_AVALID) == 0) {
+                        ctx->read_result = 1;
+                        return;
+                }
+        }
+
+        /* Read value */
+        pub_ts_get(&ctx->read_ts);
+        if (tcs34725_get_raw_data(&ctx->i2cdev, ctx->read_crgb) == 0) {
+                ctx->read_result = 0;
+        }
+}
+
+
+static void read_done(ctx_t *ctx)
+{
+        if (ctx->read_result > 0) {
+                log_debug(2, "%sIntegration not complete, retrying", ctx->hdr);
+                iostats_retry(&ctx->iostats);
+                ctx->read_tag = sys_timeout(CYCLE_US / 1000 + 1, (sys_func_t) input_read, ctx);
+
+                /* A flicker burst was requested meanwhile: let it go first */
+                if (ctx->flicker_pending) {
+                        ctx->flicker_pending = 0;
+                        if (demand_active(&ctx->demand)) {
+                                flicker_start(ctx);
+                        }
+                }
+                return;
+        }
+
+        if (ctx->read_result == 0) {
+                unsigned int sens = sensitivity(ctx);
+
+                sample(ctx, ctx->read_crgb, &ctx->read_ts);
+
+                /* Interrupt-driven mode: auto-exposure may have changed the
+                   setting, center the window on the count expected with the
+                   new one */
+                if (ctx->irq_tag != 0) {
+                        irq_arm(ctx, ((uint64_t) ctx->read_crgb[0] * sensitivity(ctx)) / sens);
+                }
+        }
+        else if (ctx->irq_tag != 0) {
+                tcs34725_clear_interrupt(&ctx->i2cdev);
+        }
+
+        /* A flicker burst was requested meanwhile: hand the bus over,
+           now that auto-exposure and interrupt settings are written */
+        if (ctx->flicker_pending) {
+                ctx->flicker_pending = 0;
+                if (demand_active(&ctx->demand)) {
+                        flicker_start(ctx);
+                        return;
+                }
+        }
+
+        /* Single shot done, or failed, or sampling suspended meanwhile: power down */
+        if (ctx->oneshot || !demand_active(&ctx->demand)) {
+                tcs34725_disable(ctx);
+        }
+}
+
+
+static int irq_recv(ctx_t *ctx, int fd)
+{
+        (void) fd;
+
+        if (gpiodev_irq_ack(&ctx->gpiodev) <= 0) {
+                return 1;
+        }
+
+        log_debug(2, "%sirq_recv", ctx->hdr);
+
+        /* Bus is owned by a flicker burst: next interrupt will catch up */
+        if (worker_busy(&ctx->flicker_job)) {
+                return 1;
+        }
+
+        /* A read is in progress: it will re-arm the window */
+        if (worker_claim(&ctx->read_job)) {
+                return 1;
+        }
+
+        /* Light moved outside the window: read it and follow it */
+        ctx->read_check = 0;
+        worker_queue(&ctx->read_job);
+
+        return 1;
+}
+
+
+static int flicker_trigger(ctx_t *ctx)
+{
+        /* No consumer: sensor is powered down */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
+
+        /* Bus is owned by a colour read: start the burst when it completes */
+        if (worker_busy(&ctx->read_job)) {
+                ctx->flicker_pending = 1;
+                return 1;
+        }
+
+	if (flicker_start(ctx) < 0) {
+                return 0;
+	}
+
+	return 1;
+}
+
+
 static int _new(hk_obj_t *obj)
 {
 	/* Alloc object context */
@@ -170,16 +955,25 @@ static int _new(hk_obj_t *obj)
 	memset(ctx, 0, sizeof(ctx_t));
 	ctx->obj = obj;
 	obj->ctx = ctx;
+        ctx->enable = TCS34725_ENABLE_PON | TCS34725_ENABLE_AEN;
+        ctx->atime_reg = TCS34725_ATIME_2_4MS;
+        worker_job_init(&ctx->read_job, (worker_func_t) read_acquire, (worker_func_t) read_done, ctx);
+        worker_job_init(&ctx->flicker_job, (worker_func_t) flicker_acquire, (worker_func_t) flicker_done, ctx);
+        gpiodev_init(&ctx->gpiodev);
 
         /* Set debug/error message header */
 	int size = strlen(CLASS_NAME) + strlen(obj->name) + 8;
 	ctx->hdr = malloc(size);
 	snprintf(ctx->hdr, size, CLASS_NAME "(%s): ", obj->name);
 
+        /* Init i/o statistics */
+        iostats_init(&ctx->iostats, obj, ctx->hdr);
+
         /* Init I2C bus interface */
         if (i2cdev_init(&ctx->i2cdev, ctx->hdr) < 0) {
 		goto failed;
         }
+        ctx->i2cdev.stats = &ctx->iostats;
 
 	/* Get I2C device num property */
 	int num = hk_prop_get_int(&obj->props, "num");
@@ -190,6 +984,13 @@ static int _new(hk_obj_t *obj)
         /* Get period property */
 	ctx->period = hk_prop_get_int(&obj->props, "period");
 
+        /* Get interrupt GPIO property */
+        int irq = -1;
+        char *str = hk_prop_get(&obj->props, "irq");
+        if (str != NULL) {
+                irq = atoi(str);
+        }
+
 	/* Open I2C device */
 	if (i2cdev_open(&ctx->i2cdev, num, TCS34725_ADDR) < 0) {
 		goto failed;
@@ -200,8 +1001,112 @@ static int _new(hk_obj_t *obj)
                 goto failed;
         }
 
-        /* Enable sensor */
-        if (tcs34725_enable(&ctx->i2cdev) < 0) {
+        /* Get current integration time */
+        if (i2cdev_read(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_ATIME, 1, &ctx->atime_reg) != 1) {
+                goto failed;
+        }
+
+        /* Get current gain */
+        if (i2cdev_read(&ctx->i2cdev, TCS34725_COMMAND_BIT|TCS34725_CONTROL, 1, &ctx->gain_reg) != 1) {
+                goto failed;
+        }
+
+        /* Colour reads are run by the shared worker pool, flicker bursts by a thread of their own */
+        if (worker_init(&obj->props, ctx->hdr) < 0) {
+                goto failed;
+        }
+
+        /* Get publishing properties */
+        pub_cfg_init(&ctx->pub_cfg, &obj->props);
+
+        /* Get glass attenuation property, for lux computation */
+        ctx->ga = 1.0;
+        str = hk_prop_get(&obj->props, "ga");
+        if (str != NULL) {
+                ctx->ga = atof(str);
+                if (ctx->ga <= 0) {
+                        ctx->ga = 1.0;
+                }
+        }
+
+        /* Get auto-exposure property */
+        str = hk_prop_get(&obj->props, "exposure");
+        if ((str != NULL) && (strcmp(str, "auto") == 0)) {
+                ctx->ae = 1;
+                log_str("%sAuto-exposure enabled", ctx->hdr);
+        }
+
+        /* Setup interrupt-driven sampling */
+        if (irq >= 0) {
+                ctx->irq_window = hk_prop_get_int(&obj->props, "window");
+                if (ctx->irq_window <= 0) {
+                        ctx->irq_window = DEFAULT_IRQ_WINDOW;
+                }
+
+                int persist = DEFAULT_IRQ_PERSIST;
+                str = hk_prop_get(&obj->props, "persist");
+                if (str != NULL) {
+                        persist = atoi(str);
+                }
+
+                persist = tcs34725_set_persistence(&ctx->i2cdev, persist);
+                if (persist < 0) {
+                        goto failed;
+                }
+
+                /* Empty window: first integration cycle will raise an interrupt */
+                if (tcs34725_set_threshold(&ctx->i2cdev, 0xFFFF, 0) < 0) {
+                        goto failed;
+                }
+
+                /* INT output is active low */
+                if (gpiodev_open(&ctx->gpiodev, ctx->hdr, irq, "falling") < 0) {
+                        goto failed;
+                }
+
+                ctx->irq_tag = sys_io_watch(gpiodev_irq_fd(&ctx->gpiodev), (sys_io_func_t) irq_recv, ctx);
+                ctx->enable |= TCS34725_ENABLE_AIEN;
+
+                log_str("%sInterrupt on GPIO%d: window=%d%% persist=%d", ctx->hdr, irq, ctx->irq_window, persist);
+        }
+
+        /* Setup flicker detection mode */
+        ctx->flicker_size = hk_prop_get_int(&obj->props, "flicker");
+        if (ctx->flicker_size > 0) {
+                if (ctx->flicker_size > FLICKER_MAX_SAMPLES) {
+                        ctx->flicker_size = FLICKER_MAX_SAMPLES;
+                }
+
+                ctx->flicker_buf = malloc(ctx->flicker_size * sizeof(uint16_t));
+                ctx->flicker_period = hk_prop_get_int(&obj->props, "flicker_period");
+
+                log_str("%sFlicker detection: %d samples per burst", ctx->hdr, ctx->flicker_size);
+        }
+
+        /* Setup low-power mode */
+        ctx->lowpower = hk_prop_get_int(&obj->props, "lowpower");
+        if (ctx->lowpower) {
+                unsigned int max_wait_us = WAIT_MAX_STEPS * CYCLE_US * WAIT_LONG_FACTOR;
+
+                if ((ctx->period > 0) && (ctx->irq_tag == 0) &&
+                    ((unsigned int) ctx->period * 1000 > max_wait_us + integration_us(TCS34725_ATIME_700MS))) {
+                        /* Period too long for the wait timer: power down between single shots */
+                        ctx->oneshot = 1;
+                        log_str("%sLow-power mode: single shot", ctx->hdr);
+                }
+                else {
+                        set_wait_time(ctx);
+                        log_str("%sLow-power mode: wait time %u ms", ctx->hdr, ctx->wait_us / 1000);
+                }
+        }
+
+        /* Enable sensor, unless powered on demand */
+        if (ctx->oneshot) {
+                if (tcs34725_disable(ctx) < 0) {
+                        goto failed;
+                }
+        }
+        else if (tcs34725_enable(ctx) < 0) {
                 goto failed;
         }
 
@@ -213,11 +1118,45 @@ static int _new(hk_obj_t *obj)
         ctx->r = hk_pad_create(obj, HK_PAD_OUT, "r");
         ctx->g = hk_pad_create(obj, HK_PAD_OUT, "g");
         ctx->b = hk_pad_create(obj, HK_PAD_OUT, "b");
+        ctx->lux = hk_pad_create(obj, HK_PAD_OUT, "lux");
+        ctx->cct = hk_pad_create(obj, HK_PAD_OUT, "cct");
+
+        pub_init(&ctx->crgb_pub[0], ctx->c, &ctx->pub_cfg);
+        pub_init(&ctx->crgb_pub[1], ctx->r, &ctx->pub_cfg);
+        pub_init(&ctx->crgb_pub[2], ctx->g, &ctx->pub_cfg);
+        pub_init(&ctx->crgb_pub[3], ctx->b, &ctx->pub_cfg);
+        pub_init(&ctx->lux_pub, ctx->lux, &ctx->pub_cfg);
+        pub_init(&ctx->cct_pub, ctx->cct, &ctx->pub_cfg);
+
+        if (ctx->flicker_size > 0) {
+                ctx->flicker_trig = hk_pad_create(obj, HK_PAD_IN, "flicker_trig");
+                ctx->flicker = hk_pad_create(obj, HK_PAD_OUT, "flicker");
+                pub_init(&ctx->flicker_pub, ctx->flicker, &ctx->pub_cfg);
+                ctx->freq = hk_pad_create(obj, HK_PAD_OUT, "freq");
+                pub_init(&ctx->freq_pub, ctx->freq, &ctx->pub_cfg);
+        }
 
 	return 0;
 
 failed:
+        if (ctx->flicker_buf != NULL) {
+                free(ctx->flicker_buf);
+                ctx->flicker_buf = NULL;
+        }
+
+        if (ctx->read_tag != 0) {
+                sys_remove(ctx->read_tag);
+                ctx->read_tag = 0;
+        }
+
+        if (ctx->irq_tag != 0) {
+                sys_remove(ctx->irq_tag);
+                ctx->irq_tag = 0;
+        }
+
+        gpiodev_close(&ctx->gpiodev);
 	i2cdev_close(&ctx->i2cdev);
+        iostats_cleanup(&ctx->iostats);
 
 	if (ctx->hdr != NULL) {
 		free(ctx->hdr);
@@ -234,25 +1173,38 @@ failed:
 
 static int input_trig(ctx_t *ctx)
 {
-        /* Read value */
-        uint16_t crgb[4];
-        tcs34725_get_raw_data(&ctx->i2cdev, crgb);
+        /* No consumer: sensor is powered down */
+        if (!demand_active(&ctx->demand)) {
+                return 1;
+        }
 
-        if (crgb[0] != ctx->c->state) {
-                ctx->c->state = crgb[0];
-                hk_pad_update_int(ctx->c, ctx->c->state);
+        /* A read is already scheduled for the upcoming integration, or in progress */
+        if ((ctx->read_tag != 0) || worker_busy(&ctx->read_job)) {
+                return 1;
         }
-        if (crgb[1] != ctx->r->state) {
-                ctx->r->state = crgb[1];
-                hk_pad_update_int(ctx->r, ctx->r->state);
+
+        /* Bus is owned by a flicker burst: read when it completes */
+        if (worker_busy(&ctx->flicker_job)) {
+                ctx->read_tag = sys_timeout(CYCLE_US / 1000 + 1, (sys_func_t) input_read, ctx);
+                return 1;
         }
-        if (crgb[2] != ctx->g->state) {
-                ctx->g->state = crgb[2];
-                hk_pad_update_int(ctx->g, ctx->g->state);
+
+        /* Single shot: power up and wait for the first integration */
+        if (!ctx->powered) {
+                if (tcs34725_enable(ctx) < 0) {
+                        return 1;
+                }
         }
-        if (crgb[3] != ctx->b->state) {
-                ctx->b->state = crgb[3];
-                hk_pad_update_int(ctx->b, ctx->b->state);
+
+        /* Defer read until a fresh integration is available */
+        uint64_t now = now_us();
+        if (now < ctx->ready_us) {
+                unsigned long delay = (ctx->ready_us - now + 999) / 1000;
+                log_debug(2, "%sDeferring read by %lu ms", ctx->hdr, delay);
+                ctx->read_tag = sys_timeout(delay, (sys_func_t) input_read, ctx);
+        }
+        else {
+                input_read(ctx);
         }
 
         return 1;
@@ -282,7 +1234,7 @@ static void input_atime(ctx_t *ctx, int v)
                 atime = TCS34725_ATIME_2_4MS;
         }
 
-        tcs34725_set_integration_time(&ctx->i2cdev, atime);
+        set_integration_time(ctx, atime);
 }
 
 
@@ -303,20 +1255,83 @@ static void input_gain(ctx_t *ctx, int v)
                 gain = TCS34725_GAIN_1X;
         }
 
-        tcs34725_set_gain(&ctx->i2cdev, gain);
+        set_gain(ctx, gain);
+}
+
+
+static void demand_changed(ctx_t *ctx, int active)
+{
+        if (active) {
+                /* Power up the sensor, unless powered on demand */
+                if (!ctx->oneshot && !ctx->powered) {
+                        tcs34725_enable(ctx);
+                }
+
+                /* No polling in interrupt-driven mode */
+                if ((ctx->period > 0) && (ctx->irq_tag == 0) && (ctx->period_tag == 0)) {
+                        ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) input_trig, ctx);
+                }
+
+                if ((ctx->flicker_period > 0) && (ctx->flicker_tag == 0)) {
+                        ctx->flicker_tag = sys_timeout(ctx->flicker_period, (sys_func_t) flicker_trigger, ctx);
+                }
+
+                input_trig(ctx);
+        }
+        else {
+                if (ctx->period_tag != 0) {
+                        sys_remove(ctx->period_tag);
+                        ctx->period_tag = 0;
+                }
+
+                if (ctx->flicker_tag != 0) {
+                        sys_remove(ctx->flicker_tag);
+                        ctx->flicker_tag = 0;
+                }
+
+                if (ctx->read_tag != 0) {
+                        sys_remove(ctx->read_tag);
+                        ctx->read_tag = 0;
+                }
+
+                /* A read or flicker burst owns the bus: power down when it completes */
+                if (!worker_busy(&ctx->read_job) && !worker_busy(&ctx->flicker_job)) {
+                        tcs34725_disable(ctx);
+                }
+        }
 }
 
 
 static void _start(hk_obj_t *obj)
 {
 	ctx_t *ctx = obj->ctx;
+        int i;
 
         if (ctx != NULL) {
+                /* Suspend sampling when no output is consumed */
+                demand_init(&ctx->demand, obj, ctx->hdr, (demand_func_t) demand_changed, ctx);
+                for (i = 0; i < 4; i++) {
+                        demand_add_pub(&ctx->demand, &ctx->crgb_pub[i]);
+                }
+                demand_add_pub(&ctx->demand, &ctx->lux_pub);
+                demand_add_pub(&ctx->demand, &ctx->cct_pub);
+                if (ctx->flicker_size > 0) {
+                        demand_add_pub(&ctx->demand, &ctx->flicker_pub);
+                        demand_add_pub(&ctx->demand, &ctx->freq_pub);
+                }
+
                 input_trig(ctx);
 
-                if (ctx->period > 0) {
+                /* No polling in interrupt-driven mode */
+                if ((ctx->period > 0) && (ctx->irq_tag == 0)) {
                         ctx->period_tag = sys_timeout(ctx->period, (sys_func_t) input_trig, ctx);
                 }
+
+                if (ctx->flicker_period > 0) {
+                        ctx->flicker_tag = sys_timeout(ctx->flicker_period, (sys_func_t) flicker_trigger, ctx);
+                }
+
+                demand_start(&ctx->demand);
         }
 }
 
@@ -333,6 +1348,17 @@ static void _input(hk_pad_t *pad, char *value)
                         input_trig(ctx);
                 }
         }
+        else if (pad == ctx->flicker_trig) {
+                if (v != 0) {
+                        flicker_trigger(ctx);
+                }
+        }
+        else if (ctx->ae) {
+                log_debug(1, "%sAuto-exposure enabled: ignoring %s setting", ctx->hdr, pad->name);
+        }
+        else if (worker_busy(&ctx->flicker_job)) {
+                log_str("%sFlicker burst in progress: ignoring %s setting", ctx->hdr, pad->name);
+        }
         else if (pad == ctx->atime) {
                 input_atime(ctx, v);
         }
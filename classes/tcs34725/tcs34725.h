@@ -14,6 +14,9 @@
 
 #define TCS34725_ADDR        0x29
 #define TCS34725_COMMAND_BIT 0x80
+#define   TCS34725_COMMAND_AUTOINC 0x20  // Auto-increment register address
+#define   TCS34725_COMMAND_SF  0x60  // Special function
+#define   TCS34725_SF_AINT_CLR 0x06  //   Clear channel interrupt clear
 
 #define TCS34725_ENABLE        0x00
 #define   TCS34725_ENABLE_AIEN   0x10 // RGBC Interrupt Enable